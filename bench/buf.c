@@ -0,0 +1,59 @@
+// Buf throughput on pipelined input: appends arrive in recv-sized pieces
+// and are consumed one 9-byte p02 frame at a time.
+//
+//   bench-buf [total_mb] [burst_kb]
+//
+// burst_kb is how much input piles up before the parser runs, e.g. a
+// client pipelining a 1 MB batch of inserts.
+#define _POSIX_C_SOURCE 200809L
+
+#include "buf.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FRAME 9
+#define CHUNK (64 * 1024)
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+  size_t total = (argc > 1 ? strtoull(argv[1], NULL, 10) : 256) << 20;
+  size_t burst = (argc > 2 ? strtoull(argv[2], NULL, 10) : 1024) << 10;
+
+  static uint8_t chunk[CHUNK];
+  for (size_t i = 0; i < CHUNK; i++)
+    chunk[i] = (uint8_t)i;
+
+  Buf b = {0};
+  size_t fed = 0, parsed = 0;
+  uint64_t sum = 0;
+  double t0 = now_s();
+  while (fed < total) {
+    for (size_t got = 0; got < burst && fed < total; got += CHUNK) {
+      if (buf_append(&b, chunk, CHUNK) < 0) {
+        perror("buf_append");
+        return EXIT_FAILURE;
+      }
+      fed += CHUNK;
+    }
+    while (b.len >= FRAME) {
+      sum += b.data[0] + b.data[FRAME - 1];
+      buf_consume(&b, FRAME);
+      parsed += FRAME;
+    }
+  }
+  double dt = now_s() - t0;
+
+  printf("buf: %zu MiB in %zu KiB bursts: %.3f s, %.1f MB/s (checksum %llu)\n",
+         total >> 20, burst >> 10, dt, (double)parsed / dt / 1e6,
+         (unsigned long long)sum);
+  buf_free(&b);
+  return 0;
+}
@@ -0,0 +1,128 @@
+// ht throughput: insert, hit and miss lookups, delete over n string keys.
+//
+//   bench-ht [n] [rounds] [prefix]
+//
+// Keys look like "<prefix>:<i>:<hex>"; the default "user" makes ~19 byte
+// keys, "u" keeps them at 16 bytes or less.
+// Keys are generated up front so only table work is timed. Lookups walk
+// the keys in a shuffled order so they do not follow insertion order.
+#define _POSIX_C_SOURCE 200809L
+
+#include "ht.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng = 0x9e3779b97f4a7c15;
+static uint64_t next_rand(void) { // xorshift64
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+static char **make_keys(size_t n, const char *prefix) {
+  char **k = malloc(n * sizeof *k);
+  if (!k)
+    abort();
+  for (size_t i = 0; i < n; i++) {
+    char tmp[48];
+    int len = snprintf(tmp, sizeof tmp, "%s:%zu:%llx", prefix, i,
+                       (unsigned long long)(next_rand() & 0xffffff));
+    k[i] = malloc((size_t)len + 1);
+    if (!k[i])
+      abort();
+    memcpy(k[i], tmp, (size_t)len + 1);
+  }
+  return k;
+}
+
+static void shuffle(char **k, size_t n) {
+  for (size_t i = n - 1; i > 0; i--) {
+    size_t j = next_rand() % (i + 1);
+    char *t = k[i];
+    k[i] = k[j];
+    k[j] = t;
+  }
+}
+
+static void print_hist(const ht *t) {
+  size_t hist[6];
+  size_t longest = ht_probe_hist(t, hist, 6);
+  printf("  probe groups:");
+  for (int i = 0; i < 6; i++)
+    printf(" %s%d=%zu", i == 5 ? ">=" : "", i + 1, hist[i]);
+  printf("  (longest %zu)\n", longest);
+}
+
+static void report(const char *what, size_t ops, double dt) {
+  printf("  %-8s %8.2f Mops/s  (%.1f ns/op)\n", what, (double)ops / dt / 1e6,
+         dt * 1e9 / (double)ops);
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+  int rounds = argc > 2 ? atoi(argv[2]) : 3;
+  const char *prefix = argc > 3 ? argv[3] : "user";
+  if (n == 0 || rounds < 1) {
+    fprintf(stderr, "usage: %s [n] [rounds] [prefix]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  char **keys = make_keys(n, prefix);
+  char **misses = make_keys(n, "x");
+  char **order = malloc(n * sizeof *order);
+  if (!order)
+    abort();
+  memcpy(order, keys, n * sizeof *order);
+  shuffle(order, n);
+
+  printf("ht: %zu keys, best of %d rounds\n", n, rounds);
+  double best[4] = {1e30, 1e30, 1e30, 1e30};
+  size_t found = 0;
+  for (int r = 0; r < rounds; r++) {
+    ht *t = ht_new(16); // start small so growth is part of the insert cost
+    if (!t)
+      abort();
+    double t0 = now_s();
+    for (size_t i = 0; i < n; i++)
+      if (ht_set(t, keys[i], keys[i]) < 0)
+        abort();
+    double t1 = now_s();
+    if (r == 0)
+      print_hist(t); // untimed
+    double t1h = now_s();
+    for (size_t i = 0; i < n; i++)
+      found += ht_get(t, order[i]) != NULL;
+    double t2 = now_s();
+    for (size_t i = 0; i < n; i++)
+      found += ht_get(t, misses[i]) != NULL;
+    double t3 = now_s();
+    for (size_t i = 0; i < n; i++)
+      ht_del(t, order[i]);
+    double t4 = now_s();
+    ht_free(t);
+
+    double d[4] = {t1 - t0, t2 - t1h, t3 - t2, t4 - t3};
+    for (int j = 0; j < 4; j++)
+      if (d[j] < best[j])
+        best[j] = d[j];
+  }
+  report("insert", n, best[0]);
+  report("hit", n, best[1]);
+  report("miss", n, best[2]);
+  report("delete", n, best[3]);
+  if (found != n * (size_t)rounds) {
+    fprintf(stderr, "lookup mismatch: %zu found\n", found);
+    return EXIT_FAILURE;
+  }
+  return 0;
+}
@@ -0,0 +1,152 @@
+// ht_conc scaling: read-heavy (95/5) and write-heavy (50/50) mixes on 1..N
+// threads, next to a plain ht behind one mutex.
+//
+//   bench-htconc [max_threads] [keys] [ms]
+//
+// Threads double from 1 up to max_threads (default: online CPUs). Each run
+// lasts ms milliseconds; writes are half sets, half deletes of random keys.
+#define _GNU_SOURCE
+
+#include "ht.h"
+#include "ht_conc.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct run {
+  int conc; // 1 = ht_conc, 0 = ht + mutex
+  ht_conc *hc;
+  ht *h;
+  pthread_mutex_t lock;
+  unsigned read_pct;
+  _Atomic int go, stop;
+  _Atomic uint64_t ops;
+} run;
+
+static char **keys;
+static size_t nkeys;
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg) {
+  run *r = arg;
+  uint64_t rng = (uint64_t)(uintptr_t)&rng | 1, ops = 0;
+  while (!atomic_load_explicit(&r->go, memory_order_acquire))
+    ;
+  while (!atomic_load_explicit(&r->stop, memory_order_relaxed)) {
+    for (int i = 0; i < 64; i++, ops++) { // check stop once per batch
+      rng ^= rng << 13;
+      rng ^= rng >> 7;
+      rng ^= rng << 17;
+      const char *k = keys[(rng >> 16) % nkeys];
+      unsigned dice = (unsigned)(rng % 100);
+      if (r->conc) {
+        if (dice < r->read_pct)
+          (void)ht_conc_get(r->hc, k);
+        else if (dice & 1)
+          ht_conc_set(r->hc, k, (void *)k);
+        else
+          ht_conc_del(r->hc, k);
+      } else {
+        pthread_mutex_lock(&r->lock);
+        if (dice < r->read_pct)
+          (void)ht_get(r->h, k);
+        else if (dice & 1)
+          ht_set(r->h, k, (void *)k);
+        else
+          ht_del(r->h, k);
+        pthread_mutex_unlock(&r->lock);
+      }
+    }
+  }
+  atomic_fetch_add(&r->ops, ops);
+  return NULL;
+}
+
+static double measure(int conc, unsigned read_pct, int threads, int ms) {
+  run r = {.conc = conc, .read_pct = read_pct};
+  pthread_mutex_init(&r.lock, NULL);
+  if (conc)
+    r.hc = ht_conc_new(nkeys);
+  else
+    r.h = ht_new(nkeys);
+  if (!r.hc && !r.h)
+    abort();
+  for (size_t i = 0; i < nkeys; i++)
+    if (conc ? ht_conc_set(r.hc, keys[i], keys[i])
+             : ht_set(r.h, keys[i], keys[i]))
+      abort();
+
+  pthread_t *t = malloc((size_t)threads * sizeof *t);
+  if (!t)
+    abort();
+  for (int i = 0; i < threads; i++)
+    if (pthread_create(&t[i], NULL, worker, &r) != 0)
+      abort();
+  double t0 = now_s();
+  atomic_store_explicit(&r.go, 1, memory_order_release);
+  struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = ms % 1000 * 1000000L};
+  nanosleep(&ts, NULL);
+  atomic_store(&r.stop, 1);
+  for (int i = 0; i < threads; i++)
+    pthread_join(t[i], NULL);
+  double dt = now_s() - t0;
+
+  free(t);
+  ht_conc_free(r.hc);
+  ht_free(r.h);
+  pthread_mutex_destroy(&r.lock);
+  return (double)atomic_load(&r.ops) / dt / 1e6;
+}
+
+int main(int argc, char **argv) {
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_threads = argc > 1 ? atoi(argv[1]) : (int)(ncpu > 0 ? ncpu : 1);
+  nkeys = argc > 2 ? strtoull(argv[2], NULL, 10) : 100000;
+  int ms = argc > 3 ? atoi(argv[3]) : 500;
+  if (max_threads < 1 || nkeys == 0 || ms < 1) {
+    fprintf(stderr, "usage: %s [max_threads] [keys] [ms]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  keys = malloc(nkeys * sizeof *keys);
+  if (!keys)
+    abort();
+  for (size_t i = 0; i < nkeys; i++) {
+    char tmp[32];
+    int len = snprintf(tmp, sizeof tmp, "user:%zu", i);
+    keys[i] = malloc((size_t)len + 1);
+    if (!keys[i])
+      abort();
+    memcpy(keys[i], tmp, (size_t)len + 1);
+  }
+
+  printf("ht_conc: %zu keys, %d ms per run, %ld online CPUs\n", nkeys, ms,
+         ncpu);
+  printf("  %-6s %7s %16s %16s\n", "mix", "threads", "ht_conc Mops/s",
+         "ht+mutex Mops/s");
+  static const unsigned mixes[] = {95, 50};
+  for (size_t m = 0; m < sizeof mixes / sizeof mixes[0]; m++) {
+    char name[16];
+    snprintf(name, sizeof name, "%u/%u", mixes[m], 100 - mixes[m]);
+    for (int th = 1;; th *= 2) {
+      if (th > max_threads)
+        th = max_threads;
+      printf("  %-6s %7d %16.2f %16.2f\n", name, th,
+             measure(1, mixes[m], th, ms), measure(0, mixes[m], th, ms));
+      fflush(stdout);
+      if (th == max_threads)
+        break;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,145 @@
+// Integer keys three ways: ht with the number spelled out in decimal, ht
+// with its 8 raw bytes, and a uint64_t -> uint64_t HT_DEFINE table.
+//
+//   bench-htgen [n] [rounds]
+//
+// Keys are random 64-bit numbers, generated (and for ht formatted) up
+// front so only table work is timed. Same phases as bench-ht.
+#define _GNU_SOURCE
+
+#include "ht.h"
+#include "ht_gen.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define u64_eq(a, b) ((a) == (b))
+HT_DEFINE(u64map, uint64_t, uint64_t, ht_hash_u64, u64_eq)
+
+enum { DECIMAL, RAW, GEN, MODES };
+static const char *mode_name[MODES] = {"ht decimal", "ht raw", "HT_DEFINE"};
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng = 0x9e3779b97f4a7c15;
+static uint64_t next_rand(void) { // xorshift64
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+static size_t n;
+static uint64_t *keys, *order, *misses;
+static char (*dec)[24], (*dec_order)[24], (*dec_misses)[24];
+
+static void fill_dec(char (*d)[24], const uint64_t *k) {
+  for (size_t i = 0; i < n; i++)
+    snprintf(d[i], sizeof d[i], "%llu", (unsigned long long)k[i]);
+}
+
+// Seconds for insert, hit, miss, delete; found counts successful lookups.
+static void run(int mode, double d[4], size_t *found) {
+  ht *t = NULL;
+  u64map g;
+  if (mode == GEN ? u64map_init(&g, 16) < 0 : !(t = ht_new(16)))
+    abort();
+  double t0 = now_s();
+  for (size_t i = 0; i < n; i++) {
+    if (mode == GEN) {
+      uint64_t *v = u64map_put(&g, keys[i], NULL);
+      if (!v)
+        abort();
+      *v = i;
+    } else if ((mode == DECIMAL ? ht_set(t, dec[i], &keys[i])
+                                : ht_set_n(t, &keys[i], 8, &keys[i])) < 0) {
+      abort();
+    }
+  }
+  double t1 = now_s();
+  for (size_t i = 0; i < n; i++)
+    *found += mode == DECIMAL ? ht_get(t, dec_order[i]) != NULL
+              : mode == RAW   ? ht_get_n(t, &order[i], 8) != NULL
+                              : u64map_get(&g, order[i]) != NULL;
+  double t2 = now_s();
+  for (size_t i = 0; i < n; i++)
+    *found += mode == DECIMAL ? ht_get(t, dec_misses[i]) != NULL
+              : mode == RAW   ? ht_get_n(t, &misses[i], 8) != NULL
+                              : u64map_get(&g, misses[i]) != NULL;
+  double t3 = now_s();
+  for (size_t i = 0; i < n; i++) {
+    if (mode == DECIMAL)
+      ht_del(t, dec_order[i]);
+    else if (mode == RAW)
+      ht_del_n(t, &order[i], 8);
+    else
+      u64map_del(&g, order[i]);
+  }
+  double t4 = now_s();
+  if (mode == GEN)
+    u64map_destroy(&g);
+  else
+    ht_free(t);
+  d[0] = t1 - t0, d[1] = t2 - t1, d[2] = t3 - t2, d[3] = t4 - t3;
+}
+
+int main(int argc, char **argv) {
+  n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+  int rounds = argc > 2 ? atoi(argv[2]) : 3;
+  if (n == 0 || rounds < 1) {
+    fprintf(stderr, "usage: %s [n] [rounds]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  keys = malloc(n * sizeof *keys);
+  order = malloc(n * sizeof *order);
+  misses = malloc(n * sizeof *misses);
+  dec = malloc(n * sizeof *dec);
+  dec_order = malloc(n * sizeof *dec_order);
+  dec_misses = malloc(n * sizeof *dec_misses);
+  if (!keys || !order || !misses || !dec || !dec_order || !dec_misses)
+    abort();
+  for (size_t i = 0; i < n; i++) {
+    keys[i] = next_rand() | 1; // odd keys hit, even ones miss
+    misses[i] = next_rand() & ~(uint64_t)1;
+  }
+  memcpy(order, keys, n * sizeof *order);
+  for (size_t i = n - 1; i > 0; i--) {
+    size_t j = next_rand() % (i + 1);
+    uint64_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+  fill_dec(dec, keys);
+  fill_dec(dec_order, order);
+  fill_dec(dec_misses, misses);
+
+  printf("integer keys: %zu, best of %d rounds, ns/op\n", n, rounds);
+  printf("  %-12s %8s %8s %8s %8s\n", "", "insert", "hit", "miss", "delete");
+  size_t found = 0;
+  for (int mode = 0; mode < MODES; mode++) {
+    double best[4] = {1e30, 1e30, 1e30, 1e30};
+    for (int r = 0; r < rounds; r++) {
+      double d[4];
+      run(mode, d, &found);
+      for (int j = 0; j < 4; j++)
+        if (d[j] < best[j])
+          best[j] = d[j];
+    }
+    printf("  %-12s", mode_name[mode]);
+    for (int j = 0; j < 4; j++)
+      printf(" %8.1f", best[j] * 1e9 / (double)n);
+    printf("\n");
+  }
+  if (found != n * (size_t)rounds * MODES) {
+    fprintf(stderr, "lookup mismatch: %zu found\n", found);
+    return EXIT_FAILURE;
+  }
+  return 0;
+}
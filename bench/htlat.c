@@ -0,0 +1,76 @@
+// ht_set tail latency while a table grows from empty to n keys.
+//
+//   bench-htlat [n] [prefix]
+//
+// Every insert is timed on its own, and percentiles are reported per decade
+// of table size (1k..10k, 10k..100k, ...), so a resize that stalls one
+// unlucky insert shows up in the p99.9 and max columns.
+#define _POSIX_C_SOURCE 200809L
+
+#include "ht.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint32_t pct(const uint32_t *v, size_t n, double p) {
+  size_t i = (size_t)(p * (double)(n - 1));
+  return v[i];
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+  const char *prefix = argc > 2 ? argv[2] : "u";
+  if (n < 1000) {
+    fprintf(stderr, "usage: %s [n >= 1000] [prefix]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  uint32_t *lat = malloc(n * sizeof *lat);
+  ht *t = ht_new(16);
+  if (!lat || !t)
+    abort();
+
+  char key[48];
+  int val;
+  for (size_t i = 0; i < n; i++) {
+    int len = snprintf(key, sizeof key, "%s:%zu", prefix, i);
+    uint64_t t0 = now_ns();
+    if (ht_set_n(t, key, (size_t)len, &val) < 0)
+      abort();
+    uint64_t d = now_ns() - t0;
+    lat[i] = d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+  }
+
+  printf("ht_set latency, %zu keys, ns per insert\n", n);
+  printf("  %-18s %7s %7s %7s %10s\n", "size", "p50", "p99", "p99.9", "max");
+  for (size_t lo = 1000; lo < n; lo *= 10) {
+    size_t hi = lo * 10 < n ? lo * 10 : n;
+    uint32_t *v = lat + lo;
+    size_t m = hi - lo;
+    qsort(v, m, sizeof *v, cmp_u32);
+    char range[48];
+    snprintf(range, sizeof range, "%zu..%zu", lo, hi);
+    printf("  %-18s %7u %7u %7u %10u\n", range, pct(v, m, 0.5),
+           pct(v, m, 0.99), pct(v, m, 0.999), v[m - 1]);
+  }
+  if (ht_len(t) != n) {
+    fprintf(stderr, "len mismatch: %zu\n", ht_len(t));
+    return EXIT_FAILURE;
+  }
+  ht_free(t);
+  free(lat);
+  return 0;
+}
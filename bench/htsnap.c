@@ -0,0 +1,129 @@
+// Warm start: rebuilding an ht through ht_set vs mapping a snapshot.
+//
+//   bench-htsnap [n] [path] [prefix]
+//
+// Builds n keys "<prefix>:<i>", writes them to path (default
+// /tmp/bench-htsnap.snap, removed at the end), then times opening it and
+// the first lookups on the fresh mapping, which pay for the page faults.
+// The file is still in the page cache, as after a quick restart.
+#define _POSIX_C_SOURCE 200809L
+
+#include "ht.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng = 0x9e3779b97f4a7c15;
+static uint64_t next_rand(void) { // xorshift64
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+static long minor_faults(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_minflt;
+}
+
+// Look up count random keys; returns how many were found.
+static size_t lookups(const ht *t, char **keys, size_t n, size_t count) {
+  size_t found = 0;
+  for (size_t i = 0; i < count; i++)
+    found += ht_get(t, keys[next_rand() % n]) != NULL;
+  return found;
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+  const char *path = argc > 2 ? argv[2] : "/tmp/bench-htsnap.snap";
+  const char *prefix = argc > 3 ? argv[3] : "user";
+  if (n == 0) {
+    fprintf(stderr, "usage: %s [n] [path] [prefix]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  char **keys = malloc(n * sizeof *keys);
+  if (!keys)
+    abort();
+  for (size_t i = 0; i < n; i++) {
+    char tmp[48];
+    int len = snprintf(tmp, sizeof tmp, "%s:%zu", prefix, i);
+    keys[i] = malloc((size_t)len + 1);
+    if (!keys[i])
+      abort();
+    memcpy(keys[i], tmp, (size_t)len + 1);
+  }
+
+  printf("ht snapshot: %zu keys\n", n);
+  double t0 = now_s();
+  ht *t = ht_new(0);
+  if (!t)
+    abort();
+  for (size_t i = 0; i < n; i++) // value: the key's index, not a pointer
+    if (ht_set(t, keys[i], (void *)(uintptr_t)(i + 1)) < 0)
+      abort();
+  double t1 = now_s();
+  if (ht_snapshot(t, path) < 0) {
+    perror(path);
+    return EXIT_FAILURE;
+  }
+  double t2 = now_s();
+  size_t heap_count = n < 1000000 ? n : 1000000;
+  double th = now_s();
+  if (lookups(t, keys, n, heap_count) != heap_count)
+    abort();
+  th = now_s() - th;
+  ht_free(t);
+  struct stat st;
+  if (stat(path, &st) < 0)
+    abort();
+  printf("  %-24s %10.1f ms\n", "rebuild with ht_set", (t1 - t0) * 1e3);
+  printf("  %-24s %10.1f ms  (%.1f MiB)\n", "ht_snapshot", (t2 - t1) * 1e3,
+         (double)st.st_size / (1 << 20));
+
+  long f0 = minor_faults();
+  t0 = now_s();
+  ht *m = ht_open_mapped(path);
+  t1 = now_s();
+  if (!m) {
+    fprintf(stderr, "ht_open_mapped failed\n");
+    return EXIT_FAILURE;
+  }
+  printf("  %-24s %10.3f ms\n", "ht_open_mapped", (t1 - t0) * 1e3);
+  for (size_t count = 1000; count <= n && count <= 1000000; count *= 10) {
+    t0 = now_s();
+    size_t found = lookups(m, keys, n, count);
+    t1 = now_s();
+    if (found != count) {
+      fprintf(stderr, "lookup mismatch: %zu of %zu\n", found, count);
+      return EXIT_FAILURE;
+    }
+    char what[32];
+    snprintf(what, sizeof what, "next %zu lookups", count);
+    printf("  %-24s %10.1f ms  (%.0f ns each, %ld faults so far)\n", what,
+           (t1 - t0) * 1e3, (t1 - t0) * 1e9 / (double)count,
+           minor_faults() - f0);
+  }
+  printf("  %-24s %10.1f ms  (%.0f ns each)\n", "same, on the built table",
+         th * 1e3, th * 1e9 / (double)heap_count);
+  if (ht_len(m) != n || ht_get(m, keys[0]) != (void *)(uintptr_t)1) {
+    fprintf(stderr, "snapshot contents differ\n");
+    return EXIT_FAILURE;
+  }
+  ht_free(m);
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,150 @@
+// cJSON parsing of number-heavy lines: p01 requests, and arrays of
+// integers and decimals, with strtod alone on the same numbers as a
+// reference for what the number parser costs.
+//
+//   bench-json [lines]
+//
+// Each shape gets lines distinct lines (default 100000), parsed with
+// cJSON_Parse and freed with cJSON_Delete, three passes, best one kept.
+#define _POSIX_C_SOURCE 200809L
+
+#include "cJSON.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ARRAY_LEN 16
+#define PASSES 3
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng = 0x9e3779b97f4a7c15;
+static uint64_t next_rand(void) { // xorshift64
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+static double rand_double(void) {
+  return (double)(next_rand() >> 11) / (double)(1ull << 53) * 2e6 - 1e6;
+}
+
+// One number as the shape writes it.
+typedef int (*write_fn)(char *s, size_t n);
+
+static int w_small_int(char *s, size_t n) {
+  return snprintf(s, n, "%u", (unsigned)(next_rand() % 1000000));
+}
+static int w_int64(char *s, size_t n) {
+  return snprintf(s, n, "%lld", (long long)next_rand());
+}
+static int w_price(char *s, size_t n) {
+  return snprintf(s, n, "%.2f", rand_double());
+}
+static int w_double(char *s, size_t n) {
+  return snprintf(s, n, "%.17g", rand_double());
+}
+static int w_sci(char *s, size_t n) {
+  return snprintf(s, n, "%.6e", rand_double() * 1e-12);
+}
+
+typedef struct shape {
+  const char *name;
+  write_fn write;
+  int array; // 0: a p01 request, else an array of ARRAY_LEN numbers
+} shape;
+
+// lines lines of the shape, back to back with NUL terminators; the numbers
+// alone go to nums the same way.
+static char *make_lines(const shape *sh, size_t lines, char **nums,
+                        size_t *count) {
+  size_t per = sh->array ? ARRAY_LEN : 1;
+  char *buf = malloc(lines * (per * 32 + 64)), *p = buf;
+  char *q = *nums = malloc(lines * per * 32);
+  if (!buf || !q)
+    abort();
+  *count = 0;
+  for (size_t i = 0; i < lines; i++) {
+    if (!sh->array)
+      p += sprintf(p, "{\"method\":\"isPrime\",\"number\":");
+    else
+      *p++ = '[';
+    for (size_t j = 0; j < per; j++) {
+      int len = sh->write(q, 32);
+      memcpy(p, q, (size_t)len);
+      p += len;
+      q += len + 1;
+      (*count)++;
+      if (sh->array)
+        *p++ = j + 1 < per ? ',' : ']';
+    }
+    if (!sh->array)
+      *p++ = '}';
+    *p++ = '\0';
+  }
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  size_t lines = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000;
+  if (lines == 0) {
+    fprintf(stderr, "usage: %s [lines]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  static const shape shapes[] = {
+      {"request int", w_small_int, 0}, {"request 2dp", w_price, 0},
+      {"int64 x16", w_int64, 1},       {"2dp x16", w_price, 1},
+      {"%.17g x16", w_double, 1},      {"%.6e x16", w_sci, 1},
+  };
+  printf("cJSON_Parse + cJSON_Delete (%zu lines per shape)\n", lines);
+  printf("  %-12s %10s %12s %14s\n", "shape", "ns/line", "Mnumbers/s",
+         "strtod ns/num");
+  volatile double sink = 0; // keeps the values read
+  for (size_t s = 0; s < sizeof shapes / sizeof shapes[0]; s++) {
+    char *nums;
+    size_t count;
+    char *buf = make_lines(&shapes[s], lines, &nums, &count);
+    double best = 1e9, best_strtod = 1e9;
+    for (int pass = 0; pass < PASSES; pass++) {
+      double t0 = now_s();
+      const char *p = buf;
+      for (size_t i = 0; i < lines; i++) {
+        cJSON *j = cJSON_Parse(p);
+        if (!j) {
+          fprintf(stderr, "cJSON rejected %s\n", p);
+          return EXIT_FAILURE;
+        }
+        sink += shapes[s].array ? j->child->valuedouble
+                                : j->child->next->valuedouble;
+        cJSON_Delete(j);
+        p += strlen(p) + 1;
+      }
+      double t = now_s() - t0;
+      best = t < best ? t : best;
+
+      t0 = now_s();
+      p = nums;
+      for (size_t i = 0; i < count; i++) {
+        char *end;
+        sink += strtod(p, &end);
+        p = end + 1;
+      }
+      t = now_s() - t0;
+      best_strtod = t < best_strtod ? t : best_strtod;
+    }
+    printf("  %-12s %10.1f %12.2f %14.1f\n", shapes[s].name,
+           best * 1e9 / (double)lines, (double)count / best / 1e6,
+           best_strtod * 1e9 / (double)count);
+    fflush(stdout);
+    free(buf);
+    free(nums);
+  }
+  return 0;
+}
@@ -0,0 +1,315 @@
+// Loopback load generator for the problem servers.
+//
+//   bench-loadgen -m echo  -c 8 -n 1000000000   stream bytes through p00
+//   bench-loadgen -m means -c 8 -n 1000000      pipelined p02 inserts
+//   bench-loadgen -m chat  -c 32 -n 10000       p03 room, every member talks
+//   bench-loadgen -m prime -c 8 -n 1000000      pipelined p01 isPrime lines
+//
+// Every connection writes its whole payload as fast as the server accepts
+// it and reads until the expected reply size has arrived. Connections stay
+// open until all are done so chat members never see anyone leave.
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct Load {
+  const uint8_t *pattern; // payload, repeated until total bytes are sent
+  size_t plen;
+  size_t total;  // bytes to send
+  size_t expect; // bytes to receive before the connection is done
+  size_t msgs;   // requests per connection, for the msgs/s figure
+} Load;
+
+typedef struct Client {
+  int fd;
+  int done; // 0/1
+  size_t sent, recvd;
+  size_t expect;
+} Client;
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int dial(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    exit(EXIT_FAILURE);
+  }
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+    perror("connect");
+    exit(EXIT_FAILURE);
+  }
+  int yes = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+  return fd;
+}
+
+static void be_put_i32(uint8_t *p, int32_t v) {
+  uint32_t u = htonl((uint32_t)v);
+  memcpy(p, &u, 4);
+}
+
+// n inserts with increasing timestamps, one mean query per 1000 inserts
+static Load means_load(size_t n) {
+  size_t q = n / 1000 + 1;
+  uint8_t *p = malloc((n + q) * 9);
+  if (!p)
+    abort();
+  size_t off = 0;
+  for (size_t i = 0; i < n; i++) {
+    p[off] = 'I';
+    be_put_i32(p + off + 1, (int32_t)i);
+    be_put_i32(p + off + 5, (int32_t)(i % 1000));
+    off += 9;
+    if (i % 1000 == 999) {
+      p[off] = 'Q';
+      be_put_i32(p + off + 1, (int32_t)(i - 999));
+      be_put_i32(p + off + 5, (int32_t)i);
+      off += 9;
+    }
+  }
+  p[off] = 'Q';
+  be_put_i32(p + off + 1, 0);
+  be_put_i32(p + off + 5, (int32_t)n);
+  off += 9;
+  size_t nq = off / 9 - n;
+  return (Load){p, off, off, nq * 4, n + nq};
+}
+
+#define CHAT_LINE "the quick brown fox jumps over the lazy dog\n"
+#define CHAT_NAME_LEN 6 // "u%05zu"
+#define CHAT_ENTERED_LEN (2 + CHAT_NAME_LEN + 22) // "* name has entered..."
+
+// n lines per member; every line comes back once from each other member.
+// Each reply is prefixed with "[name] ".
+static Load chat_load(size_t n, size_t conns) {
+  static const uint8_t line[] = CHAT_LINE;
+  size_t llen = sizeof line - 1;
+  size_t echoed = (conns - 1) * n;
+  return (Load){line, llen, n * llen, echoed * (CHAT_NAME_LEN + 3 + llen),
+                echoed};
+}
+
+static void read_line(int fd) {
+  char ch;
+  for (;;) {
+    ssize_t r = recv(fd, &ch, 1, 0);
+    if (r <= 0) {
+      fprintf(stderr, "chat: server closed during join\n");
+      exit(EXIT_FAILURE);
+    }
+    if (ch == '\n')
+      return;
+  }
+}
+
+// Join members one at a time, so member i is told about each later member.
+static void chat_join(Client *cl, size_t conns) {
+  for (size_t i = 0; i < conns; i++) {
+    char name[16];
+    int len = snprintf(name, sizeof name, "u%05zu\n", i);
+    read_line(cl[i].fd); // welcome
+    if (send(cl[i].fd, name, (size_t)len, MSG_NOSIGNAL) != len) {
+      perror("send");
+      exit(EXIT_FAILURE);
+    }
+    read_line(cl[i].fd); // room contents
+    cl[i].expect += (conns - 1 - i) * CHAT_ENTERED_LEN;
+  }
+}
+
+#define PRIME_BLOCK 1024 // distinct request lines, repeated
+
+static int is_prime_small(uint32_t n) {
+  if (n < 2)
+    return 0;
+  for (uint32_t d = 2; d <= n / d; d++)
+    if (n % d == 0)
+      return 0;
+  return 1;
+}
+
+// n isPrime requests in a few shapes a client might send: either key
+// order, spaces, an extra member, integral floats. Rounded up to whole
+// blocks so every connection gets the same replies.
+static Load prime_load(size_t n) {
+  static const char *const shapes[] = {
+      "{\"method\":\"isPrime\",\"number\":%u}\n",
+      "{\"number\":%u,\"method\":\"isPrime\"}\n",
+      "{\"method\": \"isPrime\", \"number\": %u}\n",
+      "{\"method\":\"isPrime\",\"number\":%u,\"id\":\"req\"}\n",
+      "{\"method\":\"isPrime\",\"number\":%u.0}\n",
+  };
+  static const char yes[] = "{\"method\":\"isPrime\", \"prime\":true}\n";
+  static const char no[] = "{\"method\":\"isPrime\", \"prime\":false}\n";
+  size_t nshapes = sizeof shapes / sizeof shapes[0];
+  char *p = malloc(PRIME_BLOCK * 64);
+  if (!p)
+    abort();
+  size_t off = 0, reply = 0;
+  uint32_t x = 2463534242u;
+  for (size_t i = 0; i < PRIME_BLOCK; i++) {
+    x ^= x << 13; // xorshift32
+    x ^= x >> 17;
+    x ^= x << 5;
+    uint32_t v = x % 1000000;
+    off += (size_t)sprintf(p + off, shapes[i % nshapes], v);
+    reply += is_prime_small(v) ? sizeof yes - 1 : sizeof no - 1;
+  }
+  size_t blocks = (n + PRIME_BLOCK - 1) / PRIME_BLOCK;
+  return (Load){(const uint8_t *)p, off, off * blocks, reply * blocks,
+                blocks * PRIME_BLOCK};
+}
+
+static Load echo_load(size_t n) {
+  static uint8_t chunk[64 * 1024];
+  for (size_t i = 0; i < sizeof chunk; i++)
+    chunk[i] = (uint8_t)i;
+  return (Load){chunk, sizeof chunk, n, n, 0};
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s -m echo|means|chat|prime [-c conns] [-n amount] "
+          "[-p port]\n",
+          prog);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  const char *mode = "echo";
+  size_t conns = 8, amount = 0;
+  uint16_t port = 8080;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "m:c:n:p:")) != -1) {
+    switch (opt) {
+    case 'm':
+      mode = optarg;
+      break;
+    case 'c':
+      conns = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      amount = strtoull(optarg, NULL, 10);
+      break;
+    case 'p':
+      port = (uint16_t)strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  Load load;
+  if (strcmp(mode, "echo") == 0)
+    load = echo_load(amount ? amount : 256u << 20);
+  else if (strcmp(mode, "means") == 0)
+    load = means_load(amount ? amount : 200000);
+  else if (strcmp(mode, "prime") == 0)
+    load = prime_load(amount ? amount : 1000000);
+  else if (strcmp(mode, "chat") == 0 && conns > 1)
+    load = chat_load(amount ? amount : 10000, conns);
+  else
+    usage(argv[0]);
+  if (conns == 0)
+    usage(argv[0]);
+
+  Client *cl = calloc(conns, sizeof *cl);
+  struct pollfd *pfd = calloc(conns, sizeof *pfd);
+  if (!cl || !pfd)
+    abort();
+  static uint8_t sink[256 * 1024];
+
+  double t0 = now_s();
+  for (size_t i = 0; i < conns; i++) {
+    cl[i].fd = dial(port);
+    cl[i].expect = load.expect;
+    pfd[i].fd = cl[i].fd;
+  }
+  if (strcmp(mode, "chat") == 0)
+    chat_join(cl, conns);
+
+  size_t done = 0;
+  while (done < conns) {
+    for (size_t i = 0; i < conns; i++) {
+      Client *c = &cl[i];
+      pfd[i].events = 0;
+      if (c->done) {
+        pfd[i].fd = -1;
+        continue;
+      }
+      if (c->sent < load.total)
+        pfd[i].events |= POLLOUT;
+      pfd[i].events |= POLLIN;
+    }
+    if (poll(pfd, conns, 10000) <= 0) {
+      fprintf(stderr, "stalled: %zu/%zu connections done\n", done, conns);
+      return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < conns; i++) {
+      Client *c = &cl[i];
+      if (c->done)
+        continue;
+      if (pfd[i].revents & POLLOUT) {
+        size_t off = c->sent % load.plen;
+        size_t n = load.plen - off;
+        if (n > load.total - c->sent)
+          n = load.total - c->sent;
+        ssize_t w = send(c->fd, load.pattern + off, n,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (w > 0)
+          c->sent += (size_t)w;
+        else if (w < 0 && errno != EAGAIN) {
+          perror("send");
+          return EXIT_FAILURE;
+        }
+      }
+      if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+        ssize_t r = recv(c->fd, sink, sizeof sink, MSG_DONTWAIT);
+        if (r > 0)
+          c->recvd += (size_t)r;
+        else if (r == 0 || (errno != EAGAIN && errno != EINTR)) {
+          fprintf(stderr, "connection %zu closed after %zu/%zu bytes\n", i,
+                  c->recvd, c->expect);
+          return EXIT_FAILURE;
+        }
+      }
+      if (c->recvd >= c->expect && c->sent >= load.total) {
+        c->done = 1;
+        done++;
+      }
+    }
+  }
+  double dt = now_s() - t0;
+  for (size_t i = 0; i < conns; i++)
+    close(cl[i].fd);
+
+  double bytes = (double)load.total * (double)conns; // request direction
+  printf("%s: %zu conns, %.3f s, %.1f MB/s", mode, conns, dt,
+         bytes / dt / 1e6);
+  if (load.msgs)
+    printf(", %.0f msgs/s", (double)(load.msgs * conns) / dt);
+  printf("\n");
+  return 0;
+}
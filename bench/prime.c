@@ -0,0 +1,279 @@
+// p01 primality: prime_u64 against the 6k+-1 trial division it replaced,
+// prime_u64_batch at batch sizes 1 to 512, prime_token on decimal tokens
+// of 64, 128 and 1024 bits, then repeats answered from the result cache.
+//
+//   bench-prime [count]
+//
+// Each input class gets count numbers (default 100000; 1024-bit classes
+// get count / 1000, at least 16). Trial division is stopped after a second
+// per class, which for large primes happens long before count, and skipped
+// at 64 bits, where one prime takes seconds.
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+#include "prime.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng = 0x9e3779b97f4a7c15;
+static uint64_t next_rand(void) { // xorshift64
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+// The old isPrime, widened to 64 bits.
+static int trial(uint64_t n) {
+  if (n < 2)
+    return 0;
+  if (n % 2 == 0)
+    return n == 2;
+  if (n % 3 == 0)
+    return n == 3;
+  for (uint64_t i = 5; i <= n / i; i += 6)
+    if (n % i == 0 || n % (i + 2) == 0)
+      return 0;
+  return 1;
+}
+
+// ns per call, over as many of the count inputs as fit in budget seconds.
+static double measure(int (*fn)(uint64_t), const uint64_t *v, size_t count,
+                      double budget, size_t *primes) {
+  double t0 = now_s(), t = t0;
+  size_t i = 0;
+  while (i < count && t - t0 < budget) {
+    *primes += (size_t)fn(v[i++]);
+    if (fn == trial) // slow enough to check the clock every time
+      t = now_s();
+  }
+  return (now_s() - t0) * 1e9 / (double)i;
+}
+
+// count random numbers below 2^bits; primes only when want_prime.
+static void fill(uint64_t *v, size_t count, int bits, int want_prime) {
+  uint64_t mask = bits == 64 ? UINT64_MAX : ((uint64_t)1 << bits) - 1;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t n = next_rand() & mask;
+    n |= (uint64_t)1 << (bits - 1); // full width
+    if (want_prime)
+      while (!prime_u64(n))
+        n = (next_rand() & mask) | (uint64_t)1 << (bits - 1) | 1;
+    v[i] = n;
+  }
+}
+
+// Decimal text of the k-limb number n, which is destroyed.
+static char *to_dec(uint64_t *n, size_t k) {
+  char tmp[PRIME_MAX_BITS / 3 + 2], *p = tmp + sizeof tmp;
+  *--p = '\0';
+  while (k) {
+    uint64_t r = 0; // divide by 10^19
+    for (size_t i = k; i-- > 0;) {
+      unsigned __int128 t = (unsigned __int128)r << 64 | n[i];
+      n[i] = (uint64_t)(t / 10000000000000000000u);
+      r = (uint64_t)(t % 10000000000000000000u);
+    }
+    while (k && !n[k - 1])
+      k--;
+    for (int i = 0; i < 19 && (k || r); i++, r /= 10)
+      *--p = (char)('0' + r % 10);
+  }
+  return strdup(p);
+}
+
+static void fill_tokens(char **v, size_t count, int bits, int want_prime) {
+  size_t k = (size_t)bits / 64;
+  uint64_t n[PRIME_MAX_BITS / 64];
+  for (size_t i = 0; i < count; i++) {
+    do {
+      for (size_t j = 0; j < k; j++)
+        n[j] = next_rand();
+      n[k - 1] |= (uint64_t)1 << 63;
+      n[0] |= (uint64_t)want_prime;
+    } while (want_prime && !prime_bn(n, k));
+    if (!(v[i] = to_dec(n, k)))
+      abort();
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000;
+  if (count == 0) {
+    fprintf(stderr, "usage: %s [count]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  uint64_t *v = malloc(count * sizeof *v);
+  if (!v)
+    abort();
+
+  static const struct {
+    const char *name;
+    int bits, prime;
+  } classes[] = {
+      {"random 31-bit", 31, 0}, {"prime 31-bit", 31, 1},
+      {"random 53-bit", 53, 0}, {"prime 53-bit", 53, 1},
+      {"random 64-bit", 64, 0}, {"prime 64-bit", 64, 1},
+  };
+  printf("primality, ns per number (%zu per class)\n", count);
+  printf("  %-14s %12s %12s\n", "input", "prime_u64", "trial div");
+  for (size_t c = 0; c < sizeof classes / sizeof classes[0]; c++) {
+    fill(v, count, classes[c].bits, classes[c].prime);
+    size_t a = 0, b = 0;
+    double mr = measure(prime_u64, v, count, 1e9, &a);
+    printf("  %-14s %12.1f", classes[c].name, mr);
+    if (classes[c].bits < 64)
+      printf(" %12.0f\n", measure(trial, v, count, 1.0, &b));
+    else
+      printf(" %12s\n", "-");
+    fflush(stdout);
+    if (classes[c].prime && a != count) {
+      fprintf(stderr, "prime_u64 missed primes\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Batches of 64-bit numbers: a third prime, the rest random odd, which is
+  // about what a client checking candidates sends.
+  static const size_t batches[] = {1, 8, 64, 512};
+  int *out = malloc(count * sizeof *out);
+  if (!out)
+    abort();
+  fill(v, count, 64, 0);
+  for (size_t i = 0; i < count; i++)
+    v[i] |= 1;
+  for (size_t i = 0; i < count; i += 3)
+    fill(v + i, 1, 64, 1);
+  printf("prime_u64_batch on 64-bit numbers, millions per second\n");
+  printf("  %-8s %12s %12s\n", "batch", "batch", "prime_u64");
+  for (size_t b = 0; b < sizeof batches / sizeof batches[0]; b++) {
+    size_t size = batches[b], primes = 0, full = count / size * size;
+    double t0 = now_s();
+    for (size_t i = 0; i < full; i += size)
+      prime_u64_batch(v + i, size, out + i);
+    double tb = now_s() - t0;
+    for (size_t i = 0; i < full; i++)
+      primes += (size_t)out[i];
+    size_t want = 0;
+    t0 = now_s();
+    for (size_t i = 0; i < full; i++)
+      want += (size_t)prime_u64(v[i]);
+    double ts = now_s() - t0;
+    printf("  %-8zu %12.2f %12.2f\n", size, (double)full / tb / 1e6,
+           (double)full / ts / 1e6);
+    fflush(stdout);
+    if (primes != want) {
+      fprintf(stderr, "prime_u64_batch disagrees with prime_u64\n");
+      return EXIT_FAILURE;
+    }
+  }
+  free(out);
+  free(v);
+
+  static const struct {
+    const char *name;
+    int bits, prime;
+  } tclasses[] = {
+      {"random 64-bit", 64, 0},     {"prime 64-bit", 64, 1},
+      {"random 128-bit", 128, 0},   {"prime 128-bit", 128, 1},
+      {"random 1024-bit", 1024, 0}, {"prime 1024-bit", 1024, 1},
+  };
+  char **tok = malloc(count * sizeof *tok);
+  if (!tok)
+    abort();
+  printf("prime_token on decimal text, ns per number\n");
+  printf("  %-15s %7s %12s\n", "input", "count", "prime_token");
+  for (size_t c = 0; c < sizeof tclasses / sizeof tclasses[0]; c++) {
+    size_t n = count;
+    if (tclasses[c].bits > 128 && (n /= 1000) < 16)
+      n = 16;
+    fill_tokens(tok, n, tclasses[c].bits, tclasses[c].prime);
+    size_t primes = 0;
+    double t0 = now_s();
+    for (size_t i = 0; i < n; i++)
+      primes += (size_t)prime_token(tok[i], strlen(tok[i]));
+    printf("  %-15s %7zu %12.1f\n", tclasses[c].name, n,
+           (now_s() - t0) * 1e9 / (double)n);
+    fflush(stdout);
+    for (size_t i = 0; i < n; i++)
+      free(tok[i]);
+    if (tclasses[c].prime && primes != n) {
+      fprintf(stderr, "prime_token missed primes\n");
+      return EXIT_FAILURE;
+    }
+  }
+  free(tok);
+
+  // Last, as a thread cannot turn its cache off again: HOT numbers asked
+  // about over and over, with no cache, on first sight (a miss, then the
+  // test, then the insert) and when repeated.
+  enum { HOT = 4096 };
+  static const struct {
+    const char *name;
+    int prime;
+  } cclasses[] = {{"composite 64-bit", 0}, {"prime 64-bit", 1}};
+  uint64_t cv[2][HOT];
+  for (size_t c = 0; c < 2; c++) {
+    if (cclasses[c].prime) {
+      fill(cv[c], HOT, 64, 1);
+      continue;
+    }
+    for (size_t i = 0; i < HOT;) { // composites only Miller-Rabin catches
+      uint64_t n = next_rand() | 1;
+      int small = 0;
+      for (uint64_t p = 3; p < 101 && !small; p += 2)
+        small = n % p == 0;
+      if (!small && !prime_u64(n))
+        cv[c][i++] = n;
+    }
+  }
+  uint64_t m1279[20];
+  memset(m1279, 0xff, sizeof m1279);
+  m1279[19] >>= 1;
+  double none[3];
+  for (size_t c = 0; c < 2; c++) {
+    size_t primes = 0;
+    none[c] = measure(prime_u64, cv[c], HOT, 1e9, &primes);
+  }
+  double t0 = now_s();
+  prime_bn(m1279, 20);
+  none[2] = (now_s() - t0) * 1e9;
+
+  cache_config((size_t)64 << 20);
+  printf("%d numbers repeated, with a 64 MiB cache, ns per number\n", HOT);
+  printf("  %-16s %10s %10s %10s\n", "input", "uncached", "first",
+         "repeat");
+  for (size_t c = 0; c < 3; c++) {
+    size_t first = c < 2 ? HOT : 1, primes = 0;
+    t0 = now_s();
+    for (size_t i = 0; i < first; i++)
+      primes += (size_t)(c < 2 ? prime_u64(cv[c][i]) : prime_bn(m1279, 20));
+    double miss = (now_s() - t0) * 1e9 / (double)first;
+    t0 = now_s();
+    for (size_t i = 0; i < count; i++)
+      primes +=
+          (size_t)(c < 2 ? prime_u64(cv[c][i % HOT]) : prime_bn(m1279, 20));
+    double hit = (now_s() - t0) * 1e9 / (double)count;
+    printf("  %-16s %10.1f %10.1f %10.1f\n",
+           c < 2 ? cclasses[c].name : "2^1279 - 1", none[c], miss, hit);
+    if (primes != (c == 0 ? 0 : first + count)) {
+      fprintf(stderr, "cached answers differ\n");
+      return EXIT_FAILURE;
+    }
+  }
+  CacheStats st;
+  cache_stats(&st);
+  printf("  %llu hits, %llu misses, %zu entries, %.1f MiB\n",
+         (unsigned long long)st.hits, (unsigned long long)st.misses,
+         st.entries, (double)st.bytes / (1 << 20));
+  return 0;
+}
@@ -0,0 +1,258 @@
+// p01 latency for clients asking about small numbers, first alone and then
+// next to clients that keep the server busy with 1279-bit primes.
+//
+//   bench-primelat [-c light conns] [-n requests each] [-H heavy conns]
+//                  [-p port]
+//
+// Light connections each keep one request in flight and time every round
+// trip. Heavy connections pipeline 2^1279 - 1, a Mersenne prime that takes
+// milliseconds to test, 32 at a time. Run it against p01-prime-time with
+// and without -w 0 to see what the worker pool buys.
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HEAVY_WINDOW 32
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng = 0x9e3779b97f4a7c15;
+static uint64_t next_rand(void) { // xorshift64
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+static int dial(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    exit(EXIT_FAILURE);
+  }
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+    perror("connect");
+    exit(EXIT_FAILURE);
+  }
+  int yes = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+  return fd;
+}
+
+static void send_all(int fd, const char *p, size_t n) {
+  while (n) {
+    ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+    if (w <= 0) {
+      perror("send");
+      exit(EXIT_FAILURE);
+    }
+    p += w;
+    n -= (size_t)w;
+  }
+}
+
+// --- heavy clients ---
+
+typedef struct Heavy {
+  uint16_t port;
+  const char *line; // one request, repeated
+  size_t len;
+  atomic_ulong answered;
+} Heavy;
+
+static void *heavy_main(void *arg) {
+  Heavy *h = arg;
+  int fd = dial(h->port);
+  for (int i = 0; i < HEAVY_WINDOW; i++)
+    send_all(fd, h->line, h->len);
+  char buf[4096];
+  for (;;) { // until the process exits
+    ssize_t r = recv(fd, buf, sizeof buf, 0);
+    if (r <= 0) {
+      fprintf(stderr, "heavy connection closed\n");
+      exit(EXIT_FAILURE);
+    }
+    for (ssize_t i = 0; i < r; i++)
+      if (buf[i] == '\n') {
+        atomic_fetch_add(&h->answered, 1);
+        send_all(fd, h->line, h->len); // keep the window full
+      }
+  }
+  return NULL;
+}
+
+// The isPrime request for 2^bits - 1, in decimal.
+static char *mersenne_line(int bits, size_t *len) {
+  size_t cap = (size_t)bits / 3 + 2, n = 1;
+  char *d = calloc(cap, 1); // little-endian decimal digits
+  char *line = malloc(cap + 64);
+  if (!d || !line)
+    abort();
+  d[0] = 1;
+  for (int b = 0; b < bits; b++) {
+    int carry = 0;
+    for (size_t i = 0; i < n; i++) {
+      int v = d[i] * 2 + carry;
+      d[i] = (char)(v % 10);
+      carry = v / 10;
+    }
+    if (carry)
+      d[n++] = (char)carry;
+  }
+  d[0]--; // 2^bits ends in 2, 4, 6 or 8
+  size_t off = (size_t)sprintf(line, "{\"method\":\"isPrime\",\"number\":");
+  while (n)
+    line[off++] = (char)('0' + d[--n]);
+  off += (size_t)sprintf(line + off, "}\n");
+  free(d);
+  *len = off;
+  return line;
+}
+
+// --- light clients ---
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Closed loop over conns connections, n round trips each; fills rtt.
+static void light_run(uint16_t port, size_t conns, size_t n, double *rtt) {
+  int *fd = calloc(conns, sizeof *fd);
+  double *sent_at = calloc(conns, sizeof *sent_at);
+  size_t *left = calloc(conns, sizeof *left);
+  struct pollfd *pfd = calloc(conns, sizeof *pfd);
+  if (!fd || !sent_at || !left || !pfd)
+    abort();
+  char line[96];
+  for (size_t i = 0; i < conns; i++) {
+    fd[i] = dial(port);
+    pfd[i] = (struct pollfd){.fd = fd[i], .events = POLLIN};
+    left[i] = n;
+    int len = snprintf(line, sizeof line,
+                       "{\"method\":\"isPrime\",\"number\":%u}\n",
+                       (unsigned)(next_rand() % 1000000));
+    sent_at[i] = now_s();
+    send_all(fd[i], line, (size_t)len);
+  }
+  size_t done = 0, k = 0;
+  char buf[256];
+  while (done < conns) {
+    if (poll(pfd, conns, 10000) <= 0) {
+      fprintf(stderr, "light clients stalled\n");
+      exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < conns; i++) {
+      if (!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      ssize_t r = recv(fd[i], buf, sizeof buf, 0); // one reply in flight
+      if (r <= 0 || buf[r - 1] != '\n') {
+        fprintf(stderr, "light connection %zu: short reply\n", i);
+        exit(EXIT_FAILURE);
+      }
+      rtt[k++] = now_s() - sent_at[i];
+      if (--left[i] == 0) {
+        pfd[i].fd = -1;
+        done++;
+        continue;
+      }
+      int len = snprintf(line, sizeof line,
+                         "{\"method\":\"isPrime\",\"number\":%u}\n",
+                         (unsigned)(next_rand() % 1000000));
+      sent_at[i] = now_s();
+      send_all(fd[i], line, (size_t)len);
+    }
+  }
+  for (size_t i = 0; i < conns; i++)
+    close(fd[i]);
+  free(fd);
+  free(sent_at);
+  free(left);
+  free(pfd);
+}
+
+static void report(const char *label, double *rtt, size_t n, double secs) {
+  qsort(rtt, n, sizeof *rtt, cmp_double);
+  printf("%-12s %9.0f req/s  p50 %7.1f us  p99 %8.1f us  p99.9 %8.1f us  "
+         "max %8.1f us\n",
+         label, (double)n / secs, rtt[n / 2] * 1e6, rtt[n * 99 / 100] * 1e6,
+         rtt[n * 999 / 1000] * 1e6, rtt[n - 1] * 1e6);
+}
+
+int main(int argc, char **argv) {
+  size_t conns = 8, n = 20000, heavy = 1;
+  uint16_t port = 8080;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:n:H:p:")) != -1) {
+    switch (opt) {
+    case 'c':
+      conns = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      n = strtoul(optarg, NULL, 10);
+      break;
+    case 'H':
+      heavy = strtoul(optarg, NULL, 10);
+      break;
+    case 'p':
+      port = (uint16_t)strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-c light conns] [-n requests each] "
+              "[-H heavy conns] [-p port]\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (conns == 0 || n == 0) {
+    fprintf(stderr, "need at least one light connection and request\n");
+    return EXIT_FAILURE;
+  }
+
+  double *rtt = malloc(conns * n * sizeof *rtt);
+  if (!rtt)
+    abort();
+  double t0 = now_s();
+  light_run(port, conns, n, rtt);
+  report("alone", rtt, conns * n, now_s() - t0);
+
+  Heavy h = {.port = port};
+  h.line = mersenne_line(1279, &h.len);
+  pthread_t *tid = calloc(heavy ? heavy : 1, sizeof *tid);
+  if (!tid)
+    abort();
+  for (size_t i = 0; i < heavy; i++)
+    pthread_create(&tid[i], NULL, heavy_main, &h);
+  usleep(200000); // let the heavy windows fill
+  t0 = now_s();
+  light_run(port, conns, n, rtt);
+  double secs = now_s() - t0;
+  char label[32];
+  snprintf(label, sizeof label, "+%zu heavy", heavy);
+  report(label, rtt, conns * n, secs);
+  printf("heavy: %.0f primes/s answered\n",
+         (double)atomic_load(&h.answered) / (secs + 0.2));
+  // Heavy threads block in recv; exiting the process ends them
+  return 0;
+}
@@ -0,0 +1,124 @@
+// p01 startup: the sieve bitmap at each bound, built or mapped from cache,
+// and what a lookup below the bound costs against prime_u64 alone.
+//
+//   bench-sieve [max_bits] [path]
+//
+// Bounds 2^24, 2^27, 2^30 and 2^32, up to max_bits (default 32). Each is
+// built on one thread and on one per core, saved to path (default
+// /tmp/bench-sieve.bin, removed at the end) and mapped back. RSS is the
+// process's resident set with only that sieve live; the mapped file is
+// still in the page cache, as after a quick restart.
+#define _GNU_SOURCE
+
+#include "prime.h"
+#include "sieve.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng = 0x9e3779b97f4a7c15;
+static uint64_t next_rand(void) { // xorshift64
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+static double rss_mib(void) {
+  long pages = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f) {
+    if (fscanf(f, "%*s %ld", &pages) != 1)
+      pages = 0;
+    fclose(f);
+  }
+  return (double)pages * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+// ns per prime_u64 call on random numbers below limit.
+static double lookup_ns(uint64_t limit, size_t count, size_t *primes) {
+  *primes = 0;
+  double t0 = now_s();
+  for (size_t i = 0; i < count; i++)
+    *primes += (size_t)prime_u64(next_rand() & (limit - 1));
+  return (now_s() - t0) / (double)count * 1e9;
+}
+
+static void die(const char *what) {
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  static const int bounds[] = {24, 27, 30, 32};
+  int max_bits = argc > 1 ? atoi(argv[1]) : 32;
+  const char *path = argc > 2 ? argv[2] : "/tmp/bench-sieve.bin";
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = cpus > 0 ? (int)cpus : 1;
+  enum { LOOKUPS = 10000000 };
+
+  double base = rss_mib();
+  printf("%d cores, base rss %.1f MiB, %d random lookups per bound\n\n",
+         threads, base, LOOKUPS);
+  printf("%-6s %8s %10s %10s %9s %9s %9s %9s %9s\n", "bound", "MiB",
+         "build 1t", "build Nt", "save", "map", "rss", "sieve ns",
+         "mr ns");
+  for (size_t b = 0; b < sizeof bounds / sizeof bounds[0]; b++) {
+    int bits = bounds[b];
+    if (bits > max_bits)
+      break;
+    uint64_t limit = (uint64_t)1 << bits;
+    Sieve s;
+
+    double t0 = now_s();
+    if (sieve_build(&s, limit, 1) < 0)
+      die("sieve_build");
+    double build1 = now_s() - t0;
+    sieve_free(&s);
+
+    t0 = now_s();
+    if (sieve_build(&s, limit, threads) < 0)
+      die("sieve_build");
+    double buildn = now_s() - t0;
+    t0 = now_s();
+    if (sieve_save(&s, path) < 0)
+      die(path);
+    double save = now_s() - t0;
+    sieve_free(&s);
+
+    t0 = now_s();
+    if (sieve_map(&s, limit, path) < 0)
+      die(path);
+    double map = now_s() - t0;
+    double rss = rss_mib() - base;
+
+    size_t p_sieve, p_mr;
+    prime_use_sieve(&s);
+    rng = 0x9e3779b97f4a7c15;
+    double ns_sieve = lookup_ns(limit, LOOKUPS, &p_sieve);
+    prime_use_sieve(NULL);
+    rng = 0x9e3779b97f4a7c15; // the same numbers again
+    double ns_mr = lookup_ns(limit, LOOKUPS, &p_mr);
+    if (p_sieve != p_mr) {
+      fprintf(stderr, "2^%d: sieve found %zu primes, prime_u64 %zu\n", bits,
+              p_sieve, p_mr);
+      return EXIT_FAILURE;
+    }
+    sieve_free(&s);
+
+    printf("2^%-4d %8.1f %8.1f ms %7.1f ms %6.1f ms %6.1f ms %5.1f MiB "
+           "%9.2f %9.2f\n",
+           bits, (double)limit / 16 / (1 << 20), build1 * 1e3, buildn * 1e3,
+           save * 1e3, map * 1e3, rss, ns_sieve, ns_mr);
+  }
+  unlink(path);
+  return 0;
+}
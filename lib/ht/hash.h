@@ -0,0 +1,79 @@
+#pragma once
+// Seeded string hash shared by ht and ht_conc. Not part of the public API.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+// wyhash: 64x64->128 multiply-and-fold over 16-byte blocks.
+static const uint64_t wyp[4] = {0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+                                0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull};
+
+static inline uint64_t wymix(uint64_t a, uint64_t b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t rd64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline uint64_t rd32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static inline uint64_t hash64(const void *key, size_t len, uint64_t seed) {
+  const uint8_t *p = key;
+  uint64_t a, b;
+  seed ^= wymix(seed ^ wyp[0], wyp[1]);
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t mid = (len >> 3) << 2;
+      a = rd32(p) << 32 | rd32(p + mid);
+      b = rd32(p + len - 4) << 32 | rd32(p + len - 4 - mid);
+    } else if (len > 0) {
+      a = (uint64_t)p[0] << 16 | (uint64_t)p[len >> 1] << 8 | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t s1 = seed, s2 = seed;
+      do {
+        seed = wymix(rd64(p) ^ wyp[1], rd64(p + 8) ^ seed);
+        s1 = wymix(rd64(p + 16) ^ wyp[2], rd64(p + 24) ^ s1);
+        s2 = wymix(rd64(p + 32) ^ wyp[3], rd64(p + 40) ^ s2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= s1 ^ s2;
+    }
+    while (i > 16) {
+      seed = wymix(rd64(p) ^ wyp[1], rd64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = rd64(p + i - 16);
+    b = rd64(p + i - 8);
+  }
+  __uint128_t r = (__uint128_t)(a ^ wyp[1]) * (b ^ seed);
+  return wymix((uint64_t)r ^ wyp[0] ^ len, (uint64_t)(r >> 64) ^ wyp[1]);
+}
+
+static inline uint64_t new_seed(void) {
+  uint64_t s;
+  if (getrandom(&s, sizeof s, GRND_NONBLOCK) == (ssize_t)sizeof s)
+    return s;
+  // No entropy yet (early boot): time and ASLR are better than nothing
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return wymix((uint64_t)ts.tv_nsec ^ wyp[2], (uint64_t)(uintptr_t)&s);
+}
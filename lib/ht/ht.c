@@ -4,143 +4,482 @@
 #endif
 
 #include "ht.h"
+#include "hash.h"
+#include "ht_gen.h"
+#include <fcntl.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-static inline uint64_t hash64_fnv1a(const char *s) {
-  uint64_t hash = 0xcbf29ce484222325;
-  for (size_t i = 0; s[i] != '\0'; ++i) {
-    hash ^= (uint64_t)s[i];
-    hash *= (uint64_t)s[i];
-  }
-  return hash;
+// The string table is one instantiation of ht_gen.h, with void * values
+// and a key that carries its own hash and length.
+
+// Keys up to INLINE_KEY bytes live in the slot itself; longer ones are
+// packed into the table's arena, so inserting never allocates per key.
+#define INLINE_KEY 16
+
+// Slots of the table a compaction looks at per ht_set/ht_del.
+#define SWEEP_SLOTS 64
+
+// A long key is stored as its address minus the table's base, in wrapping
+// arithmetic. Tables built in memory have base 0, so that is the address
+// itself; one opened from a snapshot has the mapping's address as base, so
+// the file offsets it was written with resolve as they are, and keys added
+// later still do. Either way no slot holds a pointer into the file.
+typedef struct key {
+  union {
+    uint64_t inl[INLINE_KEY / 8]; // zero-padded, so it compares by word
+    uint64_t at;                  // long keys: address - base
+  } k;
+  uint32_t len;
+  uint32_t hash; // top half of the seeded hash
+} key;
+
+static inline const char *key_ptr(uintptr_t base, const key *k) {
+  return (const char *)(base + (uintptr_t)k->k.at);
+}
+
+static inline int key_eq_p(uintptr_t base, const key *a, const key *b) {
+  if (a->hash != b->hash || a->len != b->len)
+    return 0;
+  if (a->len <= INLINE_KEY)
+    return a->k.inl[0] == b->k.inl[0] && a->k.inl[1] == b->k.inl[1];
+  return memcmp(key_ptr(base, a), key_ptr(base, b), a->len) == 0;
 }
 
-typedef struct bucket {
-  char *key;
-  void *value;
-  struct bucket *next;
-} bucket;
+// Rebuilt from the cached half, so resizing never rereads key bytes. The
+// probe start takes the low bits of hash, h2 (bits 0..6) the top seven.
+#define key_hash(base, k) ((uint64_t)(k).hash << 32 | (k).hash >> 25)
+#define key_eq(base, a, b) key_eq_p(base, &(a), &(b))
+
+HT_DEFINE_CTX(strtab, key, void *, uintptr_t, key_hash, key_eq)
+
+// Arena chunks never move, so stored keys can point straight into them.
+typedef struct chunk {
+  struct chunk *next;
+  size_t len, cap;
+  char data[];
+} chunk;
 
 struct ht {
-  bucket **buckets;
-  uint64_t n; // number of entries occupied in the hash table
-  uint64_t m; // size of table
+  strtab tab;        // tab.ctx is the base long keys are relative to
+  uint64_t seed;     // per table, so colliding keys cannot be precomputed
+  chunk *arena;      // newest first; long keys, back to back
+  size_t arena_len;  // bytes used over all chunks, and in map
+  size_t arena_dead; // bytes of deleted long keys, reclaimed by compaction
+  chunk *stale;      // chunks a compaction is moving the live keys out of
+  size_t stale_len;  // arena_len when it started; 0 when none runs
+  size_t sweep;      // next slot of tab.cur it looks at
+  size_t last_slots, last_bytes; // what the latest call swept and moved
+  void *map;         // snapshot this table was opened from, if any
+  size_t map_len;
 };
 
+static chunk *chunk_new(size_t cap) {
+  chunk *c = malloc(sizeof *c + cap);
+  if (!c)
+    return NULL;
+  c->next = NULL;
+  c->len = 0;
+  c->cap = cap;
+  return c;
+}
+
+static void arena_free(chunk *c) {
+  while (c) {
+    chunk *next = c->next;
+    free(c);
+    c = next;
+  }
+}
+
+// Compaction: new keys go to one fresh chunk with room for the live ones,
+// the old chunks become stale, and each later ht_set/ht_del sweeps a few
+// more slots, copying their keys over. Once a sweep gets through the whole
+// table the stale chunks are freed, so no call pays for every key at once.
+static int arena_compact_start(ht *t, size_t need) {
+  size_t live = t->arena_len - t->arena_dead, cap = 1024;
+  while (cap < (live + need) * 2)
+    cap *= 2;
+  chunk *c = chunk_new(cap);
+  if (!c)
+    return -1;
+  t->stale = t->arena;
+  t->stale_len = t->arena_len;
+  t->sweep = 0;
+  t->arena = c;
+  return 0;
+}
+
+static int arena_holds(const chunk *c, const char *p) {
+  for (; c; c = c->next)
+    if ((uintptr_t)p - (uintptr_t)c->data < c->len)
+      return 1;
+  return 0;
+}
+
+// Store a long key; returns its copy, or NULL.
+static const char *arena_push(ht *t, const void *k, size_t len) {
+  chunk *c = t->arena;
+  if (!c || c->cap - c->len < len) {
+    if (!t->stale_len && t->arena_dead >= t->arena_len / 2 &&
+        t->arena_dead > 0) {
+      if (arena_compact_start(t, len) < 0)
+        return NULL;
+    } else {
+      size_t cap = c ? c->cap * 2 : 1024;
+      while (cap < len)
+        cap *= 2;
+      chunk *nc = chunk_new(cap);
+      if (!nc)
+        return NULL;
+      nc->next = c;
+      t->arena = nc;
+    }
+    c = t->arena;
+  }
+  char *p = c->data + c->len;
+  memcpy(p, k, len);
+  c->len += len;
+  t->arena_len += len;
+  return p;
+}
+
+// One step of a compaction, after a change to the table; ctrl is cur's
+// control array from before it. A resize moves entries to slots the sweep
+// may have passed, so the sweep waits for it to end and then starts over.
+static void arena_step(ht *t, const uint8_t *ctrl) {
+  t->last_slots = t->last_bytes = 0;
+  if (!t->stale_len)
+    return;
+  const htg_tab *b = &t->tab.cur;
+  if (t->tab.old.cap || b->ctrl != ctrl)
+    t->sweep = 0;
+  if (t->tab.old.cap)
+    return;
+  strtab_slot *sl = strtab_slots(b);
+  size_t end = b->cap - t->sweep > SWEEP_SLOTS ? t->sweep + SWEEP_SLOTS
+                                                : b->cap;
+  for (; t->sweep < end; t->sweep++) {
+    key *k = &sl[t->sweep].key;
+    t->last_slots++;
+    if (!(b->ctrl[t->sweep] & HTG_FULL) || k->len <= INLINE_KEY ||
+        arena_holds(t->arena, key_ptr(t->tab.ctx, k)))
+      continue;
+    const char *p = arena_push(t, key_ptr(t->tab.ctx, k), k->len);
+    if (!p)
+      return; // this slot again next time
+    k->k.at = (uintptr_t)p - t->tab.ctx;
+    t->arena_dead += k->len;
+    t->last_bytes += k->len;
+  }
+  if (t->sweep < b->cap)
+    return;
+  // Every stale byte is dead now: deleted, or copied over
+  arena_free(t->stale);
+  t->stale = NULL;
+  t->arena_len -= t->stale_len;
+  t->arena_dead -= t->stale_len;
+  t->stale_len = 0;
+}
+
+// Inline key bytes, zero-padded, gathered with whole-word loads the way
+// wyhash reads short inputs. A byte-wise memcpy here made the wide loads
+// that compare the key wait on narrow stores, and a lookup could then no
+// longer overlap its cache misses with the previous one's.
+static inline void key_load(uint64_t w[2], const uint8_t *p, size_t len) {
+  w[0] = w[1] = 0;
+  if (len > 8) {
+    w[0] = rd64(p);
+    w[1] = rd64(p + len - 8) >> (16 - len) * 8;
+  } else if (len >= 4) {
+    w[0] = rd32(p) | rd32(p + len - 4) << (len - 4) * 8;
+  } else if (len > 0) {
+    w[0] = (uint64_t)p[0] | (uint64_t)p[len / 2] << len / 2 * 8 |
+           (uint64_t)p[len - 1] << (len - 1) * 8;
+  }
+}
+
+// A lookup key for k; long keys point at the caller's bytes.
+static inline key key_of(const ht *t, const void *k, size_t len) {
+  key e = {.len = (uint32_t)len,
+           .hash = (uint32_t)(hash64(k, len, t->seed) >> 32)};
+  if (len <= INLINE_KEY)
+    key_load(e.k.inl, k, len);
+  else
+    e.k.at = (uintptr_t)k - t->tab.ctx;
+  return e;
+}
+
 ht *ht_new(size_t m) {
   ht *t = calloc(1, sizeof *t);
   if (!t)
     return NULL;
-  t->buckets = calloc(m, sizeof *t->buckets); // array of bucket*
-  if (!t->buckets) {
+  if (strtab_init(&t->tab, m) < 0) {
     free(t);
     return NULL;
   }
-  t->m = m;
+  t->seed = new_seed();
   return t;
 }
 
 void ht_free(ht *t) {
   if (!t)
     return;
-  if (t->buckets) {
-    for (size_t i = 0; i < t->m; i++) {
-      for (bucket *p = t->buckets[i]; p;) {
-        bucket *n = p->next;
-        free(p->key); // own keys
-        /* do NOT free(p->value); */
-        free(p);
-        p = n;
-      }
-    }
-    free(t->buckets);
-  }
+  // Keys are in the slots or the arena; values are not ours to free
+  strtab_destroy(&t->tab);
+  arena_free(t->arena);
+  arena_free(t->stale);
+  if (t->map)
+    munmap(t->map, t->map_len);
   free(t);
 }
 
-static void ht_rehash(ht *t, size_t new_m) {
-  bucket **nb = calloc(new_m, sizeof *nb);
-  if (!nb)
-    return; // skip grow on OOM
-
-  for (size_t i = 0; i < t->m; i++) {
-    for (bucket *p = t->buckets[i]; p;) {
-      bucket *nxt = p->next;
-      size_t j = hash64_fnv1a(p->key) % new_m;
-      p->next = nb[j];
-      nb[j] = p;
-      p = nxt;
+int ht_set_n(ht *t, const void *k, size_t len, void *v) {
+  if (!t || t->tab.cur.cap == 0 || len > UINT32_MAX)
+    return -1;
+  const uint8_t *ctrl = t->tab.cur.ctrl;
+  key e = key_of(t, k, len);
+  if (len > INLINE_KEY) {
+    // Copy the key only when it is new
+    void **at = strtab_get(&t->tab, e);
+    if (at) {
+      *at = v;
+      arena_step(t, ctrl);
+      return 0;
     }
+    const char *p = arena_push(t, k, len);
+    if (!p)
+      return -1;
+    e.k.at = (uintptr_t)p - t->tab.ctx;
   }
-  free(t->buckets);
-  t->buckets = nb;
-  t->m = new_m;
+  int added;
+  void **at = strtab_put(&t->tab, e, &added);
+  if (at)
+    *at = v;
+  else if (len > INLINE_KEY)
+    t->arena_dead += len;
+  arena_step(t, ctrl);
+  return at ? 0 : -1;
+}
+
+void *ht_get_n(const ht *t, const void *k, size_t len) {
+  void **at = strtab_get(&t->tab, key_of(t, k, len));
+  return at ? *at : NULL;
+}
+
+int ht_del_n(ht *t, const void *k, size_t len) {
+  const uint8_t *ctrl = t->tab.cur.ctrl;
+  int resizing = t->tab.old.cap != 0;
+  int rc = strtab_del(&t->tab, key_of(t, k, len)); // migrates even if absent
+  if (rc == 0 && len > INLINE_KEY)
+    t->arena_dead += len;
+  // That delete started a shrink: let the arena shrink along. Failing is
+  // harmless, arena_push compacts once the arena fills up.
+  if (rc == 0 && !resizing && t->tab.old.cap && t->arena_dead > 0 &&
+      !t->stale_len)
+    (void)arena_compact_start(t, 0);
+  arena_step(t, ctrl);
+  return rc;
 }
 
 int ht_set(ht *t, const char *k, void *v) {
-  if (!t || t->m == 0 || !t->buckets)
-    return -1;
+  return ht_set_n(t, k, strlen(k), v);
+}
 
-  size_t idx = hash64_fnv1a(k) % t->m;
+void *ht_get(const ht *t, const char *k) {
+  return ht_get_n(t, k, strlen(k));
+}
 
-  for (bucket *p = t->buckets[idx]; p; p = p->next) {
-    if (strcmp(p->key, k) == 0) {
-      p->value = v;
-      return 0;
-    }
-  }
+int ht_del(ht *t, const char *k) { return ht_del_n(t, k, strlen(k)); }
 
-  bucket *buck = malloc(sizeof *buck);
-  if (!buck)
-    return -1;
-  buck->key = strdup(k);
-  if (!buck->key) {
-    free(buck);
-    return -1;
-  }
-  buck->value = v;
-  buck->next = t->buckets[idx];
-  t->buckets[idx] = buck;
-  t->n++;
+size_t ht_len(const ht *m) { return strtab_len(&m->tab); }
 
-  if (t->n * 4 > t->m * 3)
-    ht_rehash(t, t->m ? t->m * 2 : 1);
-  return 0;
+size_t ht_cap(const ht *m) { return strtab_cap(&m->tab); }
+
+size_t ht_probe_hist(const ht *t, size_t *hist, size_t nbins) {
+  return strtab_probe_hist(&t->tab, hist, nbins);
 }
 
-void *ht_get(const ht *t, const char *k) {
-  uint64_t idx = hash64_fnv1a(k) % t->m;
+ht_arena_stats ht_arena(const ht *t) {
+  return (ht_arena_stats){.used = t->arena_len,
+                          .dead = t->arena_dead,
+                          .last_slots = t->last_slots,
+                          .last_bytes = t->last_bytes};
+}
 
-  bucket *head = t->buckets[idx];
-  while (head != NULL) {
-    if (strcmp(head->key, k) == 0) {
-      return head->value;
-    }
-    head = head->next;
-  }
+// Snapshot file: a header, then the control bytes and slots exactly as a
+// table holds them, then the long keys back to back. Long keys are stored
+// relative to the start of the file, which is the base an opened snapshot
+// resolves them against, so the file maps and is queried as is.
+#define SNAP_MAGIC "htsnap1"
+#define SNAP_ALIGN 64
+
+typedef struct snap_hdr {
+  char magic[8];
+  uint32_t order;     // SNAP_ORDER as written: same byte order
+  uint32_t slot_size; // same slot layout
+  uint64_t seed;
+  uint64_t cap, n, tombs;
+  uint64_t ctrl_off, slots_off, keys_off, keys_len;
+} snap_hdr;
+
+#define SNAP_ORDER 0x01020304u
 
-  return NULL;
+static inline uint64_t snap_align(uint64_t off) {
+  return (off + SNAP_ALIGN - 1) & ~(uint64_t)(SNAP_ALIGN - 1);
 }
 
-int ht_del(ht *t, const char *k) {
-  uint64_t idx = hash64_fnv1a(k) % t->m;
+static int write_all(FILE *f, const void *p, size_t len) {
+  return fwrite(p, 1, len, f) == len ? 0 : -1;
+}
 
-  bucket **pp = &t->buckets[idx];
-  for (bucket *p = *pp; p; p = p->next) {
-    // p walks the nodes: head, head->next, ...
-    // pp stays one step “behind”, pointing to the link that leads to p.
-    if (strcmp(p->key, k) == 0) {
-      *pp = p->next;
-      free(p->key);
-      free(p);
-      return 0;
+static int write_pad(FILE *f, uint64_t from, uint64_t to) {
+  static const char zero[SNAP_ALIGN];
+  return write_all(f, zero, (size_t)(to - from));
+}
+
+// Slots in file form: empty ones zeroed, long keys moved to keys_off on.
+static int write_slots(FILE *f, const ht *t, uint64_t keys_off) {
+  const htg_tab *b = &t->tab.cur;
+  const strtab_slot *sl = strtab_slots(b);
+  strtab_slot buf[256];
+  size_t nbuf = 0;
+  for (size_t s = 0; s < b->cap; s++) {
+    strtab_slot *o = &buf[nbuf++];
+    if (!(b->ctrl[s] & HTG_FULL)) {
+      memset(o, 0, sizeof *o);
+    } else {
+      *o = sl[s];
+      if (o->key.len > INLINE_KEY) {
+        o->key.k.at = keys_off;
+        keys_off += o->key.len;
+      }
+    }
+    if (nbuf == sizeof buf / sizeof buf[0] || s == b->cap - 1) {
+      if (write_all(f, buf, nbuf * sizeof buf[0]) < 0)
+        return -1;
+      nbuf = 0;
     }
-    pp = &p->next;
   }
+  return 0;
+}
+
+// Long keys in the order write_slots gave them offsets.
+static int write_keys(FILE *f, const ht *t) {
+  const htg_tab *b = &t->tab.cur;
+  const strtab_slot *sl = strtab_slots(b);
+  for (size_t s = 0; s < b->cap; s++)
+    if ((b->ctrl[s] & HTG_FULL) && sl[s].key.len > INLINE_KEY &&
+        write_all(f, key_ptr(t->tab.ctx, &sl[s].key), sl[s].key.len) < 0)
+      return -1;
+  return 0;
+}
+
+int ht_snapshot(ht *t, const char *path) {
+  strtab_settle(&t->tab); // one table to write
+  const htg_tab *b = &t->tab.cur;
+  snap_hdr h = {.magic = SNAP_MAGIC,
+                .order = SNAP_ORDER,
+                .slot_size = sizeof(strtab_slot),
+                .seed = t->seed,
+                .cap = b->cap,
+                .n = b->n,
+                .tombs = b->tombs};
+  h.ctrl_off = snap_align(sizeof h);
+  h.slots_off = snap_align(h.ctrl_off + b->cap);
+  h.keys_off = h.slots_off + b->cap * sizeof(strtab_slot);
+  size_t pos = 0;
+  for (strtab_slot *s; (s = strtab_next(&t->tab, &pos));)
+    if (s->key.len > INLINE_KEY)
+      h.keys_len += s->key.len;
+
+  // Write next to path and rename over it, so readers never see half a file
+  char tmp[4096];
+  int len = snprintf(tmp, sizeof tmp, "%s.tmp", path);
+  if (len < 0 || (size_t)len >= sizeof tmp)
+    return -1;
+  FILE *f = fopen(tmp, "wb");
+  if (!f)
+    return -1;
+  int rc = write_all(f, &h, sizeof h);
+  if (rc == 0)
+    rc = write_pad(f, sizeof h, h.ctrl_off);
+  if (rc == 0)
+    rc = write_all(f, b->ctrl, b->cap);
+  if (rc == 0)
+    rc = write_pad(f, h.ctrl_off + b->cap, h.slots_off);
+  if (rc == 0)
+    rc = write_slots(f, t, h.keys_off);
+  if (rc == 0)
+    rc = write_keys(f, t);
+  if (rc == 0 && (fflush(f) != 0 || fsync(fileno(f)) < 0))
+    rc = -1;
+  if (fclose(f) != 0)
+    rc = -1;
+  if (rc == 0 && rename(tmp, path) < 0)
+    rc = -1;
+  if (rc < 0)
+    unlink(tmp);
+  return rc;
+}
 
-  return -1; // not found
+// Checks the header only, so opening costs the same at any size; the rest
+// of the file is trusted to be what ht_snapshot wrote.
+static int snap_valid(const snap_hdr *h, size_t file_len) {
+  uint64_t cap = h->cap, len = file_len;
+  if (memcmp(h->magic, SNAP_MAGIC, sizeof h->magic) != 0 ||
+      h->order != SNAP_ORDER || h->slot_size != sizeof(strtab_slot))
+    return 0;
+  if (cap < HTG_GROUP || (cap & (cap - 1)) != 0 ||
+      cap > len / sizeof(strtab_slot) || h->n >= cap ||
+      h->tombs >= cap - h->n)
+    return 0;
+  // Offsets are bounded by the file first, so the sums cannot wrap
+  return h->ctrl_off % SNAP_ALIGN == 0 && h->slots_off % SNAP_ALIGN == 0 &&
+         h->ctrl_off >= sizeof *h && h->ctrl_off <= len &&
+         h->slots_off <= len && h->slots_off >= h->ctrl_off + cap &&
+         h->keys_off <= len &&
+         h->keys_off >= h->slots_off + cap * sizeof(strtab_slot) &&
+         h->keys_len <= len - h->keys_off;
 }
 
-size_t ht_len(const ht *m) { return m->n; }
+ht *ht_open_mapped(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(snap_hdr)) {
+    close(fd);
+    return NULL;
+  }
+  // Private and writable: the first change to a page copies it, so the
+  // table can be modified like any other while the file stays as written.
+  size_t map_len = (size_t)st.st_size;
+  char *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+  const snap_hdr *h = (const snap_hdr *)map;
+  ht *t = snap_valid(h, map_len) ? calloc(1, sizeof *t) : NULL;
+  if (!t) {
+    munmap(map, map_len);
+    return NULL;
+  }
+  t->tab.cur = (htg_tab){.ctrl = (uint8_t *)map + h->ctrl_off,
+                         .slots = map + h->slots_off,
+                         .cap = h->cap,
+                         .n = h->n,
+                         .tombs = h->tombs,
+                         .borrowed = 1};
+  t->tab.ctx = (uintptr_t)map;
+  t->seed = h->seed;
+  t->arena_len = h->keys_len;
+  t->map = map;
+  t->map_len = map_len;
+  return t;
+}
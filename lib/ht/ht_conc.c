@@ -0,0 +1,453 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "ht_conc.h"
+#include "hash.h"
+#include <linux/membarrier.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Sharded open addressing with linear probing. Each shard's slot array
+// holds pointers to immutable key nodes, so a reader only ever loads a
+// pointer and compares; writers serialise on the shard lock. A slot goes
+// NULL -> node -> TOMB -> node ... and never back to NULL, which keeps
+// every probe sequence intact until a resize publishes a fresh array.
+// Unlinked nodes and arrays are freed through epoch-based reclamation once
+// no reader can still hold them.
+#define SHARDS 64       // power of two
+#define SHARD_BITS 6    // log2(SHARDS)
+#define MIN_CAP 16      // slots per shard
+#define RETIRE_BATCH 64 // unlinked blocks a shard collects before freeing
+
+typedef struct node {
+  uint64_t hash;
+  _Atomic(void *) value; // updated in place by ht_conc_set
+  size_t len;
+  char key[]; // len bytes plus a NUL
+} node;
+
+typedef struct table {
+  size_t cap; // power of two
+  _Atomic(node *) slot[];
+} table;
+
+static node tomb; // marks a deleted slot
+#define TOMB (&tomb)
+
+typedef struct retired {
+  void *p;
+  uint64_t epoch; // global epoch when it was unlinked
+} retired;
+
+typedef struct shard {
+  _Alignas(64) pthread_mutex_t lock; // writers only
+  _Atomic(table *) tab;
+  _Atomic size_t n; // live keys, written under lock
+  size_t used;      // non-NULL slots, tombstones included
+  retired *retired; // unlinked, waiting for readers to move on
+  size_t nretired, retired_cap, reclaim_at;
+} shard; // whole cache lines, so writers on neighbours do not collide
+
+struct ht_conc {
+  uint64_t seed;
+  shard shards[SHARDS];
+};
+
+// --- Epoch-based reclamation ---
+//
+// A reader publishes the global epoch it entered at and clears it when it
+// leaves. A block unlinked at epoch e can go once every reader still
+// inside entered after e. Records are per thread and recycled when the
+// thread exits; they are shared by every ht_conc in the process.
+//
+// Entering needs a full barrier between publishing the epoch and the
+// loads that follow. An mfence per lookup costs more than the lookup, so
+// when the kernel has membarrier() the writer pays instead: it forces that
+// barrier on every running thread of the process before it scans.
+typedef struct ebr_rec {
+  _Alignas(64) _Atomic uint64_t epoch; // 0 outside a read section
+  _Atomic int used;
+  unsigned depth; // nesting, owner thread only
+  struct ebr_rec *next;
+} ebr_rec;
+
+static _Atomic uint64_t ebr_epoch = 1;
+static _Atomic(ebr_rec *) ebr_recs;
+static pthread_once_t ebr_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ebr_key;
+static int ebr_membarrier; // readers can skip their fence
+static _Thread_local ebr_rec *ebr_self;
+
+static void ebr_release(void *p) {
+  ebr_rec *r = p;
+  atomic_store(&r->used, 0);
+}
+
+static void ebr_init(void) {
+  if (pthread_key_create(&ebr_key, ebr_release) != 0) {
+    perror("pthread_key_create");
+    exit(EXIT_FAILURE);
+  }
+  ebr_membarrier =
+      syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) ==
+      0;
+}
+
+// The writer's half of ebr_enter()'s barrier.
+static void ebr_barrier(void) {
+  if (!ebr_membarrier ||
+      syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) < 0)
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+static ebr_rec *ebr_rec_get(void) {
+  if (ebr_self)
+    return ebr_self;
+  ebr_rec *r;
+  for (r = atomic_load(&ebr_recs); r; r = r->next) {
+    int idle = 0;
+    if (atomic_compare_exchange_strong(&r->used, &idle, 1))
+      break;
+  }
+  if (!r) {
+    r = aligned_alloc(64, sizeof *r);
+    if (!r) {
+      perror("aligned_alloc");
+      exit(EXIT_FAILURE);
+    }
+    memset(r, 0, sizeof *r);
+    atomic_init(&r->used, 1);
+    r->next = atomic_load(&ebr_recs);
+    while (!atomic_compare_exchange_weak(&ebr_recs, &r->next, r))
+      ;
+  }
+  pthread_setspecific(ebr_key, r);
+  return ebr_self = r;
+}
+
+static void ebr_enter(void) {
+  ebr_rec *r = ebr_rec_get();
+  if (r->depth++ > 0)
+    return;
+  atomic_store_explicit(&r->epoch, atomic_load(&ebr_epoch),
+                        memory_order_relaxed);
+  // Pairs with ebr_barrier(): either the writer's scan sees this record,
+  // or every load below sees what the writer unlinked.
+  if (ebr_membarrier)
+    atomic_signal_fence(memory_order_seq_cst);
+  else
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+static void ebr_exit(void) {
+  ebr_rec *r = ebr_self;
+  if (--r->depth == 0)
+    atomic_store_explicit(&r->epoch, 0, memory_order_release);
+}
+
+// Oldest epoch a reader is still in, UINT64_MAX when there is none.
+static uint64_t ebr_oldest(void) {
+  uint64_t min = UINT64_MAX;
+  for (ebr_rec *r = atomic_load(&ebr_recs); r; r = r->next) {
+    uint64_t e = atomic_load(&r->epoch);
+    if (e != 0 && e < min)
+      min = e;
+  }
+  return min;
+}
+
+// --- Shards ---
+
+static inline shard *shard_of(const ht_conc *m, uint64_t hash) {
+  return (shard *)&m->shards[hash >> (64 - SHARD_BITS)];
+}
+
+static table *table_new(size_t cap) {
+  table *t = calloc(1, sizeof *t + cap * sizeof t->slot[0]);
+  if (t)
+    t->cap = cap;
+  return t;
+}
+
+// Room to retire n more blocks, so a write never fails after unlinking.
+static int retire_reserve(shard *s, size_t n) {
+  if (s->nretired + n <= s->retired_cap)
+    return 0;
+  size_t ncap = s->retired_cap ? s->retired_cap * 2 : RETIRE_BATCH * 2;
+  while (ncap < s->nretired + n)
+    ncap *= 2;
+  retired *nr = realloc(s->retired, ncap * sizeof *nr);
+  if (!nr)
+    return -1;
+  s->retired = nr;
+  s->retired_cap = ncap;
+  return 0;
+}
+
+static void reclaim(shard *s) {
+  // Readers entering from now on cannot reach anything retired so far
+  atomic_fetch_add(&ebr_epoch, 1);
+  ebr_barrier();
+  uint64_t oldest = ebr_oldest();
+  size_t keep = 0;
+  for (size_t i = 0; i < s->nretired; i++) {
+    if (s->retired[i].epoch < oldest)
+      free(s->retired[i].p);
+    else
+      s->retired[keep++] = s->retired[i];
+  }
+  s->nretired = keep;
+  // A reader that stays inside must not turn this into a scan per write
+  s->reclaim_at = keep + RETIRE_BATCH;
+}
+
+// p is already unreachable for new readers.
+static void retire(shard *s, void *p) {
+  s->retired[s->nretired++] =
+      (retired){.p = p, .epoch = atomic_load(&ebr_epoch)};
+  if (s->nretired >= s->reclaim_at)
+    reclaim(s);
+}
+
+// Only writers, under the lock, change n; a plain load/store pair will do.
+static inline void count_add(shard *s, size_t d) {
+  size_t n = atomic_load_explicit(&s->n, memory_order_relaxed);
+  atomic_store_explicit(&s->n, n + d, memory_order_relaxed);
+}
+
+static inline int node_is(const node *e, const void *k, size_t len,
+                          uint64_t hash) {
+  return e->hash == hash && e->len == len && memcmp(e->key, k, len) == 0;
+}
+
+// Publish a copy of t without tombstones, sized for n + 1 keys.
+static int shard_resize(shard *s, table *t) {
+  size_t n = atomic_load_explicit(&s->n, memory_order_relaxed);
+  size_t cap = MIN_CAP;
+  while (cap / 8 * 3 < n + 1) // at most 3/8 full afterwards
+    cap *= 2;
+  table *nt = table_new(cap);
+  if (!nt)
+    return -1;
+  for (size_t i = 0; i < t->cap; i++) {
+    node *e = atomic_load_explicit(&t->slot[i], memory_order_relaxed);
+    if (!e || e == TOMB)
+      continue;
+    size_t j = e->hash & (cap - 1);
+    while (atomic_load_explicit(&nt->slot[j], memory_order_relaxed))
+      j = (j + 1) & (cap - 1);
+    atomic_store_explicit(&nt->slot[j], e, memory_order_relaxed);
+  }
+  atomic_store(&s->tab, nt);
+  s->used = n;
+  retire(s, t);
+  return 0;
+}
+
+static int shard_set(shard *s, const void *k, size_t len, uint64_t hash,
+                     void *v) {
+  if (retire_reserve(s, 1) < 0) // the old table, should this resize
+    return -1;
+  table *t = atomic_load_explicit(&s->tab, memory_order_relaxed);
+  size_t mask = t->cap - 1, at = SIZE_MAX, i = hash & mask;
+  for (size_t probes = 0; probes < t->cap; probes++, i = (i + 1) & mask) {
+    node *e = atomic_load_explicit(&t->slot[i], memory_order_relaxed);
+    if (!e) {
+      if (at == SIZE_MAX)
+        at = i;
+      break;
+    }
+    if (e == TOMB) {
+      if (at == SIZE_MAX)
+        at = i;
+    } else if (node_is(e, k, len, hash)) {
+      atomic_store_explicit(&e->value, v, memory_order_release);
+      return 0;
+    }
+  }
+
+  node *e = malloc(sizeof *e + len + 1);
+  if (!e)
+    return -1;
+  e->hash = hash;
+  atomic_init(&e->value, v);
+  e->len = len;
+  memcpy(e->key, k, len);
+  e->key[len] = '\0';
+
+  // Taking a NULL slot shortens probes for everyone: keep 1/4 of them
+  if (at == SIZE_MAX ||
+      (!atomic_load_explicit(&t->slot[at], memory_order_relaxed) &&
+       s->used + 1 > t->cap / 4 * 3)) {
+    if (shard_resize(s, t) < 0) {
+      free(e);
+      return -1;
+    }
+    t = atomic_load_explicit(&s->tab, memory_order_relaxed);
+    mask = t->cap - 1;
+    at = hash & mask;
+    while (atomic_load_explicit(&t->slot[at], memory_order_relaxed))
+      at = (at + 1) & mask;
+  }
+  if (!atomic_load_explicit(&t->slot[at], memory_order_relaxed))
+    s->used++;
+  atomic_store_explicit(&t->slot[at], e, memory_order_release);
+  count_add(s, 1);
+  return 0;
+}
+
+static int shard_del(shard *s, const void *k, size_t len, uint64_t hash) {
+  if (retire_reserve(s, 1) < 0)
+    return -1;
+  table *t = atomic_load_explicit(&s->tab, memory_order_relaxed);
+  size_t mask = t->cap - 1, i = hash & mask;
+  for (size_t probes = 0; probes < t->cap; probes++, i = (i + 1) & mask) {
+    node *e = atomic_load_explicit(&t->slot[i], memory_order_relaxed);
+    if (!e)
+      break;
+    if (e != TOMB && node_is(e, k, len, hash)) {
+      atomic_store(&t->slot[i], TOMB); // seq_cst: see ebr_enter
+      count_add(s, (size_t)-1);
+      retire(s, e);
+      return 0;
+    }
+  }
+  return -1; // not found
+}
+
+ht_conc *ht_conc_new(size_t initial_cap) {
+  pthread_once(&ebr_once, ebr_init);
+  ht_conc *m = aligned_alloc(64, sizeof *m);
+  if (!m)
+    return NULL;
+  memset(m, 0, sizeof *m);
+  m->seed = new_seed();
+  size_t cap = MIN_CAP;
+  while (cap / 4 * 3 * SHARDS < initial_cap)
+    cap *= 2;
+  for (size_t i = 0; i < SHARDS; i++) {
+    shard *s = &m->shards[i];
+    table *t = table_new(cap);
+    if (!t) {
+      for (size_t j = 0; j < i; j++) {
+        pthread_mutex_destroy(&m->shards[j].lock);
+        free(atomic_load(&m->shards[j].tab));
+      }
+      free(m);
+      return NULL;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    atomic_init(&s->tab, t);
+    s->reclaim_at = RETIRE_BATCH;
+  }
+  return m;
+}
+
+void ht_conc_free(ht_conc *m) {
+  if (!m)
+    return;
+  for (size_t i = 0; i < SHARDS; i++) {
+    shard *s = &m->shards[i];
+    table *t = atomic_load(&s->tab);
+    for (size_t j = 0; j < t->cap; j++) {
+      node *e = atomic_load_explicit(&t->slot[j], memory_order_relaxed);
+      if (e && e != TOMB)
+        free(e);
+    }
+    free(t);
+    // Nobody else uses m, so nothing retired can still be read
+    for (size_t j = 0; j < s->nretired; j++)
+      free(s->retired[j].p);
+    free(s->retired);
+    pthread_mutex_destroy(&s->lock);
+  }
+  free(m);
+}
+
+int ht_conc_set_n(ht_conc *m, const void *k, size_t len, void *v) {
+  if (!m)
+    return -1;
+  uint64_t hash = hash64(k, len, m->seed);
+  shard *s = shard_of(m, hash);
+  pthread_mutex_lock(&s->lock);
+  int rc = shard_set(s, k, len, hash, v);
+  pthread_mutex_unlock(&s->lock);
+  return rc;
+}
+
+void *ht_conc_get_n(const ht_conc *m, const void *k, size_t len) {
+  uint64_t hash = hash64(k, len, m->seed);
+  shard *s = shard_of(m, hash);
+  void *v = NULL;
+  ebr_enter();
+  table *t = atomic_load_explicit(&s->tab, memory_order_acquire);
+  size_t mask = t->cap - 1, i = hash & mask;
+  for (size_t probes = 0; probes < t->cap; probes++, i = (i + 1) & mask) {
+    node *e = atomic_load_explicit(&t->slot[i], memory_order_acquire);
+    if (!e)
+      break;
+    if (e != TOMB && node_is(e, k, len, hash)) {
+      v = atomic_load_explicit(&e->value, memory_order_acquire);
+      break;
+    }
+  }
+  ebr_exit();
+  return v;
+}
+
+int ht_conc_del_n(ht_conc *m, const void *k, size_t len) {
+  if (!m)
+    return -1;
+  uint64_t hash = hash64(k, len, m->seed);
+  shard *s = shard_of(m, hash);
+  pthread_mutex_lock(&s->lock);
+  int rc = shard_del(s, k, len, hash);
+  pthread_mutex_unlock(&s->lock);
+  return rc;
+}
+
+int ht_conc_set(ht_conc *m, const char *k, void *v) {
+  return ht_conc_set_n(m, k, strlen(k), v);
+}
+
+void *ht_conc_get(const ht_conc *m, const char *k) {
+  return ht_conc_get_n(m, k, strlen(k));
+}
+
+int ht_conc_del(ht_conc *m, const char *k) {
+  return ht_conc_del_n(m, k, strlen(k));
+}
+
+size_t ht_conc_len(const ht_conc *m) {
+  size_t n = 0;
+  for (size_t i = 0; i < SHARDS; i++)
+    n += atomic_load_explicit(&m->shards[i].n, memory_order_relaxed);
+  return n;
+}
+
+int ht_conc_each(const ht_conc *m, ht_conc_fn fn, void *arg) {
+  for (size_t i = 0; i < SHARDS; i++) {
+    // The array loaded here is walked to the end even if a resize
+    // replaces it meanwhile; the read section keeps it and its nodes alive.
+    ebr_enter();
+    table *t = atomic_load_explicit(&m->shards[i].tab, memory_order_acquire);
+    int rc = 0;
+    for (size_t j = 0; j < t->cap && rc == 0; j++) {
+      node *e = atomic_load_explicit(&t->slot[j], memory_order_acquire);
+      if (e && e != TOMB)
+        rc = fn(e->key, e->len,
+                atomic_load_explicit(&e->value, memory_order_acquire), arg);
+    }
+    ebr_exit();
+    if (rc != 0)
+      return rc;
+  }
+  return 0;
+}
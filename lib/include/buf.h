@@ -0,0 +1,31 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte ring for connection input/output. The storage is mapped twice back
+// to back, so the len bytes at data are always contiguous even when they
+// wrap: parsers keep indexing data[0..len) and consuming is a cursor bump.
+// If the double mapping cannot be made, a plain heap buffer is used and
+// compacted lazily instead.
+//
+// Storage is released as soon as the buffer drains, into a per-thread pool
+// of ring sizes from 4 KiB to 4 MiB, and bigger rings shrink back once
+// mostly read. Pointers into data do not survive a consume that empties it.
+typedef struct Buf {
+  uint8_t *data; // first unread byte
+  size_t len;    // used
+  size_t cap;    // allocated
+  uint8_t *base; // start of the storage
+  int mirror;    // 0/1 base is a double mapping of 2 * cap bytes
+} Buf;
+
+// Make room for need more bytes at data + len.
+int buf_reserve(Buf *b, size_t need);
+int buf_append(Buf *b, const void *src, size_t n);
+// Writable room after the unread bytes, in one contiguous run. Fill it
+// directly (e.g. with recv into buf_tail) and then buf_commit what landed.
+size_t buf_spare(const Buf *b);
+static inline uint8_t *buf_tail(Buf *b) { return b->data + b->len; }
+void buf_commit(Buf *b, size_t n);
+void buf_consume(Buf *b, size_t n);
+void buf_free(Buf *b);
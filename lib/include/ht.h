@@ -3,9 +3,49 @@
 
 typedef struct ht ht;
 
+// String keys are copied on insert; values are stored as given and never
+// freed. Each table hashes with its own random seed. Growing and shrinking
+// move a few entries per ht_set/ht_del, so no call rehashes everything.
+// For other key or value types, see HT_DEFINE in ht_gen.h.
 ht *ht_new(size_t initial_cap);
 void ht_free(ht *m);
 int ht_set(ht *m, const char *key, void *val);
 void *ht_get(const ht *m, const char *key);
 int ht_del(ht *m, const char *key);
 size_t ht_len(const ht *m);
+// Slots allocated, counting both tables while a resize is under way.
+size_t ht_cap(const ht *m);
+
+// Same, for len-byte keys that need not be NUL-terminated and may contain
+// NUL bytes, e.g. a slice of a network buffer.
+int ht_set_n(ht *m, const void *key, size_t len, void *val);
+void *ht_get_n(const ht *m, const void *key, size_t len);
+int ht_del_n(ht *m, const void *key, size_t len);
+
+// Probe-length distribution: hist[d] counts the keys found in the d-th
+// 16-slot group their lookup visits (0 = home group); the last bin also
+// collects everything longer. Returns the longest probe, in groups.
+size_t ht_probe_hist(const ht *m, size_t *hist, size_t nbins);
+
+// Keys longer than 16 bytes are copied into an arena. Once half of it
+// holds deleted keys it is compacted, a few slots per ht_set/ht_del: used
+// and dead count its bytes and those of deleted keys, last_slots and
+// last_bytes the slots the latest of those calls swept and the key bytes
+// it moved.
+typedef struct ht_arena_stats {
+  size_t used, dead;
+  size_t last_slots, last_bytes;
+} ht_arena_stats;
+ht_arena_stats ht_arena(const ht *m);
+
+// Write m to path, replacing it atomically; finishes a resize in progress
+// first. Values are saved as the bits of the pointers, so they only mean
+// something after a restart if they are not real pointers: small integers,
+// offsets into the caller's own file, and the like. Returns 0 or -1.
+int ht_snapshot(ht *m, const char *path);
+// Map a snapshot and query it in place: opening reads nothing but the
+// header, pages come in as lookups touch them. The mapping is private, so
+// the table can be modified freely; changed pages are copied, the file is
+// never written. The file must come from ht_snapshot on the same kind of
+// machine. Returns NULL on error.
+ht *ht_open_mapped(const char *path);
@@ -0,0 +1,32 @@
+#pragma once
+#include <stddef.h>
+
+typedef struct ht_conc ht_conc;
+
+// Concurrent variant of ht for state shared between reactor threads.
+// Lookups and iteration take no lock; writers lock one of a fixed set of
+// shards, picked by hash. Keys are copied; values are stored as given and
+// never freed, so keeping the object a value points to alive is up to the
+// caller.
+ht_conc *ht_conc_new(size_t initial_cap);
+// No other thread may be using m any more.
+void ht_conc_free(ht_conc *m);
+int ht_conc_set(ht_conc *m, const char *key, void *val);
+void *ht_conc_get(const ht_conc *m, const char *key);
+int ht_conc_del(ht_conc *m, const char *key);
+// Approximate while writers are active.
+size_t ht_conc_len(const ht_conc *m);
+
+// Same, for len-byte keys that need not be NUL-terminated.
+int ht_conc_set_n(ht_conc *m, const void *key, size_t len, void *val);
+void *ht_conc_get_n(const ht_conc *m, const void *key, size_t len);
+int ht_conc_del_n(ht_conc *m, const void *key, size_t len);
+
+// Call fn for each entry, one shard at a time, until it returns nonzero;
+// returns that value, or 0. Safe while other threads modify m, and fn may
+// call ht_conc_* itself: keys present for the whole walk are seen once,
+// keys added or removed meanwhile may or may not be, and a key deleted and
+// re-added during the walk can be seen twice. key is NUL-terminated and
+// only valid during the call.
+typedef int (*ht_conc_fn)(const char *key, size_t len, void *val, void *arg);
+int ht_conc_each(const ht_conc *m, ht_conc_fn fn, void *arg);
@@ -0,0 +1,508 @@
+#pragma once
+// Open-addressing hash tables specialised for one key and value type, in
+// the spirit of khash:
+//
+//   HT_DEFINE(name, key_t, val_t, hash_fn, eq_fn)
+//
+// emits a table type `name` plus static inline name_* functions over it:
+//
+//   int name_init(name *t, size_t n);          room for n before growing
+//   void name_destroy(name *t);
+//   val_t *name_get(const name *t, key_t k);   NULL when absent
+//   name_slot *name_get_slot(const name *t, key_t k);  same, key included
+//   val_t *name_put(name *t, key_t k, int *added);
+//   int name_del(name *t, key_t k);            0, or -1 when absent
+//   size_t name_len(const name *t), name_cap(const name *t);
+//   void name_settle(name *t);                 finish a resize now
+//   name_slot *name_next(const name *t, size_t *pos);
+//   size_t name_probe_hist(const name *t, size_t *hist, size_t nbins);
+//
+// Keys and values are stored inline in the slots. name_put finds k or
+// inserts it with a zeroed value; either way it returns where the value
+// lives (NULL when out of memory) and sets *added to 1 for a new key.
+// Value pointers are valid until the next put or del. name_next walks the
+// entries: start with *pos = 0 and stop at NULL; the table must not be
+// changed meanwhile, except through the returned slots' values.
+//
+// hash_fn(key_t) returns a uint64_t, eq_fn(key_t, key_t) nonzero for equal
+// keys; both may be macros. Only bits 32..63 pick the probe position and
+// bits 0..6 the control byte. Resizes call hash_fn again on stored keys,
+// so it should be cheap there; ht_hash_u64() suits integer keys.
+//
+//   HT_DEFINE_CTX(name, key_t, val_t, ctx_t, hash_fn, eq_fn)
+//
+// is the same, except that the table has a ctx_t ctx member, zeroed by
+// name_init and then the caller's to set, which the callbacks get as
+// their first argument: hash_fn(ctx, key), eq_fn(ctx, a, b). That is for
+// keys that only make sense next to some table-wide state, e.g. offsets
+// into a key arena.
+//
+// The layout is Swiss-table style: one control byte per slot, scanned a
+// 16-slot group at a time. Control bytes are chosen so a zeroed array is an
+// empty table:
+//   0x00       empty
+//   0x01       deleted (tombstone)
+//   0x80 | h2  full, h2 = low 7 bits of the hash
+// Resizing is incremental, like Redis dict: a new table takes all inserts
+// while every put/del moves a few entries over from the old one, so no
+// single call pays for the whole table. Lookups check both.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define HTG_GROUP 16
+#define HTG_EMPTY 0x00
+#define HTG_DELETED 0x01
+#define HTG_FULL 0x80
+
+#define HTG_MIGRATE_SLOTS 4  // entries moved per put/del while resizing
+#define HTG_MIGRATE_EMPTY 32 // empty groups that may be skipped on top of that
+#define HTG_RELEASE_CHUNK ((uintptr_t)1 << 20) // old slot bytes freed at once
+
+#ifdef __SSE2__
+_Static_assert(_Alignof(max_align_t) >= HTG_GROUP, "groups are loaded aligned");
+#endif
+
+// 64-bit integer mix (wyhash's multiply-and-fold) for hash_fn.
+static inline uint64_t ht_hash_u64(uint64_t x) {
+  __uint128_t r = (__uint128_t)(x ^ 0xa0761d6478bd642full) *
+                  0xe7037ed1a0b428dbull;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+// One open-addressing table; an instantiation has two while resizing.
+typedef struct htg_tab {
+  uint8_t *ctrl; // cap bytes
+  void *slots;   // cap slots of the instantiation's slot type
+  size_t cap;    // power of two, multiple of HTG_GROUP; 0 = unused
+  size_t n;      // live entries
+  size_t tombs;  // deleted control bytes
+  int borrowed;  // ctrl and slots are not ours to free, e.g. a mapped file
+} htg_tab;
+
+static inline uint8_t htg_h2(uint64_t hash) {
+  return HTG_FULL | (hash & 0x7f);
+}
+
+// Bit i set when ctrl[i] == b, for the 16 bytes of one group.
+static inline unsigned htg_match(const uint8_t *g, uint8_t b) {
+#ifdef __SSE2__
+  __m128i v = _mm_load_si128((const __m128i *)g);
+  __m128i eq = _mm_cmpeq_epi8(v, _mm_set1_epi8((char)b));
+  return (unsigned)_mm_movemask_epi8(eq);
+#else
+  unsigned m = 0;
+  for (int i = 0; i < HTG_GROUP; i++)
+    m |= (unsigned)(g[i] == b) << i;
+  return m;
+#endif
+}
+
+// Slots that are empty or deleted: control byte has the top bit clear.
+static inline unsigned htg_match_free(const uint8_t *g) {
+#ifdef __SSE2__
+  __m128i v = _mm_load_si128((const __m128i *)g);
+  return (unsigned)_mm_movemask_epi8(v) ^ 0xffff;
+#else
+  unsigned m = 0;
+  for (int i = 0; i < HTG_GROUP; i++)
+    m |= (unsigned)!(g[i] & HTG_FULL) << i;
+  return m;
+#endif
+}
+
+// Groups are visited in triangular order, which reaches every group of a
+// power-of-two table. A lookup stops at the first group with an empty slot.
+static inline size_t htg_probe_start(const htg_tab *b, uint64_t hash) {
+  return (size_t)(hash >> 32) & (b->cap - 1) & ~(size_t)(HTG_GROUP - 1);
+}
+
+static inline size_t htg_probe_next(const htg_tab *b, size_t pos, size_t i) {
+  return (pos + i * HTG_GROUP) & (b->cap - 1);
+}
+
+// Smallest table that holds n entries at the max load of 7/8.
+static inline size_t htg_cap_for(size_t n) {
+  size_t cap = HTG_GROUP;
+  while (cap / 8 * 7 < n)
+    cap *= 2;
+  return cap;
+}
+
+// calloc rather than malloc + memset: zeroed control bytes are an empty
+// table, and a big calloc gets fresh pages zeroed on first touch instead
+// of stalling the insert that started the resize.
+static inline int htg_tab_alloc(htg_tab *b, size_t cap, size_t slot_size) {
+  uint8_t *ctrl = calloc(cap, 1);
+  void *slots = malloc(cap * slot_size);
+  if (!ctrl || !slots) {
+    free(ctrl);
+    free(slots);
+    return -1;
+  }
+  *b = (htg_tab){.ctrl = ctrl, .slots = slots, .cap = cap};
+  return 0;
+}
+
+static inline void htg_tab_free(htg_tab *b) {
+  if (!b->borrowed) {
+    free(b->ctrl);
+    free(b->slots);
+  }
+  *b = (htg_tab){0};
+}
+
+// First free slot on hash's probe sequence; claims it for a new entry.
+static inline size_t htg_claim(htg_tab *b, uint64_t hash) {
+  size_t pos = htg_probe_start(b, hash);
+  for (size_t i = 1;; i++) {
+    unsigned m = htg_match_free(b->ctrl + pos);
+    if (m) {
+      size_t s = pos + (size_t)__builtin_ctz(m);
+      if (b->ctrl[s] == HTG_DELETED)
+        b->tombs--;
+      b->ctrl[s] = htg_h2(hash);
+      b->n++;
+      return s;
+    }
+    pos = htg_probe_next(b, pos, i);
+  }
+}
+
+// Empty the slot; if its group still has an empty slot no probe ever
+// continued past it, so it can go straight back to empty. Otherwise it
+// has to stay a tombstone.
+static inline void htg_erase(htg_tab *b, size_t s) {
+  const uint8_t *g = b->ctrl + (s & ~(size_t)(HTG_GROUP - 1));
+  if (htg_match(g, HTG_EMPTY)) {
+    b->ctrl[s] = HTG_EMPTY;
+  } else {
+    b->ctrl[s] = HTG_DELETED;
+    b->tombs++;
+  }
+  b->n--;
+}
+
+// Old slots behind the migration cursor are never read again: their
+// control bytes no longer say full. Give their pages back a chunk at a
+// time, so freeing a large old table at the end is cheap instead of
+// stalling one insert. Needs MADV_DONTNEED, i.e. _GNU_SOURCE or
+// _DEFAULT_SOURCE; without it the pages simply wait for the free.
+static inline void htg_release(const htg_tab *old, size_t slot_size,
+                               size_t upto, size_t *released) {
+#ifdef MADV_DONTNEED
+  uintptr_t base = (uintptr_t)old->slots;
+  uintptr_t lo =
+      (base + *released + HTG_RELEASE_CHUNK - 1) & ~(HTG_RELEASE_CHUNK - 1);
+  uintptr_t hi = (base + upto * slot_size) & ~(HTG_RELEASE_CHUNK - 1);
+  if (hi <= lo)
+    return;
+  madvise((void *)lo, hi - lo, MADV_DONTNEED); // best effort
+  *released = hi - base;
+#else
+  (void)old, (void)slot_size, (void)upto, (void)released;
+#endif
+}
+
+// Groups from a key's probe start to its slot, counted from 0.
+static inline size_t htg_probe_len(const htg_tab *b, uint64_t hash, size_t s) {
+  size_t home = s & ~(size_t)(HTG_GROUP - 1);
+  size_t pos = htg_probe_start(b, hash), d = 0;
+  while (pos != home) {
+    d++;
+    pos = htg_probe_next(b, pos, d);
+  }
+  return d;
+}
+
+// HT_DEFINE and HT_DEFINE_CTX differ only in the struct and in how the
+// callbacks are called; HTG_IMPL emits the rest.
+#define HT_DEFINE(name, key_t, val_t, hash_fn, eq_fn)                          \
+  HTG_DECLARE(name, key_t, val_t, )                                            \
+  static inline uint64_t name##_hash_(const name *t, const key_t *k) {         \
+    (void)t;                                                                   \
+    return hash_fn(*k);                                                        \
+  }                                                                            \
+  static inline int name##_eq_(const name *t, const key_t *a,                  \
+                               const key_t *b) {                               \
+    (void)t;                                                                   \
+    return eq_fn(*a, *b);                                                      \
+  }                                                                            \
+  HTG_IMPL(name, key_t, val_t)
+
+#define HT_DEFINE_CTX(name, key_t, val_t, ctx_t, hash_fn, eq_fn)               \
+  HTG_DECLARE(name, key_t, val_t, ctx_t ctx;)                                  \
+  static inline uint64_t name##_hash_(const name *t, const key_t *k) {         \
+    (void)t; /* for callbacks that are macros ignoring ctx */                  \
+    return hash_fn(t->ctx, *k);                                                \
+  }                                                                            \
+  static inline int name##_eq_(const name *t, const key_t *a,                  \
+                               const key_t *b) {                               \
+    (void)t;                                                                   \
+    return eq_fn(t->ctx, *a, *b);                                              \
+  }                                                                            \
+  HTG_IMPL(name, key_t, val_t)
+
+#define HTG_DECLARE(name, key_t, val_t, extra)                                 \
+  typedef struct name##_slot {                                                 \
+    key_t key;                                                                 \
+    val_t val;                                                                 \
+  } name##_slot;                                                               \
+                                                                               \
+  typedef struct name {                                                        \
+    htg_tab cur;     /* where new entries go */                                \
+    htg_tab old;     /* being drained into cur when old.cap != 0 */            \
+    size_t migrate;  /* next old slot to drain */                              \
+    size_t released; /* bytes at the start of old.slots given back */          \
+    extra                                                                      \
+  } name;
+
+#define HTG_IMPL(name, key_t, val_t)                                           \
+  static inline name##_slot *name##_slots(const htg_tab *b) {                  \
+    return (name##_slot *)b->slots;                                            \
+  }                                                                            \
+                                                                               \
+  static inline long name##_find(const name *t, const htg_tab *b,              \
+                                 const key_t *k, uint64_t hash) {              \
+    if (b->cap == 0)                                                           \
+      return -1;                                                               \
+    const name##_slot *sl = name##_slots(b);                                   \
+    uint8_t tag = htg_h2(hash);                                                \
+    size_t pos = htg_probe_start(b, hash);                                     \
+    for (size_t i = 1; i <= b->cap / HTG_GROUP; i++) {                         \
+      const uint8_t *g = b->ctrl + pos;                                        \
+      for (unsigned m = htg_match(g, tag); m; m &= m - 1) {                    \
+        size_t s = pos + (size_t)__builtin_ctz(m);                             \
+        if (name##_eq_(t, &sl[s].key, k))                                      \
+          return (long)s;                                                      \
+      }                                                                        \
+      if (htg_match(g, HTG_EMPTY))                                             \
+        return -1;                                                             \
+      pos = htg_probe_next(b, pos, i);                                         \
+    }                                                                          \
+    return -1;                                                                 \
+  }                                                                            \
+                                                                               \
+  static inline void name##_move(const name *t, htg_tab *dst,                  \
+                                 const name##_slot *e) {                       \
+    name##_slots(dst)[htg_claim(dst, name##_hash_(t, &e->key))] = *e;          \
+  }                                                                            \
+                                                                               \
+  /* Move up to n entries from old into cur. As in htg_erase, a moved slot     \
+     only becomes empty if its group already stopped every probe; otherwise    \
+     it is a tombstone, so keys further along a probe sequence in old stay     \
+     reachable until they move too. */                                         \
+  static inline void name##_migrate(name *t, size_t n) {                       \
+    htg_tab *o = &t->old;                                                      \
+    const name##_slot *sl = name##_slots(o);                                   \
+    size_t empty = HTG_MIGRATE_EMPTY;                                          \
+    while (n > 0 && t->migrate < o->cap) {                                     \
+      uint8_t *g = o->ctrl + t->migrate;                                       \
+      unsigned m = htg_match_free(g) ^ 0xffff;                                 \
+      if (!m) {                                                                \
+        t->migrate += HTG_GROUP;                                               \
+        if (empty-- == 0)                                                      \
+          break;                                                               \
+        continue;                                                              \
+      }                                                                        \
+      uint8_t mark = htg_match(g, HTG_EMPTY) ? HTG_EMPTY : HTG_DELETED;        \
+      for (; m && n > 0; m &= m - 1, n--) {                                    \
+        size_t s = t->migrate + (size_t)__builtin_ctz(m);                      \
+        name##_move(t, &t->cur, &sl[s]);                                       \
+        g[s - t->migrate] = mark;                                              \
+        o->n--;                                                                \
+      }                                                                        \
+      if (!m)                                                                  \
+        t->migrate += HTG_GROUP;                                               \
+    }                                                                          \
+    if (t->migrate >= o->cap)                                                  \
+      htg_tab_free(o);                                                         \
+    else                                                                       \
+      htg_release(o, sizeof(name##_slot), t->migrate, &t->released);           \
+  }                                                                            \
+                                                                               \
+  /* Start moving everything into a fresh table of cap slots. */               \
+  static inline int name##_rehash_start(name *t, size_t cap) {                 \
+    htg_tab nb;                                                                \
+    if (htg_tab_alloc(&nb, cap, sizeof(name##_slot)) < 0)                      \
+      return -1;                                                               \
+    t->old = t->cur;                                                           \
+    t->cur = nb;                                                               \
+    t->migrate = 0;                                                            \
+    t->released = 0;                                                           \
+    name##_migrate(t, HTG_MIGRATE_SLOTS);                                      \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* Fold both tables into one of cap slots right away. */                     \
+  static inline int name##_rehash_all(name *t, size_t cap) {                   \
+    htg_tab nb;                                                                \
+    if (htg_tab_alloc(&nb, cap, sizeof(name##_slot)) < 0)                      \
+      return -1;                                                               \
+    htg_tab *from[2] = {&t->cur, &t->old};                                     \
+    for (int i = 0; i < 2; i++) {                                              \
+      for (size_t s = 0; s < from[i]->cap; s++)                                \
+        if (from[i]->ctrl[s] & HTG_FULL)                                       \
+          name##_move(t, &nb, &name##_slots(from[i])[s]);                      \
+      htg_tab_free(from[i]);                                                   \
+    }                                                                          \
+    t->cur = nb;                                                               \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* Finish a resize in progress right away, e.g. before writing the           \
+     table out. */                                                             \
+  static inline void name##_settle(name *t) {                                  \
+    while (t->old.cap)                                                         \
+      name##_migrate(t, SIZE_MAX);                                             \
+  }                                                                            \
+                                                                               \
+  static inline size_t name##_len(const name *t) {                             \
+    return t->cur.n + t->old.n;                                                \
+  }                                                                            \
+                                                                               \
+  /* Slots allocated, counting both tables while a resize is under way. */     \
+  static inline size_t name##_cap(const name *t) {                             \
+    return t->cur.cap + t->old.cap;                                            \
+  }                                                                            \
+                                                                               \
+  /* Make room for one more entry in cur. */                                   \
+  static inline int name##_reserve_one(name *t) {                              \
+    htg_tab *c = &t->cur;                                                      \
+    if (c->n + c->tombs + 1 <= c->cap / 8 * 7) /* max load, tombs too */       \
+      return 0;                                                                \
+    if (t->old.cap) {                                                          \
+      /* Migration moves HTG_MIGRATE_SLOTS entries per put, so it should       \
+         end long before cur fills. Should it not, fold everything into        \
+         one table rather than overfill cur. */                                \
+      size_t cap = HTG_GROUP;                                                  \
+      while (cap / 2 < name##_len(t) + 1)                                      \
+        cap *= 2;                                                              \
+      return name##_rehash_all(t, cap);                                        \
+    }                                                                          \
+    /* Mostly tombstones: rebuild at the same size instead of growing */       \
+    size_t cap = c->n + 1 > c->cap / 2 ? c->cap * 2 : c->cap;                  \
+    if (name##_rehash_start(t, cap) < 0) /* one empty slot must stay */        \
+      return c->n + c->tombs + 1 <= c->cap - 1 ? 0 : -1;                       \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline int name##_init(name *t, size_t n) {                           \
+    *t = (name){0};                                                            \
+    return htg_tab_alloc(&t->cur, htg_cap_for(n), sizeof(name##_slot));        \
+  }                                                                            \
+                                                                               \
+  static inline void name##_destroy(name *t) {                                 \
+    htg_tab_free(&t->cur);                                                     \
+    htg_tab_free(&t->old);                                                     \
+  }                                                                            \
+                                                                               \
+  /* The stored key can differ from k where eq_fn is looser than ==,        \
+     e.g. arena offsets or indexes that only compare what they point at. */    \
+  static inline name##_slot *name##_get_slot(const name *t, key_t k) {         \
+    uint64_t hash = name##_hash_(t, &k);                                       \
+    long at = name##_find(t, &t->cur, &k, hash);                               \
+    if (at >= 0)                                                               \
+      return &name##_slots(&t->cur)[at];                                       \
+    at = name##_find(t, &t->old, &k, hash);                                    \
+    return at >= 0 ? &name##_slots(&t->old)[at] : NULL;                        \
+  }                                                                            \
+                                                                               \
+  static inline val_t *name##_get(const name *t, key_t k) {                    \
+    name##_slot *e = name##_get_slot(t, k);                                    \
+    return e ? &e->val : NULL;                                                 \
+  }                                                                            \
+                                                                               \
+  static inline val_t *name##_put(name *t, key_t k, int *added) {              \
+    if (t->old.cap)                                                            \
+      name##_migrate(t, HTG_MIGRATE_SLOTS);                                    \
+    uint64_t hash = name##_hash_(t, &k);                                       \
+    long at = name##_find(t, &t->cur, &k, hash);                               \
+    name##_slot *e = NULL;                                                     \
+    if (at >= 0)                                                               \
+      e = &name##_slots(&t->cur)[at];                                          \
+    else if ((at = name##_find(t, &t->old, &k, hash)) >= 0)                    \
+      e = &name##_slots(&t->old)[at]; /* carried over when it moves */         \
+    if (e) {                                                                   \
+      if (added)                                                               \
+        *added = 0;                                                            \
+      return &e->val;                                                          \
+    }                                                                          \
+    if (name##_reserve_one(t) < 0)                                             \
+      return NULL;                                                             \
+    e = &name##_slots(&t->cur)[htg_claim(&t->cur, hash)];                      \
+    e->key = k;                                                                \
+    memset(&e->val, 0, sizeof e->val);                                         \
+    if (added)                                                                 \
+      *added = 1;                                                              \
+    return &e->val;                                                            \
+  }                                                                            \
+                                                                               \
+  static inline int name##_del(name *t, key_t k) {                             \
+    if (t->old.cap)                                                            \
+      name##_migrate(t, HTG_MIGRATE_SLOTS);                                    \
+    uint64_t hash = name##_hash_(t, &k);                                       \
+    htg_tab *b = &t->cur;                                                      \
+    long at = name##_find(t, b, &k, hash);                                     \
+    if (at < 0) {                                                              \
+      b = &t->old;                                                             \
+      at = name##_find(t, b, &k, hash);                                        \
+    }                                                                          \
+    if (at < 0)                                                                \
+      return -1;                                                               \
+    htg_erase(b, (size_t)at);                                                  \
+    /* Shrink once occupancy falls below 1/16, to a table a quarter full.      \
+       The gap to the 7/8 grow point keeps churn from resizing back and        \
+       forth. */                                                               \
+    htg_tab *c = &t->cur;                                                      \
+    if (!t->old.cap && c->cap > HTG_GROUP * 4 && c->n < c->cap / 16) {         \
+      size_t cap = HTG_GROUP;                                                  \
+      while (cap / 4 < c->n)                                                   \
+        cap *= 2;                                                              \
+      (void)name##_rehash_start(t, cap); /* keeps the big table if not */      \
+    }                                                                          \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* Entries of both tables; start with *pos = 0, done at NULL. */             \
+  static inline name##_slot *name##_next(const name *t, size_t *pos) {         \
+    for (; *pos < t->cur.cap + t->old.cap; ++*pos) {                           \
+      const htg_tab *b = *pos < t->cur.cap ? &t->cur : &t->old;                \
+      size_t s = *pos < t->cur.cap ? *pos : *pos - t->cur.cap;                 \
+      if (b->ctrl[s] & HTG_FULL) {                                             \
+        ++*pos;                                                                \
+        return &name##_slots(b)[s];                                            \
+      }                                                                        \
+    }                                                                          \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Probe-length distribution: hist[d] counts the keys found in the d-th      \
+     group their lookup visits (0 = home group); the last bin also collects    \
+     everything longer. Returns the longest probe, in groups. */               \
+  static inline size_t name##_probe_hist(const name *t, size_t *hist,          \
+                                         size_t nbins) {                       \
+    memset(hist, 0, nbins * sizeof *hist);                                     \
+    size_t longest = 0;                                                        \
+    const htg_tab *tabs[2] = {&t->cur, &t->old};                               \
+    for (int i = 0; i < 2; i++) {                                              \
+      const htg_tab *b = tabs[i];                                              \
+      for (size_t s = 0; s < b->cap; s++) {                                    \
+        if (!(b->ctrl[s] & HTG_FULL))                                          \
+          continue;                                                            \
+        uint64_t hash = name##_hash_(t, &name##_slots(b)[s].key);              \
+        size_t d = htg_probe_len(b, hash, s);                                  \
+        hist[d < nbins ? d : nbins - 1]++;                                     \
+        if (d + 1 > longest)                                                   \
+          longest = d + 1;                                                     \
+      }                                                                        \
+    }                                                                          \
+    return longest;                                                            \
+  }
@@ -0,0 +1,96 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buf.h"
+
+typedef struct Reactor Reactor;
+
+// Conns come from a per-reactor slab and are cache-line aligned. The first
+// line holds what event dispatch and the end-of-tick passes touch.
+typedef struct Conn {
+  _Alignas(64) int fd;
+  uint32_t gen;        // unique among the reactor's conns so far
+  uint8_t peer_closed; // 0/1 peer sent FIN
+  uint8_t closing;     // 0/1 close once out is flushed
+  uint8_t dead;        // 0/1 closed, recycled at the end of the loop tick
+  uint8_t out_armed;   // 0/1 EPOLLOUT registered
+  uint8_t queued;      // 0/1 on the reactor's dirty list
+  uint8_t held;        // 0/1 conn_hold: replies still to come, stay open
+  Reactor *r;
+  struct Conn *next_dirty;
+  Buf in;
+  // Cold
+  Buf out;
+  struct Conn *next_dead; // also links the slab free list
+  // io_uring backend
+  Buf sending;         // bytes owned by the in-flight send
+  unsigned inflight;   // submitted operations that still reference this Conn
+  uint8_t recv_armed;  // 0/1 multishot recv active
+  uint8_t rx;          // 0/1 input arrived since the last on_data
+  uint8_t shut_linked; // 0/1 shutdown queued behind the last send
+  _Alignas(max_align_t) unsigned char user[]; // NetProto.user_size bytes
+} Conn;
+
+// Protocol callbacks driven by the reactor. Any of them may be NULL.
+typedef struct NetProto {
+  size_t user_size; // zeroed per-connection state, see conn_user()
+  int max_threads;  // cap on reactor threads for shared state, 0 = no cap
+  void (*on_open)(Conn *c);
+  void (*on_data)(Conn *c); // c->in holds everything not consumed yet
+  void (*on_close)(Conn *c);
+  // Readiness hooks for protocols that move bytes themselves, e.g. with
+  // splice(). When on_readable is set the reactor never reads c->fd and
+  // on_data is not called; forces the epoll backend.
+  void (*on_readable)(Conn *c);
+  void (*on_writable)(Conn *c); // after conn_want_write(c, 1)
+  // After net_wake(r), on r's own thread. Setting it gives every reactor
+  // an eventfd to be woken through.
+  void (*on_wake)(Reactor *r);
+  // Every NetConfig.stats_interval seconds, after the reactor stats, on
+  // the thread that prints them.
+  void (*on_stats)(void);
+} NetProto;
+
+static inline void *conn_user(Conn *c) { return c->user; }
+
+// Queue bytes for the peer.
+void conn_send(Conn *c, const void *src, size_t n);
+// Close once everything queued so far has been sent.
+void conn_shutdown(Conn *c);
+// Close now. on_close runs immediately, the Conn is freed after the tick.
+void conn_close(Conn *c);
+// Ask for on_writable when the socket has room again (0/1).
+void conn_want_write(Conn *c, int on);
+// Keep c open through the peer's FIN and conn_shutdown while replies are
+// still being worked out off the reactor thread (0/1).
+void conn_hold(Conn *c, int on);
+// Have r call on_wake on its own thread soon. Safe from any thread; wakes
+// that arrive together may share one on_wake call.
+void net_wake(Reactor *r);
+
+typedef enum NetBackend { NET_EPOLL, NET_URING } NetBackend;
+
+typedef struct NetConfig {
+  uint16_t port;
+  NetBackend backend; // NET_URING falls back to epoll if the kernel lacks it
+  int threads;        // reactors, each with its own epoll fd and listener
+  int stats_interval; // seconds between per-reactor stats on stderr, 0 = off
+} NetConfig;
+
+// getopt() letters understood by net_config_opt()
+#define NET_OPTS "p:t:s:b:"
+
+// Apply one NET_OPTS option. Returns -1 on unknown option or bad value.
+int net_config_opt(NetConfig *cfg, int opt, const char *arg);
+void net_usage(const char *prog, const char *extra);
+// getopt() loop for servers without options of their own.
+void net_parse_args(NetConfig *cfg, int argc, char **argv);
+
+int make_listener(uint16_t port);
+// Same, with SO_REUSEPORT so several sockets can share the port.
+int make_listener_reuseport(uint16_t port);
+
+// Start cfg->threads reactors and run them forever. With more than one,
+// each thread owns a SO_REUSEPORT listener and the connections it accepts.
+int net_run(const NetConfig *cfg, const NetProto *proto);
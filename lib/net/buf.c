@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+
+#include "buf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define BUF_MIN_CAP 4096 // one page: the mirror needs page-sized rings
+#define BUF_TIERS 11     // pooled ring sizes, BUF_MIN_CAP << 0 .. 10 (4 MiB)
+#define BUF_TIER_MAX ((size_t)BUF_MIN_CAP << (BUF_TIERS - 1))
+#define POOL_SLOTS 64          // idle rings kept per tier and thread...
+#define POOL_BYTES (32u << 20) // ...and at most this much in all tiers
+
+// Idle rings by size. Conns stay on one reactor thread, so a plain
+// per-thread stack needs no locking.
+typedef struct Tier {
+  uint8_t *rings[POOL_SLOTS];
+  int n;
+} Tier;
+
+static _Thread_local Tier pool[BUF_TIERS];
+static _Thread_local size_t pool_bytes;
+
+// Map cap bytes of a memfd twice, back to back.
+static uint8_t *mirror_map(size_t cap) {
+  int fd = memfd_create("buf", MFD_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  uint8_t *p = MAP_FAILED;
+  if (ftruncate(fd, (off_t)cap) < 0)
+    goto out;
+
+  // Reserve the whole window first so nothing else can land in the middle
+  p = mmap(NULL, 2 * cap, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    goto out;
+  if (mmap(p, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) ==
+          MAP_FAILED ||
+      mmap(p + cap, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+           0) == MAP_FAILED) {
+    munmap(p, 2 * cap);
+    p = MAP_FAILED;
+  }
+out:
+  close(fd); // the mappings keep the memory alive
+  return p == MAP_FAILED ? NULL : p;
+}
+
+// Pool index for a ring of cap bytes, -1 if that size is not pooled.
+static int tier_of(size_t cap) {
+  int t = 0;
+  for (size_t c = BUF_MIN_CAP; c < cap; c *= 2)
+    t++;
+  return ((size_t)BUF_MIN_CAP << t) == cap && t < BUF_TIERS ? t : -1;
+}
+
+static uint8_t *storage_get(size_t cap, int *mirror) {
+  int t = tier_of(cap);
+  *mirror = 1;
+  if (t >= 0 && pool[t].n > 0) {
+    pool_bytes -= cap;
+    return pool[t].rings[--pool[t].n];
+  }
+  uint8_t *p = mirror_map(cap);
+  if (p)
+    return p;
+  *mirror = 0;
+  return malloc(cap);
+}
+
+static void storage_put(uint8_t *base, size_t cap, int mirror) {
+  if (!base)
+    return;
+  if (!mirror) {
+    free(base);
+    return;
+  }
+  int t = tier_of(cap);
+  if (t >= 0 && pool[t].n < POOL_SLOTS && pool_bytes + cap <= POOL_BYTES) {
+    pool_bytes += cap;
+    pool[t].rings[pool[t].n++] = base;
+    return;
+  }
+  munmap(base, 2 * cap);
+}
+
+// Move the unread bytes into a fresh ring of ncap bytes.
+static int buf_move(Buf *b, size_t ncap) {
+  int mirror;
+  uint8_t *nb = storage_get(ncap, &mirror);
+  if (!nb)
+    return -1;
+  if (b->len)
+    memcpy(nb, b->data, b->len); // contiguous in either layout
+  storage_put(b->base, b->cap, b->mirror);
+  b->base = b->data = nb;
+  b->cap = ncap;
+  b->mirror = mirror;
+  return 0;
+}
+
+int buf_reserve(Buf *b, size_t need) {
+  if (b->cap - b->len >= need) {
+    if (b->mirror)
+      return 0;
+    // Heap layout: the free space must follow data. Compact only once the
+    // consumed prefix is at least as large as what has to move, so every
+    // byte is copied O(1) times on average.
+    size_t head = (size_t)(b->data - b->base);
+    if (b->cap - head - b->len >= need)
+      return 0;
+    if (head >= b->len) {
+      memmove(b->base, b->data, b->len);
+      b->data = b->base;
+      return 0;
+    }
+  }
+  size_t ncap = b->cap ? b->cap : BUF_MIN_CAP;
+  while (ncap - b->len < need)
+    ncap *= 2;
+  return buf_move(b, ncap);
+}
+
+int buf_append(Buf *b, const void *src, size_t n) {
+  if (buf_reserve(b, n) < 0)
+    return -1;
+  memcpy(b->data + b->len, src, n);
+  b->len += n;
+  return 0;
+}
+
+size_t buf_spare(const Buf *b) {
+  if (b->mirror) // the second mapping makes the whole free area contiguous
+    return b->cap - b->len;
+  return b->cap - (size_t)(b->data - b->base) - b->len;
+}
+
+void buf_commit(Buf *b, size_t n) { b->len += n; }
+
+void buf_consume(Buf *b, size_t n) {
+  if (n >= b->len) { // drained: an idle conn holds no buffer memory
+    buf_free(b);
+    return;
+  }
+  b->data += n;
+  b->len -= n;
+  if (b->mirror && b->data >= b->base + b->cap)
+    b->data -= b->cap; // same bytes, seen through the first mapping
+
+  // A burst left a ring bigger than any tier; once most of it has been
+  // read, copy the rest down so the big mapping can go.
+  if (b->cap > BUF_TIER_MAX && b->len <= b->cap / 8) {
+    size_t ncap = BUF_MIN_CAP;
+    while (ncap < 2 * b->len)
+      ncap *= 2;
+    buf_move(b, ncap); // on failure just keep the big one
+  }
+}
+
+void buf_free(Buf *b) {
+  storage_put(b->base, b->cap, b->mirror);
+  b->base = b->data = NULL;
+  b->len = b->cap = 0;
+  b->mirror = 0;
+}
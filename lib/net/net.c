@@ -0,0 +1,614 @@
+#define _GNU_SOURCE
+
+#include "net.h"
+#include "reactor.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define BACKLOG 128
+#define MAX_EVENTS 64
+#define MAX_THREADS 256
+#define READ_CHUNK (64 * 1024) // room reserved in c->in before each recv
+#define READ_MIN 4096          // spare below this triggers a reserve
+#define CONN_SLAB 64           // Conns carved out of one allocation
+#define LISTENER_EV UINT64_MAX // epoll data of the listening socket
+#define WAKE_EV (UINT64_MAX - 1) // and of the wake eventfd
+
+// Carve a fresh slab into free Conns. Slabs live as long as the reactor.
+static void conn_slab_grow(Reactor *r) {
+  if (r->conn_size == 0)
+    r->conn_size = (sizeof(Conn) + r->proto->user_size + 63) & ~(size_t)63;
+  uint8_t *slab = aligned_alloc(64, r->conn_size * CONN_SLAB);
+  if (!slab)
+    abort();
+  memset(slab, 0, r->conn_size * CONN_SLAB);
+  for (int i = CONN_SLAB - 1; i >= 0; i--) {
+    Conn *c = (Conn *)(slab + (size_t)i * r->conn_size);
+    c->next_dead = r->free_conns;
+    r->free_conns = c;
+  }
+}
+
+static void conn_table_put(Reactor *r, int fd, Conn *c) {
+  if ((size_t)fd >= r->conns_cap) {
+    size_t ncap = r->conns_cap ? r->conns_cap : 1024;
+    while (ncap <= (size_t)fd)
+      ncap *= 2;
+    Conn **nt = realloc(r->conns, ncap * sizeof *nt);
+    if (!nt)
+      abort();
+    memset(nt + r->conns_cap, 0, (ncap - r->conns_cap) * sizeof *nt);
+    r->conns = nt;
+    r->conns_cap = ncap;
+  }
+  r->conns[fd] = c;
+}
+
+Conn *reactor_conn_new(Reactor *r, int fd) {
+  if (!r->free_conns)
+    conn_slab_grow(r);
+  Conn *c = r->free_conns;
+  r->free_conns = c->next_dead;
+  memset(c, 0, r->conn_size);
+  // Per reactor, not per slot: a conn that took over a closed one's fd in
+  // the same tick comes from another slot, and must not match its events
+  c->gen = ++r->next_gen;
+  c->fd = fd;
+  c->r = r;
+  conn_table_put(r, fd, c);
+  STAT_ADD(r, nconn, 1);
+  STAT_ADD(r, accepted, 1);
+  return c;
+}
+
+Conn *reactor_conn_lookup(Reactor *r, int fd, uint32_t gen) {
+  if (fd < 0 || (size_t)fd >= r->conns_cap)
+    return NULL;
+  Conn *c = r->conns[fd];
+  return c && c->gen == gen ? c : NULL;
+}
+
+static uint64_t conn_ev_data(const Conn *c) {
+  return (uint64_t)c->gen << 32 | (uint32_t)c->fd;
+}
+
+static void conn_watch(Conn *c, int out) {
+  struct epoll_event ev = {0};
+  ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP | (out ? EPOLLOUT : 0);
+  ev.data.u64 = conn_ev_data(c);
+  STAT_SYSCALL(c->r);
+  if (epoll_ctl(c->r->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+    perror("epoll_ctl MOD");
+    conn_close(c);
+    return;
+  }
+  c->out_armed = out;
+}
+
+void reactor_conn_release_fd(Conn *c) {
+  // Close, retry on EINTR
+  for (;;) {
+    STAT_SYSCALL(c->r);
+    if (close(c->fd) == 0)
+      break;
+    if (errno == EINTR)
+      continue;
+    if (errno != EBADF)
+      perror("close");
+    break;
+  }
+  c->fd = -1;
+}
+
+void conn_close(Conn *c) {
+  if (!c || c->dead)
+    return;
+  c->dead = 1;
+
+  if (c->r->proto->on_close)
+    c->r->proto->on_close(c);
+  // The fd may be handed out again before this tick ends
+  if (c->fd >= 0 && c->r->conns[c->fd] == c)
+    c->r->conns[c->fd] = NULL;
+
+  if (c->r->ring) {
+    uring_conn_close(c);
+  } else {
+    // Best-effort remove from epoll
+    STAT_SYSCALL(c->r);
+    if (epoll_ctl(c->r->epfd, EPOLL_CTL_DEL, c->fd, NULL) < 0) {
+      if (errno != EBADF && errno != ENOENT)
+        perror("epoll_ctl DEL");
+    }
+    reactor_conn_release_fd(c);
+  }
+
+  // Other queues may still point at c until the end of this tick
+  c->next_dead = c->r->dead;
+  c->r->dead = c;
+}
+
+void reactor_reap(Reactor *r) {
+  Conn **pp = &r->dead;
+  while (*pp) {
+    Conn *c = *pp;
+    if (c->inflight) { // io_uring still owns it until its CQEs arrive
+      pp = &c->next_dead;
+      continue;
+    }
+    *pp = c->next_dead;
+    if (c->fd >= 0)
+      reactor_conn_release_fd(c);
+    buf_free(&c->in);
+    buf_free(&c->out);
+    buf_free(&c->sending);
+    c->next_dead = r->free_conns;
+    r->free_conns = c;
+    STAT_ADD(r, nconn, -1);
+  }
+}
+
+void reactor_mark_dirty(Conn *c) {
+  if (c->queued)
+    return;
+  c->queued = 1;
+  c->next_dirty = c->r->dirty;
+  c->r->dirty = c;
+}
+
+void conn_send(Conn *c, const void *src, size_t n) {
+  if (c->dead || n == 0)
+    return;
+  if (buf_append(&c->out, src, n) < 0) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  if (c->r->ring)
+    uring_conn_send(c);
+  else if (!c->out_armed) // EPOLLOUT will flush it otherwise
+    reactor_mark_dirty(c);
+}
+
+void conn_shutdown(Conn *c) { c->closing = 1; }
+
+void conn_want_write(Conn *c, int on) {
+  if (!c->dead && !c->r->ring && c->out_armed != on)
+    conn_watch(c, on);
+}
+
+void conn_hold(Conn *c, int on) {
+  if (c->dead || c->held == on)
+    return;
+  c->held = (uint8_t)on;
+  if (!on) // the end-of-tick pass closes it if it was only waiting on this
+    reactor_mark_dirty(c);
+}
+
+void net_wake(Reactor *r) {
+  uint64_t one = 1;
+  while (write(r->wakefd, &one, sizeof one) < 0 && errno == EINTR)
+    ;
+}
+
+void reactor_settle(Conn *c) {
+  if (!c->dead && !c->held && (c->peer_closed || c->closing) &&
+      c->out.len == 0 && c->sending.len == 0)
+    conn_close(c);
+}
+
+void reactor_deliver(Conn *c) {
+  if (!c->dead && c->in.len > 0 && c->r->proto->on_data)
+    c->r->proto->on_data(c);
+  reactor_settle(c);
+}
+
+static void on_read(Conn *c) {
+  for (;;) {
+    if (buf_spare(&c->in) < READ_MIN && buf_reserve(&c->in, READ_CHUNK) < 0) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    size_t room = buf_spare(&c->in);
+    if (room > READ_CHUNK)
+      room = READ_CHUNK;
+    STAT_SYSCALL(c->r);
+    ssize_t n = recv(c->fd, buf_tail(&c->in), room, 0);
+
+    if (n > 0) {
+      buf_commit(&c->in, (size_t)n);
+      continue; // keep reading in ET mode
+    }
+    if (n == 0) {         // peer sent FIN
+      c->peer_closed = 1; // half-closed; flush pending
+      break;
+    }
+
+    if (errno == EINTR) // retry
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) // drained
+      break;
+
+    if (errno != ECONNRESET)
+      perror("recv");
+    conn_close(c);
+    return;
+  }
+
+  reactor_deliver(c);
+}
+
+static void on_write(Conn *c) {
+  while (c->out.len) {
+    STAT_SYSCALL(c->r);
+    ssize_t n = send(c->fd, c->out.data, c->out.len, MSG_NOSIGNAL);
+    if (n > 0) {
+      buf_consume(&c->out, (size_t)n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (n < 0 && errno != EPIPE && errno != ECONNRESET)
+      perror("send");
+    conn_close(c);
+    return;
+  }
+
+  if (c->out.len == 0) {
+    reactor_settle(c);
+    if (!c->dead && c->out_armed) // stop EPOLLOUT
+      conn_watch(c, 0);
+  } else if (!c->out_armed) { // socket buffer full: wait for EPOLLOUT
+    conn_watch(c, 1);
+  }
+}
+
+// Write out everything queued this tick. Sending optimistically saves the
+// epoll_ctl and the extra wakeup per reply that arming EPOLLOUT up front
+// costs, and several conn_send calls to one conn collapse into one send.
+static void flush_dirty(Reactor *r) {
+  while (r->dirty) {
+    Conn *c = r->dirty;
+    r->dirty = c->next_dirty;
+    c->queued = 0;
+    if (!c->dead && !c->out_armed)
+      on_write(c);
+  }
+}
+
+void reactor_conn_event(Reactor *r, uint64_t data, uint32_t events) {
+  // Events for a closed (or since reused) fd are stale
+  Conn *c =
+      reactor_conn_lookup(r, (int)(uint32_t)data, (uint32_t)(data >> 32));
+  if (!c || c->dead)
+    return;
+  if (events & EPOLLERR) {
+    conn_close(c);
+    return;
+  }
+  const NetProto *p = r->proto;
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+    if (p->on_readable) {
+      p->on_readable(c);
+      reactor_settle(c);
+    } else {
+      on_read(c);
+    }
+  }
+  if (!c->dead && (events & EPOLLOUT)) {
+    if (p->on_writable) {
+      p->on_writable(c);
+      reactor_settle(c);
+    } else {
+      on_write(c);
+    }
+  }
+}
+
+static void on_accept(Reactor *r) {
+  for (;;) {
+    struct sockaddr_in cli;
+    socklen_t len = sizeof(cli);
+
+    STAT_SYSCALL(r);
+    int cfd = accept4(r->lfd, (struct sockaddr *)&cli, &len,
+                      SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) // drained
+        break;
+      if (errno == EINTR)
+        continue;
+      perror("accept");
+      break;
+    }
+
+    Conn *c = reactor_conn_new(r, cfd);
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+    ev.data.u64 = conn_ev_data(c);
+    STAT_SYSCALL(r);
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, cfd, &ev) == -1) {
+      perror("epoll_ctl: conn_sock");
+      exit(EXIT_FAILURE);
+    }
+    if (r->proto->on_open)
+      r->proto->on_open(c);
+    reactor_settle(c);
+  }
+}
+
+// Clear the wake eventfd and run on_wake. The fd blocks, which io_uring
+// needs to park its read on it; epoll only gets here once it is readable.
+static void on_wake(Reactor *r) {
+  uint64_t n;
+  STAT_SYSCALL(r);
+  if (read(r->wakefd, &n, sizeof n) < 0 && errno != EINTR) {
+    perror("read eventfd");
+    exit(EXIT_FAILURE);
+  }
+  r->proto->on_wake(r);
+}
+
+static int listener(uint16_t port, int reuseport) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("socket");
+    exit(EXIT_FAILURE);
+  }
+
+  int yes = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0) {
+    perror("setsockopt");
+    exit(EXIT_FAILURE);
+  }
+  // Every reactor binds its own socket; the kernel spreads connections
+  if (reuseport &&
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+    perror("setsockopt SO_REUSEPORT");
+    exit(EXIT_FAILURE);
+  }
+
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY); // 0.0.0.0
+  addr.sin_port = htons(port);
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    exit(EXIT_FAILURE);
+  }
+
+  if (listen(fd, BACKLOG) < 0) {
+    perror("listen");
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+int make_listener(uint16_t port) { return listener(port, 0); }
+
+int make_listener_reuseport(uint16_t port) { return listener(port, 1); }
+
+static void epoll_init(Reactor *r) {
+  r->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (r->epfd == -1) {
+    perror("epoll_create1");
+    exit(EXIT_FAILURE);
+  }
+
+  struct epoll_event ev = {0};
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.u64 = LISTENER_EV;
+  if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->lfd, &ev) == -1) {
+    perror("epoll_ctl: lfd");
+    exit(EXIT_FAILURE);
+  }
+  if (r->wakefd >= 0) {
+    ev.events = EPOLLIN; // level-triggered: on_wake drains it
+    ev.data.u64 = WAKE_EV;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakefd, &ev) == -1) {
+      perror("epoll_ctl: wakefd");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+static void epoll_loop(Reactor *r) {
+  struct epoll_event events[MAX_EVENTS];
+
+  for (;;) {
+    STAT_SYSCALL(r);
+    int nfds = epoll_wait(r->epfd, events, MAX_EVENTS, -1);
+    if (nfds == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      exit(EXIT_FAILURE);
+    }
+
+    for (int n = 0; n < nfds; ++n) {
+      uint64_t data = events[n].data.u64;
+      if (data == LISTENER_EV) {
+        if (events[n].events & (EPOLLERR | EPOLLHUP)) {
+          int err = 0;
+          socklen_t elen = sizeof(err);
+          getsockopt(r->lfd, SOL_SOCKET, SO_ERROR, &err, &elen);
+          fprintf(stderr, "listener error: %s\n", strerror(err));
+          exit(1);
+        }
+        on_accept(r);
+        continue;
+      }
+      if (data == WAKE_EV) {
+        on_wake(r);
+        continue;
+      }
+
+      reactor_conn_event(r, data, events[n].events);
+    }
+    flush_dirty(r);
+    reactor_reap(r);
+  }
+}
+
+static void *reactor_main(void *arg) {
+  Reactor *r = arg;
+  // Rings are created on the thread that submits to them
+  if (r->ring == NULL && r->epfd < 0 && uring_init(r) < 0) {
+    fprintf(stderr, "reactor %d: io_uring setup failed, using epoll\n", r->id);
+    epoll_init(r);
+  }
+  if (r->epfd >= 0)
+    epoll_loop(r);
+  else
+    uring_loop(r);
+  return NULL;
+}
+
+static void print_stats(Reactor *rs, int n) {
+  for (int i = 0; i < n; i++) {
+    fprintf(stderr, "reactor %d: conns=%zu accepted=%llu syscalls=%llu\n",
+            rs[i].id, atomic_load_explicit(&rs[i].nconn, memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&rs[i].accepted,
+                                                     memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&rs[i].syscalls,
+                                                     memory_order_relaxed));
+  }
+}
+
+int net_config_opt(NetConfig *cfg, int opt, const char *arg) {
+  if (!arg || *arg == '\0')
+    return -1;
+  if (opt == 'b') {
+    if (strcmp(arg, "epoll") == 0)
+      cfg->backend = NET_EPOLL;
+    else if (strcmp(arg, "uring") == 0)
+      cfg->backend = NET_URING;
+    else
+      return -1;
+    return 0;
+  }
+
+  char *end;
+  long v = strtol(arg, &end, 10);
+  if (*end != '\0' || v < 0)
+    return -1;
+
+  switch (opt) {
+  case 'p':
+    if (v == 0 || v > 65535)
+      return -1;
+    cfg->port = (uint16_t)v;
+    return 0;
+  case 't':
+    if (v == 0) // one per online core
+      v = sysconf(_SC_NPROCESSORS_ONLN);
+    if (v < 1 || v > MAX_THREADS)
+      return -1;
+    cfg->threads = (int)v;
+    return 0;
+  case 's':
+    cfg->stats_interval = (int)v;
+    return 0;
+  }
+  return -1;
+}
+
+void net_usage(const char *prog, const char *extra) {
+  fprintf(stderr,
+          "usage: %s [-p port] [-t threads, 0 = one per core] "
+          "[-s stats_secs] [-b epoll|uring]%s\n",
+          prog, extra ? extra : "");
+}
+
+void net_parse_args(NetConfig *cfg, int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, NET_OPTS)) != -1) {
+    if (net_config_opt(cfg, opt, optarg) < 0) {
+      net_usage(argv[0], NULL);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+int net_run(const NetConfig *cfg, const NetProto *proto) {
+  int n = cfg->threads > 0 ? cfg->threads : 1;
+  if (proto->max_threads > 0 && n > proto->max_threads) {
+    fprintf(stderr, "this server shares state across connections; using %d "
+                    "reactor thread(s)\n",
+            proto->max_threads);
+    n = proto->max_threads;
+  }
+
+  int use_uring = cfg->backend == NET_URING;
+  if (use_uring && !uring_supported()) {
+    fprintf(stderr, "io_uring not supported by this kernel, using epoll\n");
+    use_uring = 0;
+  }
+  if (use_uring && proto->on_readable) {
+    fprintf(stderr, "this server drives its sockets directly, using epoll\n");
+    use_uring = 0;
+  }
+
+  Reactor *rs = calloc((size_t)n, sizeof *rs);
+  if (!rs) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("Opening listener on port: %d \n", cfg->port);
+  for (int i = 0; i < n; i++) {
+    rs[i].id = i;
+    rs[i].proto = proto;
+    rs[i].epfd = -1;
+    rs[i].wakefd = -1;
+    if (proto->on_wake && (rs[i].wakefd = eventfd(0, EFD_CLOEXEC)) < 0) {
+      perror("eventfd");
+      exit(EXIT_FAILURE);
+    }
+    rs[i].lfd = n > 1 ? make_listener_reuseport(cfg->port)
+                      : make_listener(cfg->port);
+    if (!use_uring)
+      epoll_init(&rs[i]);
+  }
+  printf("Listening on port: %d with %d %s reactor thread(s)\n", cfg->port, n,
+         use_uring ? "io_uring" : "epoll");
+  fflush(stdout);
+
+  if (n == 1 && cfg->stats_interval == 0) {
+    reactor_main(&rs[0]);
+    return 0;
+  }
+
+  for (int i = 0; i < n; i++) {
+    int err = pthread_create(&rs[i].thread, NULL, reactor_main, &rs[i]);
+    if (err) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (cfg->stats_interval > 0) {
+    for (;;) {
+      sleep((unsigned)cfg->stats_interval);
+      print_stats(rs, n);
+      if (proto->on_stats)
+        proto->on_stats();
+    }
+  }
+  for (int i = 0; i < n; i++)
+    pthread_join(rs[i].thread, NULL);
+  return 0;
+}
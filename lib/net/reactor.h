@@ -0,0 +1,62 @@
+#pragma once
+// Reactor internals shared by the epoll (net.c) and io_uring (uring.c)
+// backends. Not part of the public net.h API.
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "net.h"
+
+typedef struct Uring Uring;
+
+struct Reactor {
+  int id;
+  int epfd; // epoll backend
+  int lfd;
+  int wakefd; // eventfd for net_wake, -1 without proto->on_wake
+  Uring *ring; // io_uring backend, NULL when running on epoll
+  const NetProto *proto;
+  Conn *dead;  // closed this tick, freed by reactor_reap()
+  Conn *dirty; // conns with work left for the end of the tick
+  Conn *free_conns; // recycled slab slots, linked through next_dead
+  size_t conn_size; // sizeof(Conn) + user_size, whole cache lines
+  Conn **conns;     // live conns indexed by fd
+  size_t conns_cap;
+  uint32_t next_gen; // last Conn.gen handed out
+  pthread_t thread;
+  // Written by the reactor thread only, read by the stats printer
+  _Atomic size_t nconn;
+  _Atomic uint64_t accepted;
+  _Atomic uint64_t syscalls;
+};
+
+// Single writer, so a plain load/store pair is enough (no lock prefix).
+#define STAT_ADD(r, field, n)                                                  \
+  atomic_store_explicit(                                                       \
+      &(r)->field,                                                             \
+      atomic_load_explicit(&(r)->field, memory_order_relaxed) + (n),           \
+      memory_order_relaxed)
+#define STAT_SYSCALL(r) STAT_ADD(r, syscalls, 1)
+
+Conn *reactor_conn_new(Reactor *r, int fd);
+// Live conn for fd if it is still generation gen, otherwise NULL.
+Conn *reactor_conn_lookup(Reactor *r, int fd, uint32_t gen);
+// Handle epoll events for the conn in data (gen << 32 | fd), dropping them
+// if that conn is gone.
+void reactor_conn_event(Reactor *r, uint64_t data, uint32_t events);
+// Close the fd the way the active backend needs it.
+void reactor_conn_release_fd(Conn *c);
+// Run on_data over c->in, then close if the connection is finished.
+void reactor_deliver(Conn *c);
+// Close if the peer or the protocol asked for it and nothing is left to send.
+void reactor_settle(Conn *c);
+// Queue c for the end-of-tick pass; a no-op if it is already queued.
+void reactor_mark_dirty(Conn *c);
+void reactor_reap(Reactor *r);
+
+// io_uring backend (uring.c)
+int uring_supported(void);
+int uring_init(Reactor *r);
+void uring_loop(Reactor *r);
+void uring_conn_close(Conn *c);
+void uring_conn_send(Conn *c);
@@ -0,0 +1,451 @@
+#define _GNU_SOURCE
+
+#include "reactor.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define RING_ENTRIES 1024
+#define BR_GROUP 0
+#define BR_COUNT 256 // provided recv buffers per reactor, power of two
+#define BR_SIZE (16 * 1024)
+
+// user_data = Conn pointer | op; Conn is at least 16-byte aligned
+enum {
+  OP_ACCEPT = 0,
+  OP_RECV = 1,
+  OP_SEND = 2,
+  OP_SHUTDOWN = 3,
+  OP_WAKE = 4,
+  OP_MASK = 7
+};
+
+struct Uring {
+  int fd;
+  unsigned sq_entries, sq_mask, sq_tail;
+  unsigned *sq_khead, *sq_ktail, *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned cq_mask;
+  unsigned *cq_khead, *cq_ktail;
+  struct io_uring_cqe *cqes;
+  unsigned pending; // SQEs not yet handed to the kernel
+
+  struct io_uring_buf_ring *br;
+  uint8_t *bufs;
+  uint16_t br_tail;
+
+  uint64_t wake_count; // read target for the wake eventfd
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned op, void *arg, unsigned n) {
+  return (int)syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+int uring_supported(void) {
+  struct io_uring_params p = {0};
+  int fd = sys_setup(4, &p);
+  if (fd < 0)
+    return 0;
+
+  size_t sz = sizeof(struct io_uring_probe) +
+              256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, sz);
+  int ok = probe && sys_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+  // SEND_ZC landed in 6.0 together with multishot recv, which has no probe
+  static const int need[] = {IORING_OP_ACCEPT,   IORING_OP_RECV,
+                             IORING_OP_SEND,     IORING_OP_SHUTDOWN,
+                             IORING_OP_SEND_ZC, IORING_OP_READ};
+  for (size_t i = 0; ok && i < sizeof need / sizeof need[0]; i++) {
+    if (need[i] > probe->last_op ||
+        !(probe->ops[need[i]].flags & IO_URING_OP_SUPPORTED))
+      ok = 0;
+  }
+  free(probe);
+  close(fd);
+  return ok;
+}
+
+static void br_recycle(Uring *u, uint16_t bid) {
+  struct io_uring_buf *b = &u->br->bufs[u->br_tail & (BR_COUNT - 1)];
+  b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * BR_SIZE);
+  b->len = BR_SIZE;
+  b->bid = bid;
+  u->br_tail++;
+  __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+static int br_setup(Uring *u) {
+  size_t ring_sz = BR_COUNT * sizeof(struct io_uring_buf);
+  u->br = mmap(NULL, ring_sz, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (u->br == MAP_FAILED)
+    return -1;
+  u->bufs = malloc((size_t)BR_COUNT * BR_SIZE);
+  if (!u->bufs)
+    return -1;
+
+  struct io_uring_buf_reg reg = {0};
+  reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+  reg.ring_entries = BR_COUNT;
+  reg.bgid = BR_GROUP;
+  if (sys_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    return -1;
+
+  for (uint16_t i = 0; i < BR_COUNT; i++)
+    br_recycle(u, i);
+  return 0;
+}
+
+static int ring_map(Uring *u, struct io_uring_params *p) {
+  size_t sq_sz = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+  size_t cq_sz = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+  int single = p->features & IORING_FEAT_SINGLE_MMAP;
+  if (single && cq_sz > sq_sz)
+    sq_sz = cq_sz;
+
+  uint8_t *sq = mmap(NULL, sq_sz, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED)
+    return -1;
+  uint8_t *cq = sq;
+  if (!single) {
+    cq = mmap(NULL, cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              u->fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED)
+      return -1;
+  }
+  u->sqes = mmap(NULL, p->sq_entries * sizeof(struct io_uring_sqe),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                 IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED)
+    return -1;
+
+  u->sq_entries = p->sq_entries;
+  u->sq_mask = *(unsigned *)(sq + p->sq_off.ring_mask);
+  u->sq_khead = (unsigned *)(sq + p->sq_off.head);
+  u->sq_ktail = (unsigned *)(sq + p->sq_off.tail);
+  u->sq_array = (unsigned *)(sq + p->sq_off.array);
+  u->sq_tail = *u->sq_ktail;
+  u->cq_mask = *(unsigned *)(cq + p->cq_off.ring_mask);
+  u->cq_khead = (unsigned *)(cq + p->cq_off.head);
+  u->cq_ktail = (unsigned *)(cq + p->cq_off.tail);
+  u->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+  return 0;
+}
+
+static void ring_submit(Reactor *r) {
+  Uring *u = r->ring;
+  while (u->pending) {
+    STAT_SYSCALL(r);
+    int n = sys_enter(u->fd, u->pending, 0, 0);
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+        continue;
+      perror("io_uring_enter");
+      exit(EXIT_FAILURE);
+    }
+    u->pending -= (unsigned)n;
+  }
+}
+
+static void sqe_commit(Uring *u) {
+  __atomic_store_n(u->sq_ktail, u->sq_tail, __ATOMIC_RELEASE);
+}
+
+// Make room for n SQEs so a linked chain is never split across submits.
+static void sq_reserve(Reactor *r, unsigned n) {
+  Uring *u = r->ring;
+  unsigned head = __atomic_load_n(u->sq_khead, __ATOMIC_ACQUIRE);
+  if (u->sq_tail - head + n > u->sq_entries) {
+    sqe_commit(u);
+    ring_submit(r); // SQ full: hand over what we have
+  }
+}
+
+static struct io_uring_sqe *get_sqe(Reactor *r) {
+  Uring *u = r->ring;
+  sq_reserve(r, 1);
+  unsigned idx = u->sq_tail & u->sq_mask;
+  struct io_uring_sqe *sqe = &u->sqes[idx];
+  memset(sqe, 0, sizeof *sqe);
+  u->sq_array[idx] = idx;
+  u->sq_tail++;
+  u->pending++;
+  return sqe;
+}
+
+static void arm_accept(Reactor *r) {
+  struct io_uring_sqe *sqe = get_sqe(r);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = r->lfd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = OP_ACCEPT;
+  sqe_commit(r->ring);
+}
+
+// One read of the wake eventfd at a time; its completion runs on_wake.
+static void arm_wake(Reactor *r) {
+  struct io_uring_sqe *sqe = get_sqe(r);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = r->wakefd;
+  sqe->addr = (uint64_t)(uintptr_t)&r->ring->wake_count;
+  sqe->len = sizeof r->ring->wake_count;
+  sqe->user_data = OP_WAKE;
+  sqe_commit(r->ring);
+}
+
+static void arm_recv(Conn *c) {
+  struct io_uring_sqe *sqe = get_sqe(c->r);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = c->fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BR_GROUP;
+  sqe->user_data = (uint64_t)(uintptr_t)c | OP_RECV;
+  sqe_commit(c->r->ring);
+  c->recv_armed = 1;
+  c->inflight++;
+}
+
+// Send c->sending. When this is the last thing the connection will ever
+// send, link a shutdown behind it so flush + FIN cost one submission.
+static void submit_send(Conn *c) {
+  int last = (c->closing || c->peer_closed) && !c->held && c->out.len == 0;
+  sq_reserve(c->r, 2);
+  struct io_uring_sqe *sqe = get_sqe(c->r);
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = c->fd;
+  sqe->addr = (uint64_t)(uintptr_t)c->sending.data;
+  sqe->len = (uint32_t)c->sending.len;
+  sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL; // kernel retries short sends
+  sqe->flags = last ? IOSQE_IO_LINK : 0;
+  sqe->user_data = (uint64_t)(uintptr_t)c | OP_SEND;
+  c->inflight++;
+
+  if (last) {
+    sqe = get_sqe(c->r);
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = c->fd;
+    sqe->len = SHUT_RDWR;
+    sqe->user_data = (uint64_t)(uintptr_t)c | OP_SHUTDOWN;
+    c->inflight++;
+    c->shut_linked = 1;
+  }
+  sqe_commit(c->r->ring);
+}
+
+// c->out becomes the in-flight buffer; conn_send() keeps appending to a
+// fresh one, so a realloc can never move bytes the kernel is reading.
+static void start_send(Conn *c) {
+  Buf tmp = c->sending;
+  c->sending = c->out;
+  c->out = tmp;
+  submit_send(c);
+}
+
+void uring_conn_send(Conn *c) { reactor_mark_dirty(c); }
+
+void uring_conn_close(Conn *c) {
+  if (c->inflight == 0) {
+    reactor_conn_release_fd(c);
+    return;
+  }
+  // Terminates the multishot recv and fails pending sends; the fd itself is
+  // closed by reactor_reap() once no submitted operation can still use it.
+  STAT_SYSCALL(c->r);
+  shutdown(c->fd, SHUT_RDWR);
+}
+
+static void on_accept(Reactor *r, struct io_uring_cqe *cqe) {
+  if (!(cqe->flags & IORING_CQE_F_MORE))
+    arm_accept(r);
+  if (cqe->res < 0) {
+    if (cqe->res != -EINTR && cqe->res != -ECONNABORTED)
+      fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+    return;
+  }
+
+  Conn *c = reactor_conn_new(r, cqe->res);
+  arm_recv(c);
+  if (r->proto->on_open)
+    r->proto->on_open(c);
+  reactor_mark_dirty(c);
+}
+
+static void on_recv(Reactor *r, struct io_uring_cqe *cqe) {
+  Conn *c = (Conn *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+  int more = cqe->flags & IORING_CQE_F_MORE;
+  if (!more) {
+    c->inflight--;
+    c->recv_armed = 0;
+  }
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    if (cqe->res > 0 && !c->dead) {
+      if (buf_append(&c->in, r->ring->bufs + (size_t)bid * BR_SIZE,
+                     (size_t)cqe->res) < 0) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+      c->rx = 1;
+      reactor_mark_dirty(c);
+    }
+    br_recycle(r->ring, bid);
+  }
+
+  if (c->dead)
+    return;
+  if (cqe->res == 0) { // peer sent FIN
+    c->peer_closed = 1;
+    reactor_mark_dirty(c);
+    return;
+  }
+  if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+    if (cqe->res != -ECONNRESET)
+      fprintf(stderr, "recv: %s\n", strerror(-cqe->res));
+    conn_close(c);
+    return;
+  }
+  // Out of provided buffers or the kernel ended the multishot: re-arm
+  if (!c->recv_armed)
+    arm_recv(c);
+}
+
+static void on_send(Conn *c, struct io_uring_cqe *cqe) {
+  c->inflight--;
+  if (c->dead)
+    return;
+  if (cqe->res < 0) {
+    if (cqe->res != -EPIPE && cqe->res != -ECONNRESET)
+      fprintf(stderr, "send: %s\n", strerror(-cqe->res));
+    conn_close(c);
+    return;
+  }
+  buf_consume(&c->sending, (size_t)cqe->res);
+  if (c->sending.len) // short send despite MSG_WAITALL: retry the rest
+    submit_send(c);
+  else
+    reactor_mark_dirty(c);
+}
+
+static void drain_cq(Reactor *r) {
+  Uring *u = r->ring;
+  unsigned head = *u->cq_khead;
+  unsigned tail = __atomic_load_n(u->cq_ktail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; head++) {
+    struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+    Conn *c = (Conn *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+
+    switch (cqe->user_data & OP_MASK) {
+    case OP_ACCEPT:
+      on_accept(r, cqe);
+      break;
+    case OP_RECV:
+      on_recv(r, cqe);
+      break;
+    case OP_SEND:
+      on_send(c, cqe);
+      break;
+    case OP_SHUTDOWN: // the recv completion that follows closes the conn
+      c->inflight--;
+      break;
+    case OP_WAKE:
+      arm_wake(r);
+      r->proto->on_wake(r);
+      break;
+    }
+  }
+  __atomic_store_n(u->cq_khead, head, __ATOMIC_RELEASE);
+}
+
+// Deliver input and flush output for everything touched this tick.
+static void run_dirty(Reactor *r) {
+  while (r->dirty) {
+    Conn *c = r->dirty;
+    r->dirty = c->next_dirty;
+    c->queued = 0;
+    if (c->dead)
+      continue;
+
+    if (c->rx) {
+      c->rx = 0;
+      if (r->proto->on_data && c->in.len > 0)
+        r->proto->on_data(c);
+      if (c->dead)
+        continue;
+    }
+    if (c->sending.len == 0 && c->out.len > 0)
+      start_send(c);
+    // A linked shutdown ends the recv, whose completion closes the conn
+    if (!(c->shut_linked && c->recv_armed))
+      reactor_settle(c);
+  }
+}
+
+int uring_init(Reactor *r) {
+  Uring *u = calloc(1, sizeof *u);
+  if (!u)
+    return -1;
+
+  struct io_uring_params p = {0};
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER |
+            IORING_SETUP_DEFER_TASKRUN;
+  p.cq_entries = RING_ENTRIES * 4; // multishot ops produce many CQEs
+  u->fd = sys_setup(RING_ENTRIES, &p);
+  if (u->fd < 0 && errno == EINVAL) { // pre-6.1 kernel: no DEFER_TASKRUN
+    memset(&p, 0, sizeof p);
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = RING_ENTRIES * 4;
+    u->fd = sys_setup(RING_ENTRIES, &p);
+  }
+  if (u->fd < 0 || ring_map(u, &p) < 0 || br_setup(u) < 0) {
+    if (u->fd >= 0)
+      close(u->fd);
+    free(u->bufs);
+    free(u);
+    return -1;
+  }
+
+  r->ring = u;
+  arm_accept(r);
+  if (r->wakefd >= 0)
+    arm_wake(r);
+  return 0;
+}
+
+void uring_loop(Reactor *r) {
+  Uring *u = r->ring;
+  for (;;) {
+    STAT_SYSCALL(r);
+    int n = sys_enter(u->fd, u->pending, 1, IORING_ENTER_GETEVENTS);
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+        continue;
+      perror("io_uring_enter");
+      exit(EXIT_FAILURE);
+    }
+    u->pending -= (unsigned)n;
+
+    drain_cq(r);
+    run_dirty(r);
+    reactor_reap(r);
+  }
+}
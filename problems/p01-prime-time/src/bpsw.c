@@ -0,0 +1,580 @@
+// Baillie-PSW for numbers past 2^64: a strong base-2 Miller-Rabin round and
+// a strong Lucas test with Selfridge's parameters. No composite is known to
+// pass both; below 2^64 prime_u64 answers exactly instead.
+#include "prime.h"
+#include "cache.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef unsigned __int128 u128;
+
+// Products of the odd primes below 1000, grouped to fit 64 bits. n has a
+// factor in a group exactly when gcd(n mod product, product) > 1.
+static const uint64_t small_prods[] = {
+    0xe221f97c30e94e1du, 0x6329899ea9f2714bu, 0x58edcb4c9ed39c8bu,
+    0x09966ff94fd516fbu, 0x3bd7632c1f36eb51u, 0x00fd14b3c90d88a9u,
+    0x02ad3dbe0cca85ffu, 0x0787f9a02c3388a7u, 0x1113c5cc6d101657u,
+    0x2456c94f936bdb15u, 0x4236a30b85ffe139u, 0x805437b38eada69du,
+    0x00723e97bddcd2afu, 0x00a5a792ee239667u, 0x00e451352ebca269u,
+    0x013a7955f14b7805u, 0x01d37cbd653b06ffu, 0x0288fe4eca4d7cdfu,
+    0x039fddb60d3af63du, 0x04cd73f19080fb03u, 0x0639c390b9313f05u,
+    0x08a1c420d25d388fu, 0x0b4b5322977db499u, 0x00000000000f137bu,
+};
+#define NPRODS (sizeof small_prods / sizeof small_prods[0])
+// Past 128 bits a failed Miller-Rabin round costs far more than the whole
+// table; at 128 bits the first few groups catch most of what it would.
+#define NPRODS128 4
+
+static uint64_t gcd64(uint64_t a, uint64_t b) {
+  if (!a || !b)
+    return a | b;
+  int shift = __builtin_ctzll(a | b);
+  a >>= __builtin_ctzll(a);
+  do {
+    b >>= __builtin_ctzll(b);
+    if (a > b) {
+      uint64_t t = a;
+      a = b;
+      b = t;
+    }
+    b -= a;
+  } while (b);
+  return a << shift;
+}
+
+// Jacobi symbol (a/m) for odd m.
+static int jacobi(uint64_t a, uint64_t m) {
+  int j = 1;
+  a %= m;
+  while (a) {
+    int tz = __builtin_ctzll(a);
+    a >>= tz;
+    if ((tz & 1) && (m % 8 == 3 || m % 8 == 5))
+      j = -j;
+    if (a % 4 == 3 && m % 4 == 3)
+      j = -j;
+    uint64_t t = a;
+    a = m % t;
+    m = t;
+  }
+  return m == 1 ? j : 0;
+}
+
+// Selfridge's method A: the first D in 5, -7, 9, -11, ... with (D/n) = -1,
+// or 0 once n is known to be composite. (D/n) comes from (n/|D|) by
+// reciprocity, so rem(n, m) = n mod m is all that is needed of n. No such D
+// exists for a square, so after a few misses square(n) rules that out.
+static int64_t selfridge(const void *n, uint64_t (*rem)(const void *, uint64_t),
+                         int (*square)(const void *)) {
+  int n3 = rem(n, 4) == 3;
+  for (int64_t i = 0, d = 5;; i++, d = d > 0 ? -d - 2 : -d + 2) {
+    uint64_t a = (uint64_t)(d > 0 ? d : -d);
+    int j = jacobi(rem(n, a), a);
+    if (n3 && (a % 4 == 3) != (d < 0)) // reciprocity, and (-1/n) for d < 0
+      j = -j;
+    if (j == 0)
+      return 0; // n is far larger than |D|, so they share a proper factor
+    if (j < 0)
+      return d;
+    if (i == 8 && square(n))
+      return 0;
+  }
+}
+
+// --- up to 128 bits ---
+
+// Montgomery arithmetic mod odd n with R = 2^128, as in prime.c one size up.
+typedef struct mont128 {
+  u128 n;
+  u128 ninv; // n^-1 mod 2^128
+  u128 one;  // R mod n
+} mont128;
+
+// Full 256-bit product, from four 64x64 multiplies.
+static inline u128 mul256(u128 a, u128 b, u128 *lo) {
+  uint64_t a0 = (uint64_t)a, a1 = (uint64_t)(a >> 64);
+  uint64_t b0 = (uint64_t)b, b1 = (uint64_t)(b >> 64);
+  u128 p00 = (u128)a0 * b0, p01 = (u128)a0 * b1;
+  u128 p10 = (u128)a1 * b0, p11 = (u128)a1 * b1;
+  u128 mid = (p00 >> 64) + (uint64_t)p01 + (uint64_t)p10;
+  *lo = mid << 64 | (uint64_t)p00;
+  return p11 + (p01 >> 64) + (p10 >> 64) + (mid >> 64);
+}
+
+// Branch-free: the operands are as good as random, so a branch on the
+// borrow would mispredict half the time. gcc turns a u128 mask back into a
+// branch, hence the two halves.
+static inline u128 sub128(const mont128 *m, u128 a, u128 b) {
+  uint64_t mask = 0 - (uint64_t)(a < b);
+  u128 fix = (u128)((uint64_t)(m->n >> 64) & mask) << 64 |
+             ((uint64_t)m->n & mask);
+  return a - b + fix;
+}
+
+static inline u128 add128(const mont128 *m, u128 a, u128 b) {
+  return sub128(m, a, m->n - b);
+}
+
+static inline u128 mul128(const mont128 *m, u128 a, u128 b) {
+  u128 lo, qn_lo; // the low halves of a*b and q*n cancel exactly
+  u128 hi = mul256(a, b, &lo), qn = mul256(lo * m->ninv, m->n, &qn_lo);
+  return sub128(m, hi, qn);
+}
+
+// x * c for tiny c, by doubling and adding.
+static u128 times128(const mont128 *m, u128 x, int64_t c) {
+  uint64_t a = (uint64_t)(c < 0 ? -c : c);
+  u128 r = 0;
+  for (int i = 63 - __builtin_clzll(a | 1); i >= 0; i--) {
+    r = add128(m, r, r);
+    if (a >> i & 1)
+      r = add128(m, r, x);
+  }
+  return c < 0 ? sub128(m, 0, r) : r;
+}
+
+static int ctz128(u128 x) {
+  return (uint64_t)x ? __builtin_ctzll((uint64_t)x)
+                     : 64 + __builtin_ctzll((uint64_t)(x >> 64));
+}
+
+static int bitlen128(u128 x) {
+  return x >> 64 ? 128 - __builtin_clzll((uint64_t)(x >> 64))
+                 : 64 - __builtin_clzll((uint64_t)x | 1);
+}
+
+// Strong probable prime to base 2. Multiplying by the base is a doubling.
+static int sprp2_128(const mont128 *m) {
+  u128 d = m->n - 1, minus_one = m->n - m->one, x = m->one;
+  int s = ctz128(d);
+  d >>= s;
+  for (int i = bitlen128(d) - 1; i >= 0; i--) {
+    x = mul128(m, x, x);
+    if (d >> i & 1)
+      x = add128(m, x, x);
+  }
+  if (x == m->one || x == minus_one)
+    return 1;
+  while (--s > 0) {
+    x = mul128(m, x, x);
+    if (x == minus_one)
+      return 1;
+    if (x == m->one)
+      return 0;
+  }
+  return 0;
+}
+
+// Strong Lucas probable prime with P = 1, Q = (1 - D) / 4: with
+// n + 1 = d * 2^s, U_d = 0 or V_(d*2^r) = 0 for some r < s. A ladder over
+// the bits of d keeps V_k, V_(k+1) and Q^k:
+//   V_2k = V_k^2 - 2Q^k,  V_(2k+1) = V_k V_(k+1) - Q^k,
+// three multiplies per bit, as Q is tiny. U_d is never formed: it is
+// (2V_(d+1) - V_d) / D, and D is prime to n.
+static int lucas128(const mont128 *m, int64_t D) {
+  int64_t q = (1 - D) / 4;
+  u128 d = m->n + 1; // cannot wrap: 2^128 - 1 is a multiple of 3
+  int s = ctz128(d);
+  d >>= s;
+  u128 v = add128(m, m->one, m->one), v1 = m->one, qk = m->one; // k = 0
+  for (int i = bitlen128(d) - 1; i >= 0; i--) {
+    u128 mid = sub128(m, mul128(m, v, v1), qk);
+    if (d >> i & 1) { // k -> 2k + 1
+      u128 qk1 = times128(m, qk, q);
+      v1 = sub128(m, mul128(m, v1, v1), add128(m, qk1, qk1));
+      v = mid;
+      qk = mul128(m, qk, qk1);
+    } else { // k -> 2k
+      v = sub128(m, mul128(m, v, v), add128(m, qk, qk));
+      v1 = mid;
+      qk = mul128(m, qk, qk);
+    }
+  }
+  if (v == 0 || add128(m, v1, v1) == v)
+    return 1;
+  while (--s > 0) {
+    v = sub128(m, mul128(m, v, v), add128(m, qk, qk));
+    if (v == 0)
+      return 1;
+    qk = mul128(m, qk, qk);
+  }
+  return 0;
+}
+
+static uint64_t rem128(const void *n, uint64_t m) {
+  return (uint64_t)(*(const u128 *)n % m);
+}
+
+// Bit-by-bit integer square root.
+static int square128(const void *p) {
+  u128 n = *(const u128 *)p, r = 0;
+  for (u128 b = (u128)1 << ((bitlen128(n) - 1) & ~1); b; b >>= 2) {
+    if (n >= r + b) {
+      n -= r + b;
+      r = (r >> 1) + b;
+    } else {
+      r >>= 1;
+    }
+  }
+  return n == 0;
+}
+
+static int bpsw128(u128 n) {
+  mont128 m = {.n = n, .ninv = n, .one = (0 - n) % n};
+  for (int i = 0; i < 6; i++) // 3 correct bits, doubled six times
+    m.ninv *= 2 - n * m.ninv;
+  if (!sprp2_128(&m))
+    return 0;
+  int64_t D = selfridge(&n, rem128, square128);
+  return D && lucas128(&m, D);
+}
+
+int prime_u128(u128 n) {
+  if (!(n >> 64))
+    return prime_u64((uint64_t)n);
+  if (!(n & 1))
+    return 0;
+  for (size_t i = 0; i < NPRODS128; i++)
+    if (gcd64((uint64_t)(n % small_prods[i]), small_prods[i]) != 1)
+      return 0;
+
+  uint64_t key[2] = {(uint64_t)n, (uint64_t)(n >> 64)};
+  int r = cache_get(key, 2);
+  if (r < 0) {
+    r = bpsw128(n);
+    cache_put(key, 2, r);
+  }
+  return r;
+}
+
+// --- past 128 bits ---
+
+#define BN_LIMBS (PRIME_MAX_BITS / 64)
+
+// The same with R = 2^(64k), multiplying by CIOS (interleaved
+// multiply-and-reduce, one limb of b at a time).
+typedef struct mont_bn {
+  size_t k;
+  uint64_t ninv; // -n^-1 mod 2^64
+  uint64_t n[BN_LIMBS], one[BN_LIMBS];
+} mont_bn;
+
+static int bit(const uint64_t *x, size_t i) { return x[i / 64] >> i % 64 & 1; }
+
+static size_t bitlen(const uint64_t *x, size_t k) {
+  return 64 * k - (size_t)__builtin_clzll(x[k - 1]);
+}
+
+static int bn_zero(const uint64_t *x, size_t k) {
+  for (size_t i = 0; i < k; i++)
+    if (x[i])
+      return 0;
+  return 1;
+}
+
+// r = (c:r) - n if that is not negative; (c:r) < 2n.
+static void bn_reduce(const mont_bn *m, uint64_t *r, uint64_t c) {
+  uint64_t t[BN_LIMBS], borrow = 0;
+  for (size_t i = 0; i < m->k; i++) {
+    u128 d = (u128)r[i] - m->n[i] - borrow;
+    t[i] = (uint64_t)d;
+    borrow = (uint64_t)(d >> 64) & 1;
+  }
+  if (c || !borrow)
+    memcpy(r, t, m->k * sizeof *r);
+}
+
+static void bn_add(const mont_bn *m, uint64_t *r, const uint64_t *a,
+                   const uint64_t *b) {
+  uint64_t c = 0;
+  for (size_t i = 0; i < m->k; i++) {
+    u128 s = (u128)a[i] + b[i] + c;
+    r[i] = (uint64_t)s;
+    c = (uint64_t)(s >> 64);
+  }
+  bn_reduce(m, r, c);
+}
+
+static void bn_sub(const mont_bn *m, uint64_t *r, const uint64_t *a,
+                   const uint64_t *b) {
+  uint64_t borrow = 0;
+  for (size_t i = 0; i < m->k; i++) {
+    u128 d = (u128)a[i] - b[i] - borrow;
+    r[i] = (uint64_t)d;
+    borrow = (uint64_t)(d >> 64) & 1;
+  }
+  if (borrow) {
+    uint64_t c = 0;
+    for (size_t i = 0; i < m->k; i++) {
+      u128 s = (u128)r[i] + m->n[i] + c;
+      r[i] = (uint64_t)s;
+      c = (uint64_t)(s >> 64);
+    }
+  }
+}
+
+static void bn_mul(const mont_bn *m, uint64_t *r, const uint64_t *a,
+                   const uint64_t *b) {
+  size_t k = m->k;
+  uint64_t t[BN_LIMBS + 2];
+  memset(t, 0, (k + 2) * sizeof *t);
+  for (size_t i = 0; i < k; i++) {
+    uint64_t c = 0;
+    for (size_t j = 0; j < k; j++) {
+      u128 s = (u128)a[j] * b[i] + t[j] + c;
+      t[j] = (uint64_t)s;
+      c = (uint64_t)(s >> 64);
+    }
+    u128 s = (u128)t[k] + c;
+    t[k] = (uint64_t)s;
+    t[k + 1] = (uint64_t)(s >> 64);
+
+    uint64_t q = t[0] * m->ninv; // makes t + q*n a multiple of 2^64
+    s = (u128)q * m->n[0] + t[0];
+    c = (uint64_t)(s >> 64);
+    for (size_t j = 1; j < k; j++) {
+      s = (u128)q * m->n[j] + t[j] + c;
+      t[j - 1] = (uint64_t)s;
+      c = (uint64_t)(s >> 64);
+    }
+    s = (u128)t[k] + c;
+    t[k - 1] = (uint64_t)s;
+    t[k] = t[k + 1] + (uint64_t)(s >> 64);
+  }
+  memcpy(r, t, k * sizeof *r);
+  bn_reduce(m, r, t[k]);
+}
+
+// t[0..2k] / R mod n, one limb at a time; t[2k] is 0 and t is clobbered.
+static void bn_redc(const mont_bn *m, uint64_t *r, uint64_t *t) {
+  size_t k = m->k;
+  for (size_t i = 0; i < k; i++) {
+    uint64_t q = t[i] * m->ninv, c = 0;
+    for (size_t j = 0; j < k; j++) {
+      u128 s = (u128)q * m->n[j] + t[i + j] + c;
+      t[i + j] = (uint64_t)s;
+      c = (uint64_t)(s >> 64);
+    }
+    for (size_t j = i + k; c; j++) {
+      u128 s = (u128)t[j] + c;
+      t[j] = (uint64_t)s;
+      c = (uint64_t)(s >> 64);
+    }
+  }
+  memcpy(r, t + k, k * sizeof *r);
+  bn_reduce(m, r, t[2 * k]);
+}
+
+// Squaring needs each cross product once, doubled: about half the
+// multiplies of bn_mul before the reduction.
+static void bn_sqr(const mont_bn *m, uint64_t *r, const uint64_t *a) {
+  size_t k = m->k;
+  uint64_t t[2 * BN_LIMBS + 1];
+  memset(t, 0, (2 * k + 1) * sizeof *t);
+  for (size_t i = 0; i < k; i++) {
+    uint64_t c = 0;
+    for (size_t j = i + 1; j < k; j++) {
+      u128 s = (u128)a[i] * a[j] + t[i + j] + c;
+      t[i + j] = (uint64_t)s;
+      c = (uint64_t)(s >> 64);
+    }
+    t[i + k] = c;
+  }
+  uint64_t c = 0;
+  for (size_t i = 0; i < 2 * k; i++) {
+    uint64_t x = t[i];
+    t[i] = x << 1 | c;
+    c = x >> 63;
+  }
+  for (size_t i = 0; i < k; i++) {
+    u128 s = (u128)a[i] * a[i] + t[2 * i] + c;
+    t[2 * i] = (uint64_t)s;
+    s = (u128)t[2 * i + 1] + (uint64_t)(s >> 64);
+    t[2 * i + 1] = (uint64_t)s;
+    c = (uint64_t)(s >> 64);
+  }
+  bn_redc(m, r, t);
+}
+
+// As times128.
+static void bn_times(const mont_bn *m, uint64_t *r, const uint64_t *x,
+                     int64_t c) {
+  uint64_t a = (uint64_t)(c < 0 ? -c : c), t[BN_LIMBS] = {0};
+  for (int i = 63 - __builtin_clzll(a | 1); i >= 0; i--) {
+    bn_add(m, t, t, t);
+    if (a >> i & 1)
+      bn_add(m, t, t, x);
+  }
+  if (c < 0) {
+    uint64_t zero[BN_LIMBS] = {0};
+    bn_sub(m, t, zero, t);
+  }
+  memcpy(r, t, m->k * sizeof *r);
+}
+
+static void mont_bn_init(mont_bn *m, const uint64_t *n, size_t k) {
+  m->k = k;
+  memcpy(m->n, n, k * sizeof *n);
+  uint64_t x = n[0];
+  for (int i = 0; i < 5; i++)
+    x *= 2 - n[0] * x;
+  m->ninv = 0 - x;
+  // R mod n: start from the top bit of n, which is below n, and double.
+  size_t top = bitlen(n, k) - 1;
+  memset(m->one, 0, k * sizeof *n);
+  m->one[top / 64] = (uint64_t)1 << top % 64;
+  for (size_t i = top; i < 64 * k; i++)
+    bn_add(m, m->one, m->one, m->one);
+}
+
+// As sprp2_128. n - 1 has the bits of n above bit 0, so d is read off n.
+static int sprp2_bn(const mont_bn *m) {
+  size_t k = m->k, s = 1;
+  while (!bit(m->n, s))
+    s++;
+  uint64_t x[BN_LIMBS], minus_one[BN_LIMBS];
+  memcpy(x, m->one, k * sizeof *x);
+  for (size_t i = bitlen(m->n, k); i-- > s;) {
+    bn_sqr(m, x, x);
+    if (bit(m->n, i))
+      bn_add(m, x, x, x);
+  }
+  memcpy(minus_one, m->n, k * sizeof *x);
+  minus_one[0]--; // n is odd: no borrow
+  bn_sub(m, minus_one, minus_one, m->one);
+  minus_one[0]++; // (n - 1) - one + 1 = n - one, never n
+  if (!memcmp(x, m->one, k * sizeof *x) || !memcmp(x, minus_one, k * sizeof *x))
+    return 1;
+  while (--s > 0) {
+    bn_sqr(m, x, x);
+    if (!memcmp(x, minus_one, k * sizeof *x))
+      return 1;
+    if (!memcmp(x, m->one, k * sizeof *x))
+      return 0;
+  }
+  return 0;
+}
+
+// As lucas128.
+static int lucas_bn(const mont_bn *m, int64_t D) {
+  int64_t q = (1 - D) / 4;
+  size_t k = m->k, s = 0;
+  uint64_t d[BN_LIMBS], v[BN_LIMBS], v1[BN_LIMBS], qk[BN_LIMBS];
+  uint64_t mid[BN_LIMBS], t[BN_LIMBS];
+  memcpy(d, m->n, k * sizeof *d); // d = n + 1: all-ones n is a multiple of 3
+  for (size_t i = 0; i < k && ++d[i] == 0; i++)
+    ;
+  while (!bit(d, s))
+    s++;
+  bn_add(m, v, m->one, m->one);
+  memcpy(v1, m->one, k * sizeof *v1);
+  memcpy(qk, m->one, k * sizeof *qk);
+  for (size_t i = bitlen(d, k); i-- > s;) {
+    bn_mul(m, mid, v, v1);
+    bn_sub(m, mid, mid, qk);
+    if (bit(d, i)) {
+      bn_times(m, t, qk, q); // Q^(k+1)
+      bn_mul(m, qk, qk, t);
+      bn_add(m, t, t, t);
+      bn_sqr(m, v1, v1);
+      bn_sub(m, v1, v1, t);
+      memcpy(v, mid, k * sizeof *v);
+    } else {
+      bn_add(m, t, qk, qk);
+      bn_sqr(m, v, v);
+      bn_sub(m, v, v, t);
+      bn_sqr(m, qk, qk);
+      memcpy(v1, mid, k * sizeof *v1);
+    }
+  }
+  bn_add(m, t, v1, v1);
+  if (bn_zero(v, k) || !memcmp(t, v, k * sizeof *t))
+    return 1;
+  while (s-- > 1) {
+    bn_add(m, t, qk, qk);
+    bn_sqr(m, v, v);
+    bn_sub(m, v, v, t);
+    if (bn_zero(v, k))
+      return 1;
+    bn_sqr(m, qk, qk);
+  }
+  return 0;
+}
+
+static uint64_t rem_n(const uint64_t *n, size_t k, uint64_t m) {
+  uint64_t r = 0;
+  for (size_t i = k; i-- > 0;)
+    r = (uint64_t)((((u128)r << 64) | n[i]) % m);
+  return r;
+}
+
+static uint64_t rem_bn(const void *p, uint64_t m) {
+  const mont_bn *b = p;
+  return rem_n(b->n, b->k, m);
+}
+
+// As square128: r and b never overlap, so r + b is an or.
+static int square_bn(const void *p) {
+  const mont_bn *b = p;
+  size_t k = b->k;
+  uint64_t n[BN_LIMBS], r[BN_LIMBS] = {0}, t[BN_LIMBS];
+  memcpy(n, b->n, k * sizeof *n);
+  for (size_t i = (bitlen(n, k) - 1) & ~(size_t)1;; i -= 2) {
+    memcpy(t, r, k * sizeof *t);
+    t[i / 64] |= (uint64_t)1 << i % 64;
+    int ge = 1;
+    for (size_t j = k; j-- > 0;)
+      if (n[j] != t[j]) {
+        ge = n[j] > t[j];
+        break;
+      }
+    if (ge) {
+      uint64_t borrow = 0;
+      for (size_t j = 0; j < k; j++) {
+        u128 d = (u128)n[j] - t[j] - borrow;
+        n[j] = (uint64_t)d;
+        borrow = (uint64_t)(d >> 64) & 1;
+      }
+    }
+    for (size_t j = 0; j < k; j++)
+      r[j] = r[j] >> 1 | (j + 1 < k ? r[j + 1] << 63 : 0);
+    if (ge)
+      r[i / 64] |= (uint64_t)1 << i % 64;
+    if (i == 0)
+      break;
+  }
+  return bn_zero(n, k);
+}
+
+static int bpsw_bn(const uint64_t *n, size_t k) {
+  mont_bn m;
+  mont_bn_init(&m, n, k);
+  if (!sprp2_bn(&m))
+    return 0;
+  int64_t D = selfridge(&m, rem_bn, square_bn);
+  return D && lucas_bn(&m, D);
+}
+
+int prime_bn(const uint64_t *n, size_t k) {
+  while (k && !n[k - 1])
+    k--;
+  if (k <= 2)
+    return prime_u128(k == 2 ? (u128)n[1] << 64 | n[0] : k ? n[0] : 0);
+  if (!(n[0] & 1))
+    return 0;
+  if (k > BN_LIMBS)
+    return -1;
+  // Out here a lookup costs less than the divisions below, though only
+  // numbers that get past them are worth keeping
+  int r = cache_get(n, k);
+  if (r >= 0)
+    return r;
+  for (size_t i = 0; i < NPRODS; i++)
+    if (gcd64(rem_n(n, k, small_prods[i]), small_prods[i]) != 1)
+      return 0;
+
+  r = bpsw_bn(n, k);
+  cache_put(n, k, r);
+  return r;
+}
@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "ht_gen.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+// Entries sit in a fixed array the CLOCK hand sweeps; the hash table maps
+// a number to its entry's index. Numbers up to 128 bits are stored in the
+// entry, longer ones in a malloc'd copy of their limbs.
+typedef struct entry {
+  uint64_t hash;
+  union {
+    uint64_t inl[2];       // k <= 2
+    const uint64_t *limbs; // k > 2, ours unless this is the probe
+  } n;
+  uint32_t k;  // 0 = free
+  uint8_t ref; // looked up since the hand last passed
+} entry;
+
+static inline const uint64_t *entry_limbs(const entry *e) {
+  return e->k <= 2 ? e->n.inl : e->n.limbs;
+}
+
+static inline int entry_eq(const entry *a, const entry *b) {
+  return a->hash == b->hash && a->k == b->k &&
+         memcmp(entry_limbs(a), entry_limbs(b), a->k * sizeof(uint64_t)) == 0;
+}
+
+// Keys are indexes into the entry array, which is the table's ctx; values
+// are the answers.
+#define idx_hash(ent, i) ((ent)[i].hash)
+#define idx_eq(ent, a, b) entry_eq(&(ent)[a], &(ent)[b])
+
+HT_DEFINE_CTX(idxtab, uint32_t, uint8_t, const entry *, idx_hash, idx_eq)
+
+typedef struct cache {
+  idxtab tab;
+  entry *ent;         // cap + 1: ent[cap] holds the key being looked up
+  uint32_t cap, hand; // hand: next entry CLOCK looks at
+  size_t fixed;       // bytes of ent and the table
+  size_t long_budget; // bytes the limbs of numbers past 128 bits may take
+  size_t long_bytes;
+  uint64_t seed; // so nobody can line up colliding numbers ahead of time
+  // Written by the owning thread only, read by cache_stats
+  atomic_uint_least64_t hits, misses, evictions;
+  atomic_size_t entries, bytes;
+  struct cache *next; // on the list cache_stats walks
+} cache;
+
+static size_t config_bytes;
+static pthread_mutex_t all_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache *all;
+static uint64_t gone_hits, gone_misses, gone_evictions; // of exited threads
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key; // frees a thread's table when it exits
+static int key_ok = 1;
+static _Thread_local cache *mine;
+static _Thread_local int failed; // no memory for this thread's table
+
+void cache_config(size_t bytes) { config_bytes = bytes; }
+
+static void bump(atomic_uint_least64_t *x) {
+  atomic_store_explicit(x, atomic_load_explicit(x, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+}
+
+static uint64_t cache_seed(void) {
+  uint64_t s;
+  if (getrandom(&s, sizeof s, GRND_NONBLOCK) == (ssize_t)sizeof s)
+    return s;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ht_hash_u64((uint64_t)ts.tv_nsec ^ (uint64_t)(uintptr_t)&s);
+}
+
+static size_t fixed_bytes(size_t slots, size_t cap) {
+  return (cap + 1) * sizeof(entry) + slots * (sizeof(idxtab_slot) + 1);
+}
+
+// Unlist the table, keeping its counts for cache_stats, and free it.
+static void cache_free(void *arg) {
+  cache *c = arg;
+  pthread_mutex_lock(&all_lock);
+  cache **pp = &all;
+  while (*pp != c)
+    pp = &(*pp)->next;
+  *pp = c->next;
+  gone_hits += atomic_load_explicit(&c->hits, memory_order_relaxed);
+  gone_misses += atomic_load_explicit(&c->misses, memory_order_relaxed);
+  gone_evictions += atomic_load_explicit(&c->evictions, memory_order_relaxed);
+  pthread_mutex_unlock(&all_lock);
+  for (uint32_t i = 0; i < c->cap; i++)
+    if (c->ent[i].k > 2)
+      free((void *)c->ent[i].n.limbs);
+  idxtab_destroy(&c->tab);
+  free(c->ent);
+  free(c);
+  mine = NULL;
+  failed = 1; // a later destructor on this thread gets no new table
+}
+
+static void key_create(void) {
+  if (pthread_key_create(&key, cache_free) != 0)
+    key_ok = 0;
+}
+
+// Entries and table take at most half the budget, the limbs of numbers
+// past 128 bits the rest. The table has twice as many slots as entries, so
+// sweeping out deleted slots rebuilds it at the same size instead of
+// doubling it (for the moment that takes, it is there twice).
+static cache *cache_new(size_t bytes) {
+  pthread_once(&key_once, key_create);
+  size_t slots = HTG_GROUP;
+  if (!key_ok) // it would outlive its thread
+    return NULL;
+  if (fixed_bytes(slots, slots / 2 - 1) > bytes / 2)
+    return NULL;
+  while (slots < (size_t)1 << 32 &&
+         fixed_bytes(slots * 2, slots - 1) <= bytes / 2)
+    slots *= 2;
+  cache *c = calloc(1, sizeof *c);
+  if (!c)
+    return NULL;
+  c->cap = (uint32_t)(slots / 2 - 1);
+  c->ent = calloc((size_t)c->cap + 1, sizeof *c->ent);
+  if (!c->ent || idxtab_init(&c->tab, c->cap) < 0) {
+    free(c->ent);
+    free(c);
+    return NULL;
+  }
+  if (pthread_setspecific(key, c) != 0) {
+    idxtab_destroy(&c->tab);
+    free(c->ent);
+    free(c);
+    return NULL;
+  }
+  c->tab.ctx = c->ent;
+  c->fixed = fixed_bytes(idxtab_cap(&c->tab), c->cap);
+  c->long_budget = bytes - c->fixed;
+  c->seed = cache_seed();
+  atomic_init(&c->bytes, c->fixed);
+  pthread_mutex_lock(&all_lock);
+  c->next = all;
+  all = c;
+  pthread_mutex_unlock(&all_lock);
+  return c;
+}
+
+// The calling thread's table, made on first use; NULL when caching is off.
+static cache *cache_mine(void) {
+  if (mine || !config_bytes || failed)
+    return mine;
+  if (!(mine = cache_new(config_bytes)))
+    failed = 1;
+  return mine;
+}
+
+static uint64_t limbs_hash(const cache *c, const uint64_t *n, size_t k) {
+  uint64_t h = c->seed;
+  for (size_t i = 0; i < k; i++)
+    h = ht_hash_u64(h ^ n[i]);
+  return h;
+}
+
+// Point the probe entry at n; its index is the key to look up.
+static uint32_t probe(cache *c, const uint64_t *n, size_t k) {
+  entry *p = &c->ent[c->cap];
+  p->hash = limbs_hash(c, n, k);
+  p->k = (uint32_t)k;
+  if (k <= 2)
+    memcpy(p->n.inl, n, k * sizeof *n);
+  else
+    p->n.limbs = n;
+  return c->cap;
+}
+
+int cache_get(const uint64_t *n, size_t k) {
+  cache *c = cache_mine();
+  if (!c)
+    return -1;
+  idxtab_slot *sl = idxtab_get_slot(&c->tab, probe(c, n, k));
+  if (!sl) {
+    bump(&c->misses);
+    return -1;
+  }
+  c->ent[sl->key].ref = 1; // the stored key: the entry's index
+  bump(&c->hits);
+  return sl->val;
+}
+
+static void evict(cache *c, uint32_t i) {
+  entry *e = &c->ent[i];
+  idxtab_del(&c->tab, i);
+  if (e->k > 2) {
+    c->long_bytes -= e->k * sizeof(uint64_t);
+    free((void *)e->n.limbs);
+  }
+  e->k = 0;
+  bump(&c->evictions);
+}
+
+void cache_put(const uint64_t *n, size_t k, int prime) {
+  cache *c = cache_mine();
+  size_t need = k > 2 ? k * sizeof *n : 0;
+  if (!c || need > c->long_budget)
+    return;
+  uint8_t *have = idxtab_get(&c->tab, probe(c, n, k));
+  if (have) {
+    *have = (uint8_t)prime;
+    return;
+  }
+
+  // CLOCK: pass over entries looked at since last time, clearing their
+  // bit, and evict the first that was not. Keep going while the limbs
+  // would not fit.
+  for (;; c->hand = (c->hand + 1) % c->cap) {
+    entry *e = &c->ent[c->hand];
+    if (e->k && e->ref) {
+      e->ref = 0;
+      continue;
+    }
+    if (e->k)
+      evict(c, c->hand);
+    if (c->long_bytes + need <= c->long_budget)
+      break;
+  }
+  entry *e = &c->ent[c->hand];
+  uint32_t i = c->hand;
+  c->hand = (c->hand + 1) % c->cap;
+  *e = c->ent[c->cap]; // the probe: hash, k and where the limbs are
+  if (k > 2) {
+    uint64_t *copy = malloc(need);
+    if (!copy) {
+      e->k = 0;
+      return;
+    }
+    memcpy(copy, n, need);
+    e->n.limbs = copy;
+    c->long_bytes += need;
+  }
+  e->ref = 0;
+  uint8_t *val = idxtab_put(&c->tab, i, NULL);
+  if (!val) { // the table could not sweep its deleted slots
+    if (k > 2) {
+      c->long_bytes -= need;
+      free((void *)e->n.limbs);
+    }
+    e->k = 0;
+    return;
+  }
+  *val = (uint8_t)prime;
+  atomic_store_explicit(&c->entries, idxtab_len(&c->tab),
+                        memory_order_relaxed);
+  atomic_store_explicit(&c->bytes, c->fixed + c->long_bytes,
+                        memory_order_relaxed);
+}
+
+void cache_stats(CacheStats *s) {
+  pthread_mutex_lock(&all_lock);
+  *s = (CacheStats){
+      .hits = gone_hits, .misses = gone_misses, .evictions = gone_evictions};
+  for (cache *c = all; c; c = c->next) {
+    s->hits += atomic_load_explicit(&c->hits, memory_order_relaxed);
+    s->misses += atomic_load_explicit(&c->misses, memory_order_relaxed);
+    s->evictions += atomic_load_explicit(&c->evictions, memory_order_relaxed);
+    s->entries += atomic_load_explicit(&c->entries, memory_order_relaxed);
+    s->bytes += atomic_load_explicit(&c->bytes, memory_order_relaxed);
+    s->threads++;
+  }
+  pthread_mutex_unlock(&all_lock);
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Answers to primality tests too slow to repeat: each thread keeps its own
+// bounded table from a number to 0/1, evicting by CLOCK, freed when the
+// thread exits. The prime_* entry points look there once a number is past
+// the sieve and trial division, so only numbers that would take
+// Miller-Rabin or BPSW ever get in.
+
+// Give every thread a table of up to bytes, keys included; 0 (the default)
+// turns caching off. Call before the first test on any thread.
+void cache_config(size_t bytes);
+
+// The number of k little-endian limbs at n, k >= 1 and n[k - 1] != 0: 0/1
+// if the calling thread has its answer, else -1.
+int cache_get(const uint64_t *n, size_t k);
+// Remember prime (0/1) for n, making room if needed. Numbers too large for
+// the whole table are not kept.
+void cache_put(const uint64_t *n, size_t k, int prime);
+
+typedef struct CacheStats {
+  uint64_t hits, misses, evictions;
+  size_t entries, bytes; // held now
+  int threads;           // tables summed
+} CacheStats;
+
+// Totals over every thread's table; read while they run, so only roughly
+// consistent. Hits, misses and evictions include threads that have exited.
+void cache_stats(CacheStats *s);
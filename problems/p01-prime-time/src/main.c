@@ -1,377 +1,319 @@
 #define _GNU_SOURCE
 
-#include <arpa/inet.h>
 #include <errno.h>
-#include <fcntl.h>
-#include <math.h>
-#include <netinet/in.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/epoll.h>
-#include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
-#include "cJSON.h"
+#include "cache.h"
+#include "net.h"
+#include "pool.h"
+#include "prime.h"
+#include "request.h"
+#include "sieve.h"
 //#include "utils.h"
 
 #define PORT 8080
-#define BACKLOG 128
-
-typedef struct Buf {
-  uint8_t *data;
-  size_t len; // used
-  size_t cap; // allocated
-} Buf;
-
-typedef struct Conn {
-  int fd;
-  Buf in;
-  Buf out;
-  int peer_closed; // 0/1
-} Conn;
+#define SIEVE_BITS 27      // default sieve bound: 2^27, 8 MiB
+#define OFFLOAD_LEN 20     // longer tokens can be past 64 bits: to the workers
+#define OFFLOAD_MAX 100000 // largest -o; -w 0 keeps every token on the reactor
+#define PENDING_MAX 64     // replies a connection may have waiting on workers
+#define BATCH_MAX 512      // lines parsed and tested together
+#define CACHE_MIB 8        // per thread, for answers that took Miller-Rabin
+#define CACHE_MIB_MAX 65536
+#define WORKERS_MAX 1024
+
+// -j: decode every line with cJSON, the path req_parse falls back to.
+static int (*parse)(const char *, size_t, const char **, size_t *) = req_parse;
+static int workers;                       // -w, 0 = test everything inline
+static size_t offload_len = OFFLOAD_LEN; // -o
+
+enum { R_WAIT, R_YES, R_NO, R_BAD }; // a reply, R_WAIT while on a worker
+
+// Replies go out in the order the lines came, whichever finishes first.
+typedef struct Pending {
+  uint32_t head, tail;        // next reply to send, next line's number
+  uint8_t reply[PENDING_MAX]; // by line number mod PENDING_MAX
+  uint8_t bad;                // 0/1 a malformed line is queued: read no more
+} Pending;
+
+static inline Pending *conn_pending(Conn *c) { return conn_user(c); }
+
+// The text of each reply but R_WAIT.
+static const struct {
+  const char *s;
+  size_t len;
+} replies[] = {
+#define REPLY(s) {s, sizeof s - 1}
+    [R_YES] = REPLY("{\"method\":\"isPrime\", \"prime\":true}\n"),
+    [R_NO] = REPLY("{\"method\":\"isPrime\", \"prime\":false}\n"),
+    [R_BAD] = REPLY("{}\n"),
+#undef REPLY
+};
+
+// prime_token's answer as a reply. A number too large to test gets the
+// malformed one rather than a guess.
+static int verdict(int prime) {
+  return prime < 0 ? R_BAD : prime ? R_YES : R_NO;
+}
 
-static Conn *new_conn(int fd) {
-  Conn *c = calloc(1, sizeof *c);
-  if (!c)
-    abort();
-  c->fd = fd;
-  return c;
+static void send_reply(Conn *c, int reply) {
+  conn_send(c, replies[reply].s, replies[reply].len);
+  if (reply == R_BAD)
+    conn_shutdown(c); // malformed: answer once, then hang up
 }
 
-static void conn_close(Conn *c, int epfd) {
-  if (!c)
-    return;
+// Send what is ready, up to the first reply still on a worker.
+static void flush_replies(Conn *c) {
+  Pending *p = conn_pending(c);
+  while (p->head != p->tail && p->reply[p->head % PENDING_MAX] != R_WAIT) {
+    int reply = p->reply[p->head++ % PENDING_MAX];
+    send_reply(c, reply);
+    if (reply == R_BAD) // nothing after it is answered
+      p->head = p->tail;
+  }
+  if (p->head == p->tail)
+    conn_hold(c, 0);
+}
 
-  if (c->fd >= 0) {
-    // Best-effort remove from epoll
-    if (epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL) < 0) {
-      if (errno != EBADF && errno != ENOENT)
-        perror("epoll_ctl DEL");
-    }
+// A token too long for the reactor, as line number seq on c: R_WAIT once a
+// worker has it, else tested here.
+static int offload(Conn *c, const char *tok, size_t len, uint32_t seq) {
+  Job *j = pool_job(c, seq, tok, len);
+  if (j && pool_submit(j))
+    return R_WAIT;
+  free(j); // no room: test it here
+  return verdict(prime_token(tok, len));
+}
 
-    // Close, retry on EINTR
-    for (;;) {
-      if (close(c->fd) == 0)
-        break;
-      if (errno == EINTR)
-        continue;
-      if (errno != EBADF)
-        perror("close");
+// The complete lines at the front of c->in, as far as one pass takes them.
+// Tokens point into c->in, which stays put until the pass consumes it.
+typedef struct batch {
+  size_t lines;
+  size_t end[BATCH_MAX];  // offset past each line's '\n'
+  uint8_t kind[BATCH_MAX]; // R_BAD, R_WAIT for a long token, else R_YES
+  const char *tok[BATCH_MAX];
+  size_t len[BATCH_MAX];
+  int prime[BATCH_MAX]; // for the R_YES lines, by prime_token_batch
+} batch;
+
+static void gather(Conn *c, batch *b) {
+  const char *in = (const char *)c->in.data;
+  size_t off = 0;
+  for (b->lines = 0; b->lines < BATCH_MAX;) {
+    const char *nl = memchr(in + off, '\n', c->in.len - off);
+    if (!nl)
       break;
+    size_t i = b->lines++, linelen = (size_t)(nl - in) - off;
+    if (linelen && nl[-1] == '\r')
+      linelen--; // CRLF
+    int ok = parse(in + off, linelen, &b->tok[i], &b->len[i]);
+    off = b->end[i] = (size_t)(nl - in) + 1;
+    if (!ok) {
+      b->kind[i] = R_BAD;
+      break; // nothing past it is read
     }
-    c->fd = -1;
+    b->kind[i] = workers && b->len[i] > offload_len ? R_WAIT : R_YES;
   }
-
-  free(c->in.data);
-  c->in.data = NULL;
-  c->in.len = c->in.cap = 0;
-  free(c->out.data);
-  c->out.data = NULL;
-  c->out.len = c->out.cap = 0;
-
-  free(c);
-}
-
-static int buf_reserve(Buf *b, size_t need) {
-  if (b->cap - b->len >= need)
-    return 0;
-  size_t ncap = b->cap ? b->cap : 4096;
-  while (ncap - b->len < need)
-    ncap *= 2;
-  void *p = realloc(b->data, ncap);
-  if (!p)
-    return -1;
-  b->data = p;
-  b->cap = ncap;
-  return 0;
 }
 
-static int buf_append(Buf *b, const void *src, size_t n) {
-  if (buf_reserve(b, n) < 0)
-    return -1;
-  memcpy(b->data + b->len, src, n);
-  b->len += n;
-  return 0;
-}
+// Answer complete lines in passes of up to BATCH_MAX: parse them all, test
+// the short tokens together, then reply in order. Replies that can go out
+// now share one conn_send; the rest wait in the Pending ring behind
+// whatever a worker holds. Partial lines stay, and so does everything
+// while PENDING_MAX replies are waiting.
+static void prime_data(Conn *c) {
+  static _Thread_local batch b;
+  static _Thread_local char out[BATCH_MAX * 64]; // > any reply
+  Pending *p = conn_pending(c);
+  while (!c->closing && !p->bad && p->tail - p->head < PENDING_MAX) {
+    gather(c, &b);
+    if (!b.lines)
+      break;
 
-static void buf_consume(Buf *b, size_t n) {
-  if (n >= b->len) {
-    b->len = 0;
-    return;
+    const char *tok[BATCH_MAX];
+    size_t len[BATCH_MAX], n = 0;
+    for (size_t i = 0; i < b.lines; i++)
+      if (b.kind[i] == R_YES) {
+        tok[n] = b.tok[i];
+        len[n++] = b.len[i];
+      }
+    prime_token_batch(tok, len, n, b.prime);
+
+    size_t used = 0, consumed = 0, k = 0;
+    for (size_t i = 0; i < b.lines; i++) {
+      int reply = b.kind[i];
+      if (reply == R_YES)
+        reply = verdict(b.prime[k++]);
+      if (p->head == p->tail && reply != R_WAIT) { // nothing ahead of it
+        memcpy(out + used, replies[reply].s, replies[reply].len);
+        used += replies[reply].len;
+        if (reply == R_BAD)
+          conn_shutdown(c); // malformed: answer once, then hang up
+      } else {
+        if (p->tail - p->head == PENDING_MAX)
+          break; // the rest go through again once replies drain
+        if (reply == R_WAIT)
+          reply = offload(c, b.tok[i], b.len[i], p->tail);
+        p->reply[p->tail++ % PENDING_MAX] = (uint8_t)reply;
+        p->bad = reply == R_BAD;
+        conn_hold(c, 1);
+      }
+      consumed = b.end[i];
+      if (reply == R_BAD)
+        break; // a number too large to test: the lines after it go unread
+    }
+    conn_send(c, out, used);
+    buf_consume(&c->in, consumed);
+    if (consumed < b.end[b.lines - 1])
+      break;
   }
-  memmove(b->data, b->data + n, b->len - n);
-  b->len -= n;
 }
 
-static int isPrime(const int n) {
-  if (n < 2)
-    return 0;
-  if ((n % 2) == 0)
-    return n == 2;
-  if ((n % 3) == 0)
-    return n == 3;
-
-  // test only 6k±1
-  for (int64_t i = 5; i <= n / i; i += 6) {
-    if (n % i == 0 || n % (i + 2) == 0)
-      return 0;
+// Workers finished some jobs for this reactor.
+static void prime_wake(Reactor *r) {
+  (void)r;
+  Job *next;
+  for (Job *j = pool_done(); j; j = next) {
+    next = j->next;
+    Conn *c = j->c;
+    if (!c->dead && c->gen == j->gen) { // else closed, maybe reused, since
+      conn_pending(c)->reply[j->seq % PENDING_MAX] = (uint8_t)verdict(j->prime);
+      flush_replies(c);
+      if (c->in.len) // lines held back while its replies were full
+        prime_data(c);
+    }
+    free(j);
   }
-  return 1;
 }
 
-static inline int dbl_to_i64(double v, int64_t *out) {
-  if (!isfinite(v))
-    return 0;
-  if (v != trunc(v))
-    return 0;
-  if (fabs(v) > 9007199254740991.0)
-    return 0; // 2^53-1
-  if (v < (double)INT64_MIN || v > (double)INT64_MAX)
-    return 0;
-  *out = (int64_t)v;
-  return 1;
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
 }
 
-static int make_listener(void) {
-  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
-  if (fd < 0) {
-    perror("socket");
-    exit(EXIT_FAILURE);
-  }
-
-  int yes = 1;
-  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0) {
-    perror("setsockopt");
-    exit(EXIT_FAILURE);
+// Resident set in MiB, from /proc/self/statm.
+static double rss_mib(void) {
+  long pages = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f) {
+    if (fscanf(f, "%*s %ld", &pages) != 1)
+      pages = 0;
+    fclose(f);
   }
+  return (double)pages * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
 
-  struct sockaddr_in addr = {0};
-  addr.sin_family = AF_INET;
-  addr.sin_addr.s_addr = htonl(INADDR_ANY); // 0.0.0.0
-  addr.sin_port = htons(PORT);
+static int cpus(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
 
-  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-    perror("bind");
-    exit(EXIT_FAILURE);
-  }
+// arg as a whole decimal number in lo..hi (lo >= 0), else -1.
+static long opt_num(const char *arg, long lo, long hi) {
+  char *end;
+  errno = 0;
+  long v = strtol(arg, &end, 10);
+  return end == arg || *end || errno || v < lo || v > hi ? -1 : v;
+}
 
-  if (listen(fd, BACKLOG) < 0) {
-    perror("listen");
-    exit(EXIT_FAILURE);
+// Map the sieve from cache if it holds this bound, else build and save it.
+static void load_sieve(Sieve *s, int bits, const char *cache) {
+  double t0 = now_ms();
+  const char *how = "mapped";
+  if (!cache || sieve_map(s, (uint64_t)1 << bits, cache) < 0) {
+    how = "built";
+    if (sieve_build(s, (uint64_t)1 << bits, cpus()) < 0) {
+      perror("sieve");
+      exit(EXIT_FAILURE);
+    }
+    if (cache && sieve_save(s, cache) < 0)
+      perror(cache); // still usable, just not cached
   }
-  return fd;
+  fprintf(stderr, "sieve below 2^%d %s in %.1f ms, rss %.1f MiB\n", bits,
+          how, now_ms() - t0, rss_mib());
+  prime_use_sieve(s);
 }
 
-static void on_read(Conn *c, int epfd) {
-  for (;;) {
-    uint8_t tmp[64 * 1024];
-    ssize_t n = recv(c->fd, tmp, sizeof(tmp), 0);
+static void cache_report(void) {
+  CacheStats s;
+  cache_stats(&s);
+  uint64_t looked = s.hits + s.misses;
+  fprintf(stderr,
+          "cache: %d tables, %zu entries, %.1f MiB, %.1f%% hits of %llu, "
+          "%llu evicted\n",
+          s.threads, s.entries, (double)s.bytes / (1 << 20),
+          looked ? 100.0 * (double)s.hits / (double)looked : 0.0,
+          (unsigned long long)looked, (unsigned long long)s.evictions);
+}
 
-    if (n > 0) {
-      if (buf_append(&c->in, tmp, n) < 0) {
-        perror("realloc");
-        exit(EXIT_FAILURE);
-      }
-      continue; // keep reading in ET mode
-    }
-    if (n == 0) {         // perr sent FIN
-      c->peer_closed = 1; // half-closed; flush pending
+int main(int argc, char **argv) {
+  static NetProto proto = {.user_size = sizeof(Pending),
+                           .on_data = prime_data};
+  NetConfig cfg = {.port = PORT, .threads = 1};
+  int bits = SIEVE_BITS, cache_mib = CACHE_MIB;
+  const char *cache = NULL;
+  workers = cpus();
+
+  int opt, bad = 0;
+  while ((opt = getopt(argc, argv, NET_OPTS "jl:c:w:o:m:")) != -1) {
+    switch (opt) {
+    case 'j':
+      parse = req_parse_cjson;
       break;
-    }
-
-    if (errno == EINTR) // retry
-      continue;
-    if (errno == EAGAIN || errno == EWOULDBLOCK) // drained
+    case 'l': // below 2^7 one 128-bit word covers it: nothing to gain
+      bits = (int)opt_num(optarg, 0, 32);
+      bad |= bits < 0 || (bits > 0 && bits < 7);
       break;
-
-    perror("recv");
-    conn_close(c, epfd);
-    return;
-  }
-
-  // Handle the input buffer
-  // printf("In c input buffer: %.*s\n", (int)c->in.len, c->in.data);
-  // Process complete lines; leave partials
-  for (;;) {
-    unsigned char *nl = memchr(c->in.data, '\n', c->in.len);
-    if (!nl) {
+    case 'c':
+      cache = optarg;
       break;
-    }
-
-    size_t raw_len = (size_t)(nl - c->in.data); // Just before \n
-    size_t linelen = raw_len;
-    if (linelen && c->in.data[linelen - 1] == '\r')
-      linelen--; // CRLF
-
-    // printf("Message: %.*s\n", (int)linelen, (const char *)c->in.data);
-
-    cJSON *msg = cJSON_ParseWithLength((const char *)c->in.data, linelen);
-    buf_consume(&c->in, raw_len + 1); // including '\n'
-
-    int ok = 0;
-    if (msg) {
-      const cJSON *method = cJSON_GetObjectItemCaseSensitive(msg, "method");
-      const cJSON *number = cJSON_GetObjectItemCaseSensitive(msg, "number");
-
-      if (cJSON_IsString(method) && method->valuestring &&
-          strcmp(method->valuestring, "isPrime") == 0 &&
-          cJSON_IsNumber(number)) {
-
-        int prime = 0;
-        int64_t n64;
-        if (dbl_to_i64(cJSON_GetNumberValue(number), &n64))
-          prime = isPrime(n64);
-
-        char resp[128];
-        int m = snprintf(resp, sizeof resp,
-                         "{\"method\":\"isPrime\", \"prime\":%s}\n",
-                         prime ? "true" : "false");
-        if (m > 0 && (size_t)m < sizeof resp) {
-          buf_append(&c->out, resp, (size_t)m);
-          ok = 1;
-        }
-      }
-    }
-
-    if (ok == 0) {
-      const char *err = "{}\n";
-      buf_append(&c->out, err, 3);
-      c->peer_closed = 1;
-    }
-  }
-
-  // Need to write? enable EPOLLOUT
-  if (c->out.len > 0) {
-    struct epoll_event ev = {0};
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
-    ev.data.ptr = c;
-    if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
-      perror("epoll_ctl MOD");
-      conn_close(c, epfd);
-      return;
-    }
-  }
-
-  if (c->peer_closed && c->out.len == 0)
-    conn_close(c, epfd);
-}
-
-static void on_write(Conn *c, int epfd) {
-  while (c->out.len) {
-    ssize_t n = send(c->fd, c->out.data, c->out.len, MSG_NOSIGNAL);
-    if (n > 0) {
-      buf_consume(&c->out, (size_t)n);
-      continue;
-    }
-    if (n < 0 && errno == EINTR)
-      continue;
-    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    case 'w':
+      workers = (int)opt_num(optarg, 0, WORKERS_MAX);
+      bad |= workers < 0;
+      break;
+    case 'o': {
+      long len = opt_num(optarg, 0, OFFLOAD_MAX);
+      bad |= len < 0;
+      offload_len = (size_t)len;
       break;
-    if (n < 0 && (errno == EPIPE || errno == ECONNRESET)) {
-      conn_close(c, epfd);
-      return;
-    }
-    perror("send");
-    conn_close(c, epfd);
-    return;
-  }
-
-  if (c->out.len == 0) {
-    if (c->peer_closed) { // finished echoing; mirror the close
-      conn_close(c, epfd);
-      return;
     }
-    struct epoll_event ev = {0}; // stop EPOLLOUT
-    ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-    ev.data.ptr = c;
-    if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
-      perror("epoll_ctl MOD");
-      conn_close(c, epfd);
+    case 'm':
+      cache_mib = (int)opt_num(optarg, 0, CACHE_MIB_MAX);
+      bad |= cache_mib < 0;
+      break;
+    default:
+      bad |= net_config_opt(&cfg, opt, optarg) < 0;
     }
   }
-}
-
-int main(void) {
-#define MAX_EVENTS 10
-  struct epoll_event ev, events[MAX_EVENTS];
-
-  printf("Opening listener on port: %d \n", PORT);
-  int lfd = make_listener();
-  printf("Listening on port: %d \n", PORT);
-
-  int epfd = epoll_create1(EPOLL_CLOEXEC);
-  if (epfd == -1) {
-    perror("epoll_create1");
+  if (bad) {
+    net_usage(argv[0], " [-j always decode with cJSON]"
+                       " [-l sieve below 2^bits, 7..32, 0 = none]"
+                       " [-c sieve cache]"
+                       " [-w workers, 0..1024, 0 = none]"
+                       " [-o offload above digits, 0..100000]"
+                       " [-m cache MiB per thread, 0..65536, 0 = none]");
     exit(EXIT_FAILURE);
   }
-
-  ev.events = EPOLLIN | EPOLLET;
-  ev.data.fd = lfd;
-  if (epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev) == -1) {
-    perror("epoll_ctl: lfd");
-    exit(EXIT_FAILURE);
-  }
-
-  for (;;) {
-    int nfds = epoll_wait(epfd, events, MAX_EVENTS, -1);
-    if (nfds == -1) {
-      perror("epoll_wait");
+  if (workers) {
+    if (pool_start(workers) < 0) {
+      perror("pool_start");
       exit(EXIT_FAILURE);
     }
-
-    for (int n = 0; n < nfds; ++n) {
-
-      if (events[n].data.fd == lfd) {
-        if (events[n].events & (EPOLLERR | EPOLLHUP)) {
-          int err = 0;
-          socklen_t elen = sizeof(err);
-          getsockopt(lfd, SOL_SOCKET, SO_ERROR, &err, &elen);
-          fprintf(stderr, "listener error: %s\n", strerror(err));
-          exit(1);
-        }
-        for (;;) {
-          struct sockaddr_in cli;
-          socklen_t len = sizeof(cli);
-
-          int cfd = accept4(lfd, (struct sockaddr *)&cli, &len,
-                            SOCK_NONBLOCK | SOCK_CLOEXEC);
-          if (cfd < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-              break;
-            perror("accept");
-            break;
-          }
-
-          Conn *c = new_conn(cfd);
-          ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-          ev.data.fd = cfd;
-          ev.data.ptr = c;
-          if (epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev) == -1) {
-            perror("epoll_ctl: conn_sock");
-            exit(EXIT_FAILURE);
-          }
-        }
-        continue;
-      }
-
-      // client fds
-      Conn *c = events[n].data.ptr;
-      if (events[n].events & (EPOLLERR)) {
-        conn_close(c, epfd);
-        continue;
-      }
-
-      if (events[n].events & EPOLLIN) {
-        on_read(c, epfd);
-      }
-      if (events[n].events & EPOLLOUT) {
-        on_write(c, epfd);
-      }
-    }
+    proto.on_wake = prime_wake;
+  }
+  if (cache_mib) {
+    cache_config((size_t)cache_mib << 20);
+    proto.on_stats = cache_report;
   }
 
-  return 0;
+  static Sieve sieve;
+  if (bits)
+    load_sieve(&sieve, bits, cache);
+  return net_run(&cfg, &proto);
 }
@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+
+#include "pool.h"
+#include "prime.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RING_CAP 4096 // jobs in flight across all reactors, power of two
+
+// Per reactor thread: where its workers leave finished jobs.
+typedef struct JobHome {
+  _Atomic(Job *) done; // Treiber stack; the reactor takes it whole
+  atomic_int woken;    // 1 once a net_wake is on its way
+  Reactor *r;
+} JobHome;
+
+static _Thread_local JobHome *home;
+
+// Bounded MPMC ring after Vyukov: each cell's sequence number says whose
+// turn it is, so producers and consumers only contend on their own index.
+typedef struct cell {
+  atomic_size_t seq;
+  Job *job;
+} cell;
+
+static cell cells[RING_CAP];
+static _Alignas(64) atomic_size_t ring_tail; // next push
+static _Alignas(64) atomic_size_t ring_head; // next pop
+static sem_t ready;                          // one count per pushed job
+
+static int ring_push(Job *j) {
+  size_t pos = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+  cell *c;
+  for (;;) {
+    c = &cells[pos & (RING_CAP - 1)];
+    size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit(&ring_tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (dif < 0) {
+      return 0; // full
+    } else {
+      pos = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    }
+  }
+  c->job = j;
+  atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+  return 1;
+}
+
+static Job *ring_pop(void) {
+  size_t pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+  cell *c;
+  for (;;) {
+    c = &cells[pos & (RING_CAP - 1)];
+    size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit(&ring_head, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (dif < 0) {
+      return NULL; // empty, or the next job is not published yet
+    } else {
+      pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    }
+  }
+  Job *j = c->job;
+  atomic_store_explicit(&c->seq, pos + RING_CAP, memory_order_release);
+  return j;
+}
+
+static void finish(Job *j) {
+  JobHome *h = j->home;
+  Job *top = atomic_load(&h->done);
+  do
+    j->next = top;
+  while (!atomic_compare_exchange_weak(&h->done, &top, j));
+  if (atomic_exchange(&h->woken, 1) == 0)
+    net_wake(h->r);
+}
+
+static void *worker(void *arg) {
+  (void)arg;
+  for (;;) {
+    while (sem_wait(&ready) < 0)
+      if (errno != EINTR) {
+        perror("sem_wait");
+        exit(EXIT_FAILURE);
+      }
+    // The count says a job is coming, but its push may still be finishing
+    Job *j;
+    while (!(j = ring_pop()))
+      sched_yield();
+    j->prime = prime_token(j->tok, j->len);
+    finish(j);
+  }
+  return NULL;
+}
+
+int pool_start(int workers) {
+  for (size_t i = 0; i < RING_CAP; i++)
+    atomic_init(&cells[i].seq, i);
+  if (sem_init(&ready, 0, 0) < 0)
+    return -1;
+  for (int i = 0; i < workers; i++) {
+    pthread_t t;
+    int err = pthread_create(&t, NULL, worker, NULL);
+    if (err) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      return -1;
+    }
+    pthread_detach(t);
+  }
+  return 0;
+}
+
+Job *pool_job(Conn *c, uint32_t seq, const char *tok, size_t len) {
+  if (!home) {
+    if (!(home = calloc(1, sizeof *home)))
+      return NULL;
+    home->r = c->r;
+  }
+  Job *j = malloc(sizeof *j + len);
+  if (!j)
+    return NULL;
+  *j = (Job){.home = home, .c = c, .gen = c->gen, .seq = seq, .len = len};
+  memcpy(j->tok, tok, len);
+  return j;
+}
+
+int pool_submit(Job *j) {
+  if (!ring_push(j))
+    return 0;
+  sem_post(&ready); // a futex wake only when a worker sleeps
+  return 1;
+}
+
+Job *pool_done(void) {
+  if (!home)
+    return NULL;
+  // Re-arm first: a job pushed after the exchange below wakes us again
+  atomic_store(&home->woken, 0);
+  return atomic_exchange(&home->done, NULL);
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "net.h"
+
+// Worker threads for primality tests too slow to run on a reactor thread.
+// Jobs go out through one bounded lock-free ring that every reactor pushes
+// to and every worker pops from. Finished jobs go back on a lock-free stack
+// owned by the submitting reactor, and net_wake tells it to look.
+typedef struct Job {
+  struct Job *next;      // on its reactor's finished stack
+  struct JobHome *home;  // that reactor
+  Conn *c;
+  uint32_t gen; // c->gen at submission: c may be closed and reused since
+  uint32_t seq; // which reply this is on c
+  int prime;    // prime_token's answer, once finished
+  size_t len;
+  char tok[]; // the number token, copied out of c->in
+} Job;
+
+// Start workers threads. 0 on success.
+int pool_start(int workers);
+// A job testing tok[0..len) for c. Reactor threads only; NULL if out of
+// memory.
+Job *pool_job(Conn *c, uint32_t seq, const char *tok, size_t len);
+// Hand j to a worker: 0 with j untouched when the ring is full, and the
+// caller had better test it itself.
+int pool_submit(Job *j);
+// Jobs that finished for the calling reactor thread since it last asked,
+// linked through next, in no particular order. Call from on_wake.
+Job *pool_done(void);
@@ -0,0 +1,420 @@
+#include "prime.h"
+#include "cache.h"
+#include "sieve.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned __int128 u128;
+
+// Trial division without dividing: for odd p, n is a multiple of p exactly
+// when n * p^-1 (mod 2^64) <= UINT64_MAX / p.
+typedef struct small_prime {
+  uint64_t p, inv, lim;
+} small_prime;
+
+#define SP(p, inv) {p, inv, UINT64_MAX / p}
+static const small_prime small[] = {
+    SP(3, 0xaaaaaaaaaaaaaaabu),  SP(5, 0xcccccccccccccccdu),
+    SP(7, 0x6db6db6db6db6db7u),  SP(11, 0x2e8ba2e8ba2e8ba3u),
+    SP(13, 0x4ec4ec4ec4ec4ec5u), SP(17, 0xf0f0f0f0f0f0f0f1u),
+    SP(19, 0x86bca1af286bca1bu), SP(23, 0xd37a6f4de9bd37a7u),
+    SP(29, 0x34f72c234f72c235u), SP(31, 0xef7bdef7bdef7bdfu),
+    SP(37, 0x14c1bacf914c1badu), SP(41, 0x8f9c18f9c18f9c19u),
+    SP(43, 0x82fa0be82fa0be83u), SP(47, 0x51b3bea3677d46cfu),
+    SP(53, 0x21cfb2b78c13521du), SP(59, 0xcbeea4e1a08ad8f3u),
+    SP(61, 0x4fbcda3ac10c9715u), SP(67, 0xf0b7672a07a44c6bu),
+    SP(71, 0x193d4bb7e327a977u), SP(73, 0x7e3f1f8fc7e3f1f9u),
+    SP(79, 0x9b8b577e613716afu), SP(83, 0xa3784a062b2e43dbu),
+    SP(89, 0xf47e8fd1fa3f47e9u), SP(97, 0xa3a0fd5c5f02a3a1u),
+};
+#define SMALL_LIMIT 101 // first prime not in small[]
+
+// Bases with no composite strong pseudoprime below the limit: Jaeschke's
+// three up to 4759123141, Sinclair's seven for the rest of 2^64.
+static const uint64_t bases32[] = {2, 7, 61};
+static const uint64_t bases64[] = {2,      325,     9375,      28178,
+                                   450775, 9780504, 1795265022};
+#define BASES32_LIMIT 4759123141u
+
+// Montgomery arithmetic mod odd n with R = 2^64: values are kept as aR mod
+// n, so a modular multiply is three 64x64 multiplies and no division.
+typedef struct mont {
+  uint64_t n;
+  uint64_t ninv; // n^-1 mod 2^64
+  uint64_t r2;   // R^2 mod n, to convert into Montgomery form
+  uint64_t one;  // R mod n, i.e. 1 in Montgomery form
+} mont;
+
+// t / R mod n, for t < nR. t - m*n is a multiple of R, so only the high
+// halves need subtracting; this also cannot overflow for n >= 2^63.
+static inline uint64_t redc(const mont *m, u128 t) {
+  uint64_t q = (uint64_t)t * m->ninv;
+  uint64_t hi = (uint64_t)(t >> 64), qn = (uint64_t)(((u128)q * m->n) >> 64);
+  return hi >= qn ? hi - qn : hi - qn + m->n;
+}
+
+static inline uint64_t mont_mul(const mont *m, uint64_t a, uint64_t b) {
+  return redc(m, (u128)a * b);
+}
+
+static void mont_init(mont *m, uint64_t n) {
+  uint64_t x = n; // correct to 3 bits; each Newton step doubles that
+  for (int i = 0; i < 5; i++)
+    x *= 2 - n * x;
+  m->n = n;
+  m->ninv = x;
+  m->one = (0 - n) % n;
+  m->r2 = (uint64_t)(((u128)m->one << 64) % n);
+}
+
+// One strong-probable-prime round: n - 1 = d * 2^s with d odd.
+static int sprp(const mont *m, uint64_t a, uint64_t d, int s) {
+  uint64_t minus_one = m->n - m->one;
+  uint64_t base = mont_mul(m, a, m->r2), x = m->one;
+  for (; d; d >>= 1) {
+    if (d & 1)
+      x = mont_mul(m, x, base);
+    base = mont_mul(m, base, base);
+  }
+  if (x == m->one || x == minus_one)
+    return 1;
+  while (--s > 0) {
+    x = mont_mul(m, x, x);
+    if (x == minus_one)
+      return 1;
+    if (x == m->one)
+      return 0; // a nontrivial square root of 1
+  }
+  return 0;
+}
+
+static const Sieve *sieve;
+static uint64_t sieve_limit; // 0 without one
+
+void prime_use_sieve(const Sieve *s) {
+  sieve = s;
+  sieve_limit = s ? s->limit : 0;
+}
+
+// 0 or 1 when small factors, the sieve or the size of n settle it, -1 when
+// it takes Miller-Rabin.
+static int prime_cheap(uint64_t n) {
+  if (n < sieve_limit)
+    return sieve_has(sieve, n);
+  if (n < 2)
+    return 0;
+  if (n % 2 == 0)
+    return n == 2;
+  for (size_t i = 0; i < sizeof small / sizeof small[0]; i++)
+    if (n * small[i].inv <= small[i].lim)
+      return n == small[i].p;
+  if (n < SMALL_LIMIT * SMALL_LIMIT)
+    return 1;
+  return -1;
+}
+
+static const uint64_t *bases_for(uint64_t n, size_t *nbases) {
+  if (n < BASES32_LIMIT) {
+    *nbases = sizeof bases32 / sizeof bases32[0];
+    return bases32;
+  }
+  *nbases = sizeof bases64 / sizeof bases64[0];
+  return bases64;
+}
+
+// Miller-Rabin with enough bases to be exact for n.
+static int prime_mr(uint64_t n) {
+  mont m;
+  mont_init(&m, n);
+  uint64_t d = n - 1;
+  int s = __builtin_ctzll(d);
+  d >>= s;
+  size_t nbases;
+  const uint64_t *bases = bases_for(n, &nbases);
+  for (size_t i = 0; i < nbases; i++) {
+    uint64_t a = bases[i] % n;
+    if (a == 0)
+      continue; // n divides the base: says nothing
+    if (!sprp(&m, a, d, s))
+      return 0;
+  }
+  return 1;
+}
+
+int prime_u64(uint64_t n) {
+  int r = prime_cheap(n);
+  if (r < 0 && (r = cache_get(&n, 1)) < 0) {
+    r = prime_mr(n);
+    cache_put(&n, 1, r);
+  }
+  return r;
+}
+
+// Batches run Miller-Rabin on LANES numbers in lockstep. Each lane's
+// multiplies form one long dependency chain, so interleaving lanes keeps
+// the multiplier busy where a single number would wait on its latency.
+// The exponent is walked two bits at a time from the top, so every lane
+// does the same squarings and one table multiply per step, without
+// branches on its own bits.
+#define LANES 4
+
+typedef struct lane {
+  size_t idx;  // into the batch, SIZE_MAX when idle
+  size_t base; // next base to try
+  mont m;
+  uint64_t d; // n - 1 = d * 2^s, d odd
+  int s;
+} lane;
+
+// Point l at its next round: 1 if there is one, else the number is done
+// and out has its answer.
+static int lane_next(lane *l, int *out) {
+  size_t nbases;
+  const uint64_t *bases = bases_for(l->m.n, &nbases);
+  while (l->base < nbases && bases[l->base] % l->m.n == 0)
+    l->base++; // n divides the base: says nothing
+  if (l->base == nbases) {
+    out[l->idx] = 1;
+    return 0;
+  }
+  return 1;
+}
+
+// Give l the next number that needs Miller-Rabin, or make it idle.
+static void lane_fill(lane *l, const uint64_t *n, const size_t *todo,
+                      size_t ntodo, size_t *next, int *out) {
+  while (*next < ntodo) {
+    l->idx = todo[(*next)++];
+    l->base = 0;
+    mont_init(&l->m, n[l->idx]);
+    l->d = n[l->idx] - 1;
+    l->s = __builtin_ctzll(l->d);
+    l->d >>= l->s;
+    if (lane_next(l, out))
+      return;
+  }
+  l->idx = SIZE_MAX;
+}
+
+// One strong-probable-prime round on every busy lane; lanes that finish
+// their number take the next one from todo.
+static void lanes_round(lane *ls, const uint64_t *n, const size_t *todo,
+                        size_t ntodo, size_t *next, int *out) {
+  mont m[LANES];
+  uint64_t d[LANES], x[LANES], tab[LANES][4]; // tab[i][k] = a^k
+  int busy = 0, top = 0;
+  while (ls[busy].idx == SIZE_MAX)
+    busy++;
+  for (int i = 0; i < LANES; i++) {
+    const lane *l = &ls[i];
+    if (l->idx == SIZE_MAX) { // idle: square 1 under a busy lane's modulus
+      m[i] = ls[busy].m;
+      d[i] = 0;
+      tab[i][0] = tab[i][1] = tab[i][2] = tab[i][3] = m[i].one;
+    } else {
+      size_t nbases;
+      const uint64_t *bases = bases_for(l->m.n, &nbases);
+      m[i] = l->m;
+      d[i] = l->d;
+      uint64_t a = mont_mul(&m[i], bases[l->base] % m[i].n, m[i].r2);
+      tab[i][0] = m[i].one;
+      tab[i][1] = a;
+      tab[i][2] = mont_mul(&m[i], a, a);
+      tab[i][3] = mont_mul(&m[i], tab[i][2], a);
+      int bits = 64 - __builtin_clzll(l->d);
+      if (bits > top)
+        top = bits;
+    }
+    x[i] = m[i].one;
+  }
+
+  for (int b = (top + 1) & ~1; b > 0; b -= 2) {
+    for (int i = 0; i < LANES; i++)
+      x[i] = mont_mul(&m[i], x[i], x[i]);
+    for (int i = 0; i < LANES; i++)
+      x[i] = mont_mul(&m[i], x[i], x[i]);
+    for (int i = 0; i < LANES; i++)
+      x[i] = mont_mul(&m[i], x[i], tab[i][d[i] >> (b - 2) & 3]);
+  }
+
+  for (int i = 0; i < LANES; i++) {
+    lane *l = &ls[i];
+    if (l->idx == SIZE_MAX)
+      continue;
+    uint64_t one = l->m.one, minus_one = l->m.n - one, y = x[i];
+    int pass = y == one || y == minus_one;
+    for (int k = 1; !pass && k < l->s; k++) {
+      y = mont_mul(&l->m, y, y);
+      if (y == one)
+        break; // a nontrivial square root of 1
+      pass = y == minus_one;
+    }
+    if (!pass) {
+      out[l->idx] = 0;
+      lane_fill(l, n, todo, ntodo, next, out);
+    } else {
+      l->base++;
+      if (!lane_next(l, out))
+        lane_fill(l, n, todo, ntodo, next, out);
+    }
+  }
+}
+
+// Miller-Rabin on n[todo[0..ntodo)] into out, LANES at a time.
+static void lanes_run(const uint64_t *n, const size_t *todo, size_t ntodo,
+                      int *out) {
+  lane ls[LANES];
+  size_t next = 0;
+  for (int i = 0; i < LANES; i++)
+    lane_fill(&ls[i], n, todo, ntodo, &next, out);
+  for (;;) {
+    int busy = 0;
+    for (int i = 0; i < LANES; i++)
+      busy |= ls[i].idx != SIZE_MAX;
+    if (!busy)
+      return;
+    lanes_round(ls, n, todo, ntodo, &next, out);
+  }
+}
+
+void prime_u64_batch(const uint64_t *n, size_t count, int *out) {
+  enum { CHUNK = 256 }; // numbers needing Miller-Rabin, gathered at a time
+  size_t todo[CHUNK];
+  for (size_t start = 0; start < count;) {
+    size_t ntodo = 0;
+    for (; start < count && ntodo < CHUNK; start++) {
+      int r = prime_cheap(n[start]);
+      if (r < 0 && (r = cache_get(&n[start], 1)) < 0)
+        todo[ntodo++] = start;
+      else
+        out[start] = r;
+    }
+    if (ntodo < 2) { // nothing to interleave
+      for (size_t i = 0; i < ntodo; i++)
+        out[todo[i]] = prime_mr(n[todo[i]]);
+    } else {
+      lanes_run(n, todo, ntodo, out);
+    }
+    for (size_t i = 0; i < ntodo; i++)
+      cache_put(&n[todo[i]], 1, out[todo[i]]);
+  }
+}
+
+// x = x * mul + add over *k limbs; 0 if the result needs more than max.
+static int limbs_mul_add(uint64_t *x, size_t *k, size_t max, uint64_t mul,
+                         uint64_t add) {
+  uint64_t c = add;
+  for (size_t i = 0; i < *k; i++) {
+    u128 t = (u128)x[i] * mul + c;
+    x[i] = (uint64_t)t;
+    c = (uint64_t)(t >> 64);
+  }
+  if (c) {
+    if (*k == max)
+      return 0;
+    x[(*k)++] = c;
+  }
+  return 1;
+}
+
+static int is_digit(char c) { return c >= '0' && c <= '9'; }
+
+int prime_token(const char *s, size_t len) {
+  const char *p = s, *end = s + len;
+  if (p == end || *p == '-')
+    return 0; // negative, or -0
+
+  // mantissa digits: whole[0..ilen) then frac[0..flen)
+  const char *whole = p;
+  while (p < end && is_digit(*p))
+    p++;
+  size_t ilen = (size_t)(p - whole), flen = 0;
+  const char *frac = p;
+  if (ilen == 0)
+    return 0;
+  if (p < end && *p == '.') {
+    frac = ++p;
+    while (p < end && is_digit(*p))
+      p++;
+    flen = (size_t)(p - frac);
+  }
+  int64_t exp = 0;
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    int neg = 0;
+    if (++p < end && (*p == '+' || *p == '-'))
+      neg = *p++ == '-';
+    if (p == end || !is_digit(*p))
+      return 0;
+    for (; p < end && is_digit(*p); p++)
+      if (exp < (int64_t)1 << 48) // past any token length: saturate
+        exp = exp * 10 + (*p - '0');
+    if (neg)
+      exp = -exp;
+  }
+  if (p != end)
+    return 0;
+
+#define DIGIT(i) ((i) < ilen ? whole[i] : frac[(i) - ilen])
+  size_t first = 0, last = ilen + flen;
+  while (first < last && DIGIT(first) == '0')
+    first++;
+  if (first == last)
+    return 0;
+  while (DIGIT(last - 1) == '0')
+    last--;
+  // The value is digits [first, last) times 10^e. e < 0 leaves a
+  // fraction, as the last digit is not 0; e > 0 makes a multiple of 10.
+  if (exp + (int64_t)ilen - (int64_t)last != 0)
+    return 0;
+  // Too large to test, unless the last digit gives a factor away
+  char d = DIGIT(last - 1);
+  int untested = (d - '0') % 2 && d != '5' ? -1 : 0;
+  if (last - first > PRIME_MAX_BITS / 3 + 1)
+    return untested; // past the limb buffer anyway: skip the conversion
+
+  uint64_t n[PRIME_MAX_BITS / 64];
+  size_t k = 0;
+  while (first < last) {
+    uint64_t chunk = 0, mul = 1;
+    for (int i = 0; i < 19 && first < last; i++, first++) {
+      chunk = chunk * 10 + (uint64_t)(DIGIT(first) - '0');
+      mul *= 10;
+    }
+    if (!limbs_mul_add(n, &k, PRIME_MAX_BITS / 64, mul, chunk))
+      return untested;
+  }
+#undef DIGIT
+  return prime_bn(n, k);
+}
+
+void prime_token_batch(const char *const *s, const size_t *len, size_t count,
+                       int *out) {
+  enum { CHUNK = 256 };
+  uint64_t n[CHUNK];
+  size_t at[CHUNK];
+  int r[CHUNK];
+  for (size_t start = 0; start < count;) {
+    size_t k = 0;
+    for (; start < count && k < CHUNK; start++) {
+      // Plain digits that fit 64 bits; anything else the long way
+      const char *p = s[start];
+      size_t i = 0;
+      uint64_t v = 0;
+      int fits = len[start] > 0;
+      for (; fits && i < len[start]; i++) {
+        uint64_t d = (uint64_t)(p[i] - '0');
+        fits = d < 10 && !__builtin_mul_overflow(v, 10, &v) &&
+               !__builtin_add_overflow(v, d, &v);
+      }
+      if (fits) {
+        n[k] = v;
+        at[k++] = start;
+      } else {
+        out[start] = prime_token(p, len[start]);
+      }
+    }
+    prime_u64_batch(n, k, r);
+    for (size_t i = 0; i < k; i++)
+      out[at[i]] = r[i];
+  }
+}
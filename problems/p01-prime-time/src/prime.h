@@ -0,0 +1,41 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest number prime_bn and prime_token will test. Past it they answer
+// -1: BPSW grows with the cube of the length, and a client could otherwise
+// hold a thread for seconds per line.
+#define PRIME_MAX_BITS 4096
+
+// 1 if n is prime, else 0. Deterministic over the whole uint64_t range and
+// cheap for any input: a few multiplications to rule out small factors,
+// then at most seven Miller-Rabin rounds.
+int prime_u64(uint64_t n);
+// prime_u64 of n[0..count) into out. Numbers that need Miller-Rabin are
+// tested several at a time with their multiplies interleaved, which pays
+// from a handful of such numbers up.
+void prime_u64_batch(const uint64_t *n, size_t count, int *out);
+
+// Answer prime_u64 below s->limit from the sieve s, which must outlive the
+// calls; NULL goes back to testing every number.
+struct Sieve;
+void prime_use_sieve(const struct Sieve *s);
+
+// The same past 2^64, by Baillie-PSW: a base-2 Miller-Rabin round and a
+// strong Lucas test. No composite is known to pass it.
+int prime_u128(unsigned __int128 n);
+// n is k little-endian 64-bit limbs. Even numbers past PRIME_MAX_BITS are
+// answered 0, odd ones -1 without testing.
+int prime_bn(const uint64_t *n, size_t k);
+
+// 1 if the JSON number token s[0..len) is a prime integer, else 0. The
+// text is read exactly rather than through a double: "7.0" and "70e-1" are
+// 7, "7.5" and "7e1" are not prime, and every digit of a long integer
+// counts. Takes what cJSON takes, so leading zeros and a bare trailing '.'
+// are fine. Integers past PRIME_MAX_BITS are 0 when their last digit shows
+// a factor of 2 or 5, else -1: not tested.
+int prime_token(const char *s, size_t len);
+// prime_token of s[i][0..len[i]) for i < count into out, with the plain
+// integers below 2^64 going through prime_u64_batch.
+void prime_token_batch(const char *const *s, const size_t *len, size_t count,
+                       int *out);
@@ -0,0 +1,440 @@
+#include "request.h"
+#include "cJSON.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFER (-1)
+#define MAX_DEPTH 16 // deeper nesting in ignored members goes to cJSON
+
+// Like cJSON, treats every control byte as whitespace.
+static const char *skip_ws(const char *p, const char *end) {
+  while (p < end && (unsigned char)*p <= ' ')
+    p++;
+  return p;
+}
+
+static int is_digit(char c) { return c >= '0' && c <= '9'; }
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = (char)(c | 0x20);
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// --- fast path ---
+
+// The string at p, decoded into buf up to its first NUL, where cJSON's C
+// string ends; buf is left empty if that does not fit in cap - 1 bytes.
+// Returns the end of the string, or NULL to defer: on malformed escapes and
+// on the \u forms cJSON reads oddly (bad hex digits, surrogates).
+static const char *string(const char *p, const char *end, char *buf,
+                          size_t cap) {
+  size_t n = 0;
+  int cut = 0;
+  for (p++;;) {
+    if (p == end)
+      return NULL;
+    unsigned c = (unsigned char)*p++;
+    if (c == '"')
+      break;
+    if (c == '\\') {
+      if (p == end)
+        return NULL;
+      switch (c = (unsigned char)*p++) {
+      case '"':
+      case '\\':
+      case '/':
+        break;
+      case 'b':
+        c = '\b';
+        break;
+      case 'f':
+        c = '\f';
+        break;
+      case 'n':
+        c = '\n';
+        break;
+      case 'r':
+        c = '\r';
+        break;
+      case 't':
+        c = '\t';
+        break;
+      case 'u':
+        if (end - p < 4)
+          return NULL;
+        c = 0;
+        for (int i = 0; i < 4; i++) {
+          int h = hex_digit(*p++);
+          if (h < 0)
+            return NULL;
+          c = c << 4 | (unsigned)h;
+        }
+        if (c >= 0xd800 && c <= 0xdfff)
+          return NULL;
+        if (c >= 0x80)
+          c = 0xff; // first byte of its UTF-8 form is not ASCII either
+        break;
+      default:
+        return NULL;
+      }
+    }
+    if (c == 0)
+      cut = 1;
+    if (!cut && buf && n < cap)
+      buf[n++] = (char)c;
+  }
+  if (buf)
+    buf[n < cap ? n : 0] = '\0';
+  return p;
+}
+
+// A number as cJSON reads it: the run of [0-9+-.eE] bytes, which strtod
+// must consume whole for the line to parse. Forms strtod takes but JSON
+// does not, like "-.5", are deferred.
+static const char *number(const char *p, const char *end) {
+  if (p < end && *p == '-')
+    p++;
+  if (p == end || !is_digit(*p))
+    return NULL;
+  while (p < end && is_digit(*p))
+    p++;
+  if (p < end && *p == '.')
+    for (p++; p < end && is_digit(*p); p++)
+      ;
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    if (++p < end && (*p == '+' || *p == '-'))
+      p++;
+    if (p == end || !is_digit(*p))
+      return NULL;
+    while (p < end && is_digit(*p))
+      p++;
+  }
+  if (p < end && (is_digit(*p) || *p == '.' || *p == '+' || *p == '-' ||
+                  *p == 'e' || *p == 'E'))
+    return NULL;
+  return p;
+}
+
+static const char *value(const char *p, const char *end, int depth);
+
+// Members of an ignored object, or elements of an array: p is past the
+// opening bracket.
+static const char *members(const char *p, const char *end, int depth,
+                           char close) {
+  if (depth > MAX_DEPTH)
+    return NULL;
+  p = skip_ws(p, end);
+  if (p < end && *p == close)
+    return p + 1;
+  for (;;) {
+    if (close == '}') {
+      if (p == end || *p != '"' || !(p = string(p, end, NULL, 0)))
+        return NULL;
+      p = skip_ws(p, end);
+      if (p == end || *p != ':')
+        return NULL;
+      p = skip_ws(p + 1, end);
+    }
+    if (!(p = value(p, end, depth + 1)))
+      return NULL;
+    p = skip_ws(p, end);
+    if (p < end && *p == close)
+      return p + 1;
+    if (p == end || *p != ',')
+      return NULL;
+    p = skip_ws(p + 1, end);
+  }
+}
+
+static const char *value(const char *p, const char *end, int depth) {
+  if (p == end)
+    return NULL;
+  switch (*p) {
+  case '"':
+    return string(p, end, NULL, 0);
+  case '{':
+    return members(p + 1, end, depth, '}');
+  case '[':
+    return members(p + 1, end, depth, ']');
+  case 't':
+    return end - p >= 4 && memcmp(p, "true", 4) == 0 ? p + 4 : NULL;
+  case 'f':
+    return end - p >= 5 && memcmp(p, "false", 5) == 0 ? p + 5 : NULL;
+  case 'n':
+    return end - p >= 4 && memcmp(p, "null", 4) == 0 ? p + 4 : NULL;
+  default:
+    return number(p, end);
+  }
+}
+
+int req_parse_fast(const char *line, size_t len, const char **num,
+                   size_t *num_len) {
+  const char *p = line, *end = line + len;
+  if (len >= 3 && memcmp(p, "\xef\xbb\xbf", 3) == 0)
+    return DEFER; // a UTF-8 BOM, which cJSON skips under conditions
+  p = skip_ws(p, end);
+  if (p == end || *p != '{')
+    return DEFER; // not an object: cJSON may still call it valid JSON
+
+  int seen_method = 0, seen_number = 0, method_ok = 0;
+  const char *tok = NULL;
+  p = skip_ws(p + 1, end);
+  if (p < end && *p == '}')
+    return 0; // {}
+  for (;;) {
+    char key[8], val[8]; // room for "isPrime" and a NUL
+    if (p == end || *p != '"' || !(p = string(p, end, key, sizeof key)))
+      return DEFER;
+    p = skip_ws(p, end);
+    if (p == end || *p != ':')
+      return DEFER;
+    p = skip_ws(p + 1, end);
+
+    const char *v = p;
+    if (!seen_method && strcmp(key, "method") == 0) {
+      seen_method = 1;
+      if (p < end && *p == '"') {
+        p = string(p, end, val, sizeof val);
+        method_ok = p && strcmp(val, "isPrime") == 0;
+      } else {
+        p = value(p, end, 2);
+      }
+    } else if (!seen_number && strcmp(key, "number") == 0) {
+      seen_number = 1;
+      if (p < end && (*p == '-' || is_digit(*p))) {
+        if ((p = number(p, end))) {
+          tok = v;
+          *num_len = (size_t)(p - v);
+        }
+      } else {
+        p = value(p, end, 2);
+      }
+    } else {
+      p = value(p, end, 2);
+    }
+    if (!p)
+      return DEFER;
+
+    p = skip_ws(p, end);
+    if (p < end && *p == '}')
+      break; // cJSON ignores whatever follows
+    if (p == end || *p != ',')
+      return DEFER;
+    p = skip_ws(p + 1, end);
+  }
+  if (!method_ok || !tok)
+    return 0;
+  *num = tok;
+  return 1;
+}
+
+// --- cJSON ---
+
+// Does the raw key text k[0..len) spell name once decoded as cJSON does?
+static int key_is(const char *k, size_t len, const char *name) {
+  const char *end = k + len;
+  while (k < end) {
+    int c = (unsigned char)*k++;
+    if (c == '\\' && k < end) {
+      switch (c = *k++) {
+      case 'b':
+        c = '\b';
+        break;
+      case 'f':
+        c = '\f';
+        break;
+      case 'n':
+        c = '\n';
+        break;
+      case 'r':
+        c = '\r';
+        break;
+      case 't':
+        c = '\t';
+        break;
+      case 'u':
+        if (end - k < 4)
+          return 0;
+        c = 0;
+        for (int i = 0; i < 4; i++) {
+          int h = hex_digit(*k++);
+          if (h < 0) { // cJSON's parse_hex4 makes the whole escape 0
+            c = 0;
+            break;
+          }
+          c = c << 4 | h;
+        }
+        break;
+      }
+    }
+    if (c == 0)
+      break; // cJSON keys are C strings: \u0000 ends them
+    if (*name == '\0' || c != (unsigned char)*name++)
+      return 0;
+  }
+  return *name == '\0';
+}
+
+// p is at an opening quote; returns just past the closing one.
+static const char *skip_string(const char *p, const char *end) {
+  for (p++; p < end && *p != '"'; p++)
+    if (*p == '\\')
+      p++;
+  return p + 1;
+}
+
+// Any value cJSON accepted, without checking it again.
+static const char *skip_value(const char *p, const char *end) {
+  if (*p == '"')
+    return skip_string(p, end);
+  if (*p == '{' || *p == '[') {
+    int depth = 0;
+    while (p < end) {
+      if (*p == '"') {
+        p = skip_string(p, end);
+        continue;
+      }
+      if (*p == '{' || *p == '[')
+        depth++;
+      else if ((*p == '}' || *p == ']') && --depth == 0)
+        return p + 1;
+      p++;
+    }
+    return p;
+  }
+  while (p < end && (unsigned char)*p > ' ' && *p != ',' && *p != '}' &&
+         *p != ']')
+    p++;
+  return p;
+}
+
+// Raw text of the first top-level member called name in the object js,
+// which cJSON has already accepted: number tokens are kept exact this way
+// instead of going through cJSON's double.
+static const char *member_raw(const char *js, size_t len, const char *name,
+                              size_t *raw_len) {
+  const char *p = js, *end = js + len;
+  if (len >= 3 && memcmp(p, "\xef\xbb\xbf", 3) == 0)
+    p += 3; // UTF-8 BOM, as cJSON skips it
+  p = skip_ws(p, end);
+  if (p == end || *p != '{')
+    return NULL;
+  for (p = skip_ws(p + 1, end); p < end && *p == '"';) {
+    const char *key = p + 1;
+    p = skip_string(p, end);
+    size_t key_len = (size_t)(p - 1 - key);
+    p = skip_ws(p, end);
+    if (p == end || *p != ':')
+      return NULL;
+    p = skip_ws(p + 1, end);
+    const char *val = p;
+    p = skip_value(p, end);
+    if (key_is(key, key_len, name)) {
+      *raw_len = (size_t)(p - val);
+      return val;
+    }
+    p = skip_ws(p, end);
+    if (p == end || *p != ',')
+      return NULL;
+    p = skip_ws(p + 1, end);
+  }
+  return NULL;
+}
+
+// cJSON mallocs every node, key and string. While req_parse_cjson runs on
+// a thread they come off that thread's bump arena instead, and the whole
+// tree goes at once when the next parse starts over at the bottom. What
+// does not fit is malloc'd as before, and the arena grows to fit it next
+// time, so a steady stream of lines stops allocating. Outside a parse the
+// hooks are plain malloc and free, for any other cJSON user.
+#define ARENA_MIN 4096
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+typedef struct arena {
+  char *base;
+  size_t used, cap;
+  size_t spilled; // bytes malloc'd this parse because they did not fit
+  int on;         // 0/1 a parse is under way
+} arena;
+
+static _Thread_local arena ar;
+static pthread_once_t hooks_once = PTHREAD_ONCE_INIT;
+static pthread_key_t arena_key; // frees a thread's arena when it exits
+
+static void *arena_alloc(size_t n) {
+  if (ar.on) {
+    size_t at = (ar.used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (at <= ar.cap && n <= ar.cap - at) {
+      ar.used = at + n;
+      return ar.base + at;
+    }
+    ar.spilled += n + ARENA_ALIGN;
+  }
+  return malloc(n);
+}
+
+static void arena_free(void *p) {
+  if ((uintptr_t)p - (uintptr_t)ar.base < ar.cap)
+    return; // the next parse reuses it
+  free(p);
+}
+
+// Room for everything the last parse wanted, once its tree is gone.
+static void arena_grow(void) {
+  size_t cap = ar.cap ? ar.cap : ARENA_MIN;
+  while (cap < ar.used + ar.spilled)
+    cap *= 2;
+  char *base = malloc(cap);
+  if (base) {
+    free(ar.base);
+    ar.base = base;
+    ar.cap = cap;
+    pthread_setspecific(arena_key, base);
+  }
+}
+
+static void hooks_install(void) {
+  if (pthread_key_create(&arena_key, free) != 0) {
+    perror("pthread_key_create");
+    exit(EXIT_FAILURE);
+  }
+  cJSON_InitHooks(&(cJSON_Hooks){.malloc_fn = arena_alloc,
+                                 .free_fn = arena_free});
+}
+
+int req_parse_cjson(const char *line, size_t len, const char **num,
+                    size_t *num_len) {
+  pthread_once(&hooks_once, hooks_install);
+  ar.used = ar.spilled = 0;
+  ar.on = 1;
+  cJSON *msg = cJSON_ParseWithLength(line, len);
+  ar.on = 0;
+  if (!msg) { // cJSON already freed what it had built
+    if (ar.spilled)
+      arena_grow();
+    return 0;
+  }
+  const cJSON *method = cJSON_GetObjectItemCaseSensitive(msg, "method");
+  const cJSON *number = cJSON_GetObjectItemCaseSensitive(msg, "number");
+  int ok = cJSON_IsString(method) && method->valuestring &&
+           strcmp(method->valuestring, "isPrime") == 0 &&
+           cJSON_IsNumber(number) &&
+           (*num = member_raw(line, len, "number", num_len)) != NULL;
+  if (ar.spilled) { // free the malloc'd part node by node
+    cJSON_Delete(msg);
+    arena_grow();
+  }
+  return ok;
+}
+
+int req_parse(const char *line, size_t len, const char **num,
+              size_t *num_len) {
+  int r = req_parse_fast(line, len, num, num_len);
+  return r != DEFER ? r : req_parse_cjson(line, len, num, num_len);
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stddef.h>
+
+// A p01 request line is a JSON object whose "method" is the string
+// "isPrime" and whose "number" is a number. Other members are ignored and
+// the first of duplicate keys counts, as with cJSON_GetObjectItemCaseSensitive.
+
+// 1 for an isPrime request, with the raw text of its number in
+// num[0..*num_len); 0 for anything else. Scans the line once without
+// allocating and defers to cJSON only for malformed or unusual input, so
+// the answer is always the one cJSON would give.
+int req_parse(const char *line, size_t len, const char **num, size_t *num_len);
+
+// The two halves of req_parse. req_parse_fast returns -1 where it defers.
+int req_parse_fast(const char *line, size_t len, const char **num,
+                   size_t *num_len);
+int req_parse_cjson(const char *line, size_t len, const char **num,
+                    size_t *num_len);
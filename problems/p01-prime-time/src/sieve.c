@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+
+#include "sieve.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SIEVE_MAGIC "sieve01"
+#define SIEVE_ORDER 0x01020304u
+#define SIEVE_HDR 64 // header room: the bits start on a cache line
+
+typedef struct sieve_hdr {
+  char magic[8];
+  uint32_t order; // SIEVE_ORDER as written: same byte order
+  uint32_t pad;
+  uint64_t limit;
+} sieve_hdr;
+
+// Segments of 256 KiB of bits (4M numbers) stay in L2 while every base
+// prime crosses them off, and start on word boundaries so workers never
+// share a word.
+#define SEG_WORDS (32 * 1024)
+
+typedef struct sieve_job {
+  uint64_t *bits;
+  size_t words;
+  const uint32_t *primes; // odd primes up to sqrt(limit), ascending
+  size_t nprimes;
+  atomic_size_t next; // next segment to take
+} sieve_job;
+
+static void sieve_segment(const sieve_job *j, size_t seg) {
+  size_t w0 = seg * SEG_WORDS, w1 = w0 + SEG_WORDS;
+  if (w1 > j->words)
+    w1 = j->words;
+  memset(j->bits + w0, 0xff, (w1 - w0) * sizeof *j->bits);
+  uint64_t lo = (uint64_t)w0 * 64, hi = (uint64_t)w1 * 64; // bit indexes
+  for (size_t k = 0; k < j->nprimes; k++) {
+    uint64_t p = j->primes[k], i = p * p >> 1;
+    if (i >= hi)
+      break;
+    if (i < lo) { // first odd multiple of p in the segment
+      uint64_t m = (2 * lo + 1 + p - 1) / p;
+      i = (m | 1) * p >> 1;
+    }
+    for (; i < hi; i += p) // odd multiples are p apart in bit indexes
+      j->bits[i >> 6] &= ~((uint64_t)1 << (i & 63));
+  }
+}
+
+static void *sieve_worker(void *arg) {
+  sieve_job *j = arg;
+  size_t nseg = (j->words + SEG_WORDS - 1) / SEG_WORDS, seg;
+  while ((seg = atomic_fetch_add(&j->next, 1)) < nseg)
+    sieve_segment(j, seg);
+  return NULL;
+}
+
+// Odd primes p with p * p < limit, by a plain sieve.
+static uint32_t *base_primes(uint64_t limit, size_t *n) {
+  uint64_t r = 1;
+  while ((r + 1) * (r + 1) < limit)
+    r++;
+  uint8_t *comp = calloc(r + 1, 1);
+  uint32_t *primes = malloc((r / 2 + 1) * sizeof *primes);
+  if (!comp || !primes) {
+    free(comp);
+    free(primes);
+    return NULL;
+  }
+  *n = 0;
+  for (uint64_t p = 3; p <= r; p += 2) {
+    if (comp[p])
+      continue;
+    primes[(*n)++] = (uint32_t)p;
+    for (uint64_t q = p * p; q <= r; q += 2 * p)
+      comp[q] = 1;
+  }
+  free(comp);
+  return primes;
+}
+
+int sieve_build(Sieve *s, uint64_t limit, int threads) {
+  if (limit == 0 || limit % 128 != 0 || limit >> 40)
+    return -1;
+  size_t words = (size_t)(limit / 128);
+  size_t map_len = SIEVE_HDR + words * sizeof(uint64_t);
+  void *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  sieve_job j = {.bits = (uint64_t *)((char *)map + SIEVE_HDR),
+                 .words = words};
+  uint32_t *primes = base_primes(limit, &j.nprimes);
+  if (!primes) {
+    munmap(map, map_len);
+    return -1;
+  }
+  j.primes = primes;
+  atomic_init(&j.next, 0);
+
+  if (threads < 1)
+    threads = 1;
+  pthread_t *tid = calloc((size_t)threads, sizeof *tid);
+  int started = 0;
+  if (tid)
+    while (started < threads - 1 &&
+           pthread_create(&tid[started], NULL, sieve_worker, &j) == 0)
+      started++;
+  sieve_worker(&j); // this thread works too, alone if none started
+  for (int i = 0; i < started; i++)
+    pthread_join(tid[i], NULL);
+  free(tid);
+  free(primes);
+  j.bits[0] &= ~(uint64_t)1; // 1 is not prime
+
+  sieve_hdr h = {.magic = SIEVE_MAGIC, .order = SIEVE_ORDER, .limit = limit};
+  memcpy(map, &h, sizeof h);
+  *s = (Sieve){.limit = limit, .bits = j.bits, .map = map, .map_len = map_len};
+  return 0;
+}
+
+int sieve_save(const Sieve *s, const char *path) {
+  // Write next to path and rename over it, so readers never see half a file
+  char tmp[4096];
+  int len = snprintf(tmp, sizeof tmp, "%s.tmp", path);
+  if (len < 0 || (size_t)len >= sizeof tmp)
+    return -1;
+  FILE *f = fopen(tmp, "wb");
+  if (!f)
+    return -1;
+  int rc = fwrite(s->map, 1, s->map_len, f) == s->map_len ? 0 : -1;
+  if (rc == 0 && (fflush(f) != 0 || fsync(fileno(f)) < 0))
+    rc = -1;
+  if (fclose(f) != 0)
+    rc = -1;
+  if (rc == 0 && rename(tmp, path) < 0)
+    rc = -1;
+  if (rc < 0)
+    unlink(tmp);
+  return rc;
+}
+
+int sieve_map(Sieve *s, uint64_t limit, const char *path) {
+  if (limit == 0 || limit % 128 != 0 || limit >> 40)
+    return -1;
+  size_t map_len = SIEVE_HDR + (size_t)(limit / 128) * sizeof(uint64_t);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (uint64_t)st.st_size != map_len) {
+    close(fd);
+    return -1;
+  }
+  // Shared and populated up front: lookups never fault, and every process
+  // mapping the file uses the same page cache pages.
+  void *map =
+      mmap(NULL, map_len, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+  const sieve_hdr *h = map;
+  if (memcmp(h->magic, SIEVE_MAGIC, sizeof h->magic) != 0 ||
+      h->order != SIEVE_ORDER || h->limit != limit) {
+    munmap(map, map_len);
+    return -1;
+  }
+  *s = (Sieve){.limit = limit,
+               .bits = (const uint64_t *)((char *)map + SIEVE_HDR),
+               .map = map,
+               .map_len = map_len};
+  return 0;
+}
+
+void sieve_free(Sieve *s) {
+  if (s->map)
+    munmap(s->map, s->map_len);
+  *s = (Sieve){0};
+}
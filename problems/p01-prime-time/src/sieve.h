@@ -0,0 +1,27 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Primality of every number below a bound, one bit per odd number: 2^27
+// takes 8 MiB, 2^32 takes 256 MiB. Built by a segmented sieve spread over
+// threads, or mapped read-only from a file a previous run saved, so several
+// servers on one machine share the page cache copy.
+typedef struct Sieve {
+  uint64_t limit;       // numbers below this are answered from bits
+  const uint64_t *bits; // bit i: 2i + 1 is prime
+  void *map;            // header and bits, as saved
+  size_t map_len;
+} Sieve;
+
+// Sieve the numbers below limit, a multiple of 128, with threads workers.
+int sieve_build(Sieve *s, uint64_t limit, int threads);
+// Write s to path, atomically replacing any file there.
+int sieve_save(const Sieve *s, const char *path);
+// Map a file sieve_save wrote for the same limit; -1 if there is none.
+int sieve_map(Sieve *s, uint64_t limit, const char *path);
+void sieve_free(Sieve *s);
+
+// n < s->limit.
+static inline int sieve_has(const Sieve *s, uint64_t n) {
+  return n == 2 || (n & 1 && s->bits[n >> 7] >> (n >> 1 & 63) & 1);
+}
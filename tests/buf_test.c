@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "acutest.h"
+#include "buf.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef TEST_REQUIRE_
+#define TEST_REQUIRE_(cond, ...)                                               \
+  do {                                                                         \
+    TEST_CHECK_(cond, __VA_ARGS__);                                            \
+    if (!(cond))                                                               \
+      return;                                                                  \
+  } while (0)
+#endif
+
+static void t_append_consume(void) {
+  Buf b = {0};
+  int rc = buf_append(&b, "hello world", 11);
+  TEST_REQUIRE_(rc == 0, "append rc=%d", rc);
+  TEST_CHECK_(b.len == 11, "len=%zu", b.len);
+  TEST_CHECK_(memcmp(b.data, "hello world", 11) == 0, "content");
+
+  buf_consume(&b, 6);
+  TEST_CHECK_(b.len == 5, "len after consume=%zu", b.len);
+  TEST_CHECK_(memcmp(b.data, "world", 5) == 0, "content after consume");
+
+  buf_consume(&b, 100); // over-consume empties
+  TEST_CHECK_(b.len == 0, "empty");
+  buf_free(&b);
+  TEST_CHECK_(b.data == NULL && b.cap == 0, "freed");
+}
+
+// Frames that straddle the end of the ring must still read contiguously.
+static void t_wrap_is_contiguous(void) {
+  Buf b = {0};
+  uint8_t frame[9];
+  uint32_t next_in = 0, next_out = 0;
+
+  int rc = buf_reserve(&b, 1);
+  TEST_REQUIRE_(rc == 0, "reserve rc=%d", rc);
+  size_t cap = b.cap;
+
+  for (int round = 0; round < 10000; round++) {
+    // Keep the ring mostly full so writes keep wrapping
+    while (b.cap - b.len >= sizeof frame) {
+      memset(frame, (int)(next_in & 0xff), sizeof frame);
+      memcpy(frame, &next_in, sizeof next_in);
+      next_in++;
+      rc = buf_append(&b, frame, sizeof frame);
+      TEST_REQUIRE_(rc == 0, "append rc=%d", rc);
+    }
+    for (int i = 0; i < 7 && b.len >= sizeof frame; i++) {
+      uint32_t got;
+      memcpy(&got, b.data, sizeof got);
+      TEST_REQUIRE_(got == next_out, "frame %u read as %u", next_out, got);
+      TEST_REQUIRE_(b.data[8] == (uint8_t)(next_out & 0xff), "frame tail %u",
+                    next_out);
+      next_out++;
+      buf_consume(&b, sizeof frame);
+    }
+  }
+  TEST_CHECK_(b.cap == cap, "steady state must not grow: %zu -> %zu", cap,
+              b.cap);
+  buf_free(&b);
+}
+
+static void t_grow_keeps_content(void) {
+  Buf b = {0};
+  const size_t N = 3u << 20;
+  uint8_t *src = malloc(N);
+  TEST_REQUIRE_(src, "malloc");
+  for (size_t i = 0; i < N; i++)
+    src[i] = (uint8_t)(i * 7 + 3);
+
+  // Offset the read cursor first so growth happens from a wrapped state
+  int rc = buf_append(&b, src, 3000);
+  TEST_REQUIRE_(rc == 0, "append head rc=%d", rc);
+  buf_consume(&b, 2500);
+  rc = buf_append(&b, src + 3000, N - 3000);
+  TEST_REQUIRE_(rc == 0, "append rest rc=%d", rc);
+  TEST_CHECK_(b.len == N - 2500, "len=%zu", b.len);
+  TEST_CHECK_(memcmp(b.data, src + 2500, b.len) == 0, "content after grow");
+
+  free(src);
+  buf_free(&b);
+}
+
+// Writing straight into the spare room must behave like buf_append.
+static void t_commit_into_tail(void) {
+  Buf b = {0};
+  int rc = buf_append(&b, "abc", 3);
+  TEST_REQUIRE_(rc == 0, "append rc=%d", rc);
+  buf_consume(&b, 2);
+  rc = buf_reserve(&b, 5);
+  TEST_REQUIRE_(rc == 0, "reserve rc=%d", rc);
+  TEST_REQUIRE_(buf_spare(&b) >= 5, "spare=%zu", buf_spare(&b));
+  memcpy(buf_tail(&b), "defgh", 5);
+  buf_commit(&b, 5);
+  TEST_CHECK_(b.len == 6, "len=%zu", b.len);
+  TEST_CHECK_(memcmp(b.data, "cdefgh", 6) == 0, "content");
+  buf_free(&b);
+}
+
+static void t_drain_releases(void) {
+  Buf b = {0};
+  int rc = buf_append(&b, "ping\n", 5);
+  TEST_REQUIRE_(rc == 0, "append rc=%d", rc);
+  uint8_t *first = b.base;
+  buf_consume(&b, 5);
+  TEST_CHECK_(b.base == NULL && b.cap == 0, "drained buffer holds %zu bytes",
+              b.cap);
+
+  // The next same-sized buffer comes back out of the pool
+  rc = buf_append(&b, "pong\n", 5);
+  TEST_REQUIRE_(rc == 0, "append rc=%d", rc);
+  if (b.mirror)
+    TEST_CHECK_(b.base == first, "ring reused from the pool");
+  TEST_CHECK_(memcmp(b.data, "pong\n", 5) == 0, "content");
+  buf_free(&b);
+}
+
+static void t_shrink_after_burst(void) {
+  Buf b = {0};
+  const size_t N = 12u << 20;
+  uint8_t *src = malloc(N);
+  TEST_REQUIRE_(src, "malloc");
+  for (size_t i = 0; i < N; i++)
+    src[i] = (uint8_t)(i * 13 + 1);
+
+  int rc = buf_append(&b, src, N);
+  TEST_REQUIRE_(rc == 0, "append rc=%d", rc);
+  size_t big = b.cap;
+  buf_consume(&b, N - 1000);
+  TEST_CHECK_(b.cap < big && b.cap <= (4u << 20), "cap %zu -> %zu", big,
+              b.cap);
+  TEST_CHECK_(b.len == 1000, "len=%zu", b.len);
+  TEST_CHECK_(memcmp(b.data, src + N - 1000, 1000) == 0, "content kept");
+
+  free(src);
+  buf_free(&b);
+}
+
+TEST_LIST = {{"append_consume", t_append_consume},
+             {"wrap_is_contiguous", t_wrap_is_contiguous},
+             {"grow_keeps_content", t_grow_keeps_content},
+             {"commit_into_tail", t_commit_into_tail},
+             {"drain_releases", t_drain_releases},
+             {"shrink_after_burst", t_shrink_after_burst},
+             {NULL, NULL}};
@@ -0,0 +1,112 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "acutest.h"
+#include "cache.h"
+#include "prime.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Tables are per thread and made on first use, so each test runs on a
+// fresh thread to start from an empty one.
+static void on_thread(void *(*fn)(void *)) {
+  pthread_t t;
+  TEST_ASSERT(pthread_create(&t, NULL, fn, NULL) == 0);
+  pthread_join(t, NULL);
+}
+
+static void *get_put(void *arg) {
+  (void)arg;
+  uint64_t a = 1000000007, b[2] = {5, 1}, c[4] = {1, 2, 3, 4};
+  TEST_CHECK(cache_get(&a, 1) < 0);
+  cache_put(&a, 1, 1);
+  cache_put(b, 2, 0);
+  cache_put(c, 4, 1);
+  TEST_CHECK(cache_get(&a, 1) == 1);
+  TEST_CHECK(cache_get(b, 2) == 0);
+  TEST_CHECK(cache_get(c, 4) == 1);
+  // Same low limbs, other lengths and values: all different numbers
+  TEST_CHECK(cache_get(b, 1) < 0);
+  TEST_CHECK(cache_get(c, 3) < 0);
+  c[3] = 5;
+  TEST_CHECK(cache_get(c, 4) < 0);
+  return NULL;
+}
+
+static void t_get_put(void) {
+  cache_config(1 << 20);
+  on_thread(get_put);
+  cache_config(0);
+}
+
+// Far more numbers than fit: the table stays within its bytes, and CLOCK
+// keeps one that is looked up between every insert.
+static void *bounded(void *arg) {
+  (void)arg;
+  uint64_t hot[8] = {~0ull, 1, 2, 3, 4, 5, 6, 7};
+  cache_put(hot, 8, 1);
+  uint64_t n[8] = {0};
+  for (uint64_t i = 1; i <= 200000; i++) {
+    n[0] = i;
+    n[7] = i % 3 + 1; // a third of them past 128 bits
+    cache_put(n, i % 2 ? 8 : 1, (int)(i & 1));
+    TEST_CHECK_(cache_get(hot, 8) == 1, "hot entry gone after %llu",
+                (unsigned long long)i);
+    if (cache_get(hot, 8) != 1)
+      break;
+  }
+  CacheStats st; // this thread's table is the only one alive
+  cache_stats(&st);
+  TEST_CHECK_(st.threads == 1 && st.bytes <= 64 << 10, "%d tables, %zu bytes",
+              st.threads, st.bytes);
+  return NULL;
+}
+
+static void t_bounded(void) {
+  CacheStats before, after;
+  cache_stats(&before);
+  cache_config(64 << 10);
+  on_thread(bounded);
+  cache_config(0);
+  cache_stats(&after);
+  TEST_CHECK(after.evictions > before.evictions);
+  // Gone with its thread, counts kept
+  TEST_CHECK_(after.threads == 0 && after.bytes == 0, "%d tables, %zu bytes",
+              after.threads, after.bytes);
+}
+
+static void *repeat_primes(void *arg) {
+  (void)arg;
+  static const uint64_t m127[2] = {UINT64_MAX, UINT64_MAX >> 1}; // 2^127-1
+  for (int i = 0; i < 3; i++) {
+    TEST_CHECK(prime_u64(18446744073709551557u) == 1);
+    TEST_CHECK(prime_u64(3825123056546413051u) == 0); // strong pseudoprime
+    TEST_CHECK(prime_bn(m127, 2) == 1);
+  }
+  uint64_t n[4] = {18446744073709551557u, 3825123056546413051u, 7, 1};
+  int out[4];
+  prime_u64_batch(n, 4, out);
+  TEST_CHECK(out[0] == 1 && out[1] == 0 && out[2] == 1 && out[3] == 0);
+  return NULL;
+}
+
+// The prime_* entry points answer repeats from the table, and the same.
+static void t_prime_hits(void) {
+  CacheStats before, after;
+  cache_stats(&before);
+  cache_config(1 << 20);
+  on_thread(repeat_primes);
+  cache_config(0);
+  cache_stats(&after);
+  // 3 numbers past trial division, missed once each, then 6 + 2 hits
+  TEST_CHECK_(after.hits - before.hits == 8, "%llu hits",
+              (unsigned long long)(after.hits - before.hits));
+  TEST_CHECK_(after.misses - before.misses == 3, "%llu misses",
+              (unsigned long long)(after.misses - before.misses));
+}
+
+TEST_LIST = {{"get_put", t_get_put},
+             {"bounded", t_bounded},
+             {"prime_hits", t_prime_hits},
+             {NULL, NULL}};
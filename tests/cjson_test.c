@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "acutest.h"
+#include "cJSON.h"
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t rng = 0x9e3779b97f4a7c15;
+static uint64_t next_rand(void) { // xorshift64
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+static uint64_t bits_of(double d) {
+  uint64_t b;
+  memcpy(&b, &d, sizeof b);
+  return b;
+}
+
+// cJSON must read the number at s exactly as strtod does: the same bits,
+// the same length, and the integer flag for literals without '.' or an
+// exponent. Returns 0 after reporting a mismatch.
+static int same_as_strtod(const char *s) {
+  size_t len = strlen(s);
+  char *end;
+  double want = strtod(s, &end);
+  size_t want_len = (size_t)(end - s);
+  const char *parse_end = NULL;
+  cJSON *item = cJSON_ParseWithLengthOpts(s, len, &parse_end, 0);
+  if (want_len == 0)
+    return TEST_CHECK_(item == NULL, "cJSON accepted %s", s);
+  if (!TEST_CHECK_(item != NULL, "cJSON rejected %s", s))
+    return 0;
+  int integer = strcspn(s, ".eE") >= want_len;
+  int ok = TEST_CHECK_(cJSON_IsNumber(item), "%s: not a number", s) &&
+           TEST_CHECK_(bits_of(item->valuedouble) == bits_of(want),
+                       "%s: %.17g, strtod %.17g", s, item->valuedouble,
+                       want) &&
+           TEST_CHECK_((size_t)(parse_end - s) == want_len,
+                       "%s: read %zu chars, strtod %zu", s,
+                       (size_t)(parse_end - s), want_len) &&
+           TEST_CHECK_(!!(item->type & cJSON_NumberIsInteger) == integer,
+                       "%s: integer flag %d", s,
+                       !!(item->type & cJSON_NumberIsInteger));
+  cJSON_Delete(item);
+  return ok;
+}
+
+static void t_edges(void) {
+  static const char *const cases[] = {
+      "0", "-0", "0.0", "-0.0", "0e0", "-0e-999999", "0e999999", "00012",
+      "-00.00012", "1", "-1", "1.", "-1.e3", "-.5", "-.", "-", "-e5", "1e",
+      "1e+", "1e-", "1E5", "1.5e", "1.5.3", "1e5e5", "1e+-5", "1--2", "1+2",
+      "9007199254740991", "9007199254740992", "9007199254740993",
+      "9007199254740994", "9007199254740995", "18014398509481985",
+      "18446744073709551615", "18446744073709551616", "9999999999999999999",
+      "10000000000000000000", "99999999999999999999",
+      "1e22", "1e23", "9007199254740993e22", "123456789012345678e-22",
+      "0.1", "0.2", "0.3", "3.141592653589793", "2.718281828459045",
+      "1.7976931348623157e308", "1.7976931348623158e308", "1.8e308",
+      "1e309", "-1e309", "2.2250738585072014e-308", "2.2250738585072011e-308",
+      "4.9406564584124654e-324", "2.4703282292062327e-324", "5e-324",
+      "1e-324", "1e-400", "1e-342", "1e-343", "1e308", "1e-308", "1e-307",
+      "7.2057594037927933e16", "4.35679e-1", "8.98846567431158e307",
+      "0.000000000000000000000000000000000000000000000000000000000000001",
+      "1000000000000000000000000000000000000000000000000000000000000000",
+      "123456789.123456789123456789", "1e99999999999999999999",
+      "1e-99999999999999999999", "0.0000000000000000000000000001e28",
+      "1e100000", "1e-100000",
+  };
+  for (size_t i = 0; i < sizeof cases / sizeof *cases; i++)
+    same_as_strtod(cases[i]);
+}
+
+// Doubles as printf writes them: shortest-ish, 17 digits and everything in
+// between, across the whole range including subnormals.
+static void t_printed(void) {
+  char s[64];
+  int fails = 0;
+  for (int i = 0; i < 1 << 20 && fails < 10; i++) {
+    uint64_t b = next_rand();
+    double d;
+    memcpy(&d, &b, sizeof d);
+    if (!isfinite(d))
+      continue;
+    snprintf(s, sizeof s, "%.*g", (int)(b % 17) + 1, d);
+    fails += !same_as_strtod(s);
+    snprintf(s, sizeof s, "%.17g", d);
+    fails += !same_as_strtod(s);
+  }
+}
+
+// Random digit strings around every power of ten the table covers, plus
+// integers that sit exactly halfway between two doubles.
+static void t_digits(void) {
+  char s[96];
+  int fails = 0;
+  for (int i = 0; i < 1 << 20 && fails < 10; i++) {
+    size_t n = 0;
+    uint64_t r = next_rand();
+    if (r & 1)
+      s[n++] = '-';
+    int int_digits = (int)((r >> 1) % 22) + 1;
+    int frac_digits = (int)((r >> 8) % 22);
+    for (int j = 0; j < int_digits; j++)
+      s[n++] = (char)('0' + next_rand() % 10);
+    if (frac_digits || (r >> 16) % 4 == 0)
+      s[n++] = '.';
+    for (int j = 0; j < frac_digits; j++)
+      s[n++] = (char)('0' + next_rand() % 10);
+    if ((r >> 20) % 4)
+      n += (size_t)snprintf(s + n, sizeof s - n, "e%d",
+                            (int)((r >> 24) % 671) - 350);
+    s[n] = '\0';
+    fails += !same_as_strtod(s);
+  }
+  for (int i = 0; i < 1 << 18 && fails < 10; i++) {
+    // 54 significant bits ending in 1, shifted: a tie under any rounding
+    uint64_t m = (next_rand() >> 10) | 1 | (uint64_t)1 << 53;
+    uint64_t n = m << (next_rand() % 11);
+    snprintf(s, sizeof s, "%llu", (unsigned long long)n);
+    fails += !same_as_strtod(s);
+    int zeros = 0;
+    while (n % 10 == 0) {
+      n /= 10;
+      zeros++;
+    }
+    snprintf(s, sizeof s, "%llue%d", (unsigned long long)n, zeros);
+    fails += !same_as_strtod(s);
+    // m / 2^k written as m * 5^k / 10^k, while that fits 19 digits
+    for (int k = 1; k <= 3; k++) {
+      uint64_t p = 1;
+      for (int j = 0; j < k; j++)
+        p *= 5;
+      snprintf(s, sizeof s, "%llue-%d", (unsigned long long)(m * p), k);
+      fails += !same_as_strtod(s);
+    }
+  }
+}
+
+// Any run of the characters cJSON hands its number parser.
+static void t_grammar(void) {
+  static const char chars[] = "0123456789+-.eE";
+  char s[16];
+  int fails = 0;
+  for (int i = 0; i < 1 << 20 && fails < 10; i++) {
+    size_t n = (size_t)(next_rand() % 12) + 1;
+    s[0] = next_rand() % 4 ? (char)('0' + next_rand() % 10) : '-';
+    for (size_t j = 1; j < n; j++)
+      s[j] = chars[next_rand() % (sizeof chars - 1)];
+    s[n] = '\0';
+    fails += !same_as_strtod(s);
+  }
+}
+
+// Numbers inside documents: the parser picks up where the number ends.
+static void t_in_documents(void) {
+  cJSON *a = cJSON_Parse("[1, -2.5, 3e2, 18446744073709551616, 0.1]");
+  TEST_ASSERT(a != NULL);
+  static const double want[] = {1, -2.5, 300, 18446744073709551616.0, 0.1};
+  static const int integer[] = {1, 0, 0, 1, 0};
+  for (int i = 0; i < 5; i++) {
+    const cJSON *v = cJSON_GetArrayItem(a, i);
+    TEST_CHECK(cJSON_IsNumber(v) && v->valuedouble == want[i]);
+    TEST_CHECK(!!(v->type & cJSON_NumberIsInteger) == integer[i]);
+  }
+  TEST_CHECK(cJSON_GetArrayItem(a, 0)->valueint == 1);
+  char *out = cJSON_PrintUnformatted(a);
+  TEST_CHECK(out && strcmp(out, "[1,-2.5,300,1.8446744073709552e+19,0.1]") == 0);
+  free(out);
+
+  // Setting a value clears the flag; copies and comparisons ignore it
+  cJSON *copy = cJSON_Duplicate(a, 1);
+  TEST_CHECK(cJSON_Compare(a, copy, 1));
+  cJSON_SetNumberValue(cJSON_GetArrayItem(copy, 0), 1);
+  TEST_CHECK(!(cJSON_GetArrayItem(copy, 0)->type & cJSON_NumberIsInteger));
+  TEST_CHECK(cJSON_Compare(a, copy, 1));
+  cJSON_Delete(copy);
+  cJSON_Delete(a);
+
+  TEST_CHECK(cJSON_Parse("[1.5.3]") == NULL);
+  TEST_CHECK(cJSON_Parse("{\"n\":1e}") == NULL);
+  cJSON *o = cJSON_Parse("{\"n\":-0}");
+  TEST_ASSERT(o != NULL);
+  TEST_CHECK(signbit(cJSON_GetObjectItem(o, "n")->valuedouble));
+  cJSON_Delete(o);
+}
+
+TEST_LIST = {{"edges", t_edges},
+             {"printed", t_printed},
+             {"digits", t_digits},
+             {"grammar", t_grammar},
+             {"in_documents", t_in_documents},
+             {NULL, NULL}};
@@ -0,0 +1,208 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "acutest.h"
+#include "ht_conc.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef TEST_REQUIRE_
+#define TEST_REQUIRE_(cond, ...)                                               \
+  do {                                                                         \
+    TEST_CHECK_(cond, __VA_ARGS__);                                            \
+    if (!(cond))                                                               \
+      return;                                                                  \
+  } while (0)
+#endif
+
+#define KEYS 4096
+static int vals[KEYS];
+
+static int key_of(char *buf, size_t n, size_t i) {
+  return snprintf(buf, n, "key:%zu", i);
+}
+
+static void t_set_get_del(void) {
+  ht_conc *m = ht_conc_new(0);
+  TEST_REQUIRE_(m, "ht_conc_new");
+  int a = 1, b = 2;
+  TEST_CHECK(ht_conc_set(m, "alpha", &a) == 0);
+  TEST_CHECK(ht_conc_get(m, "alpha") == &a);
+  TEST_CHECK(ht_conc_set(m, "alpha", &b) == 0);
+  TEST_CHECK(ht_conc_get(m, "alpha") == &b);
+  TEST_CHECK(ht_conc_len(m) == 1);
+  TEST_CHECK(ht_conc_set_n(m, "al\0pha", 6, &a) == 0);
+  TEST_CHECK(ht_conc_get_n(m, "al\0pha", 6) == &a);
+  TEST_CHECK(ht_conc_get_n(m, "al", 2) == NULL);
+  TEST_CHECK(ht_conc_del(m, "alpha") == 0);
+  TEST_CHECK(ht_conc_del(m, "alpha") == -1);
+  TEST_CHECK(ht_conc_get(m, "alpha") == NULL);
+  TEST_CHECK(ht_conc_len(m) == 1);
+  ht_conc_free(m);
+}
+
+// Many keys force every shard through a few resizes; deletes leave
+// tombstones that later inserts and resizes have to cope with.
+static void t_grow_and_churn(void) {
+  ht_conc *m = ht_conc_new(0);
+  TEST_REQUIRE_(m, "ht_conc_new");
+  char key[32];
+  for (size_t round = 0; round < 4; round++) {
+    for (size_t i = 0; i < KEYS; i++) {
+      key_of(key, sizeof key, i);
+      int rc = ht_conc_set(m, key, &vals[i]);
+      TEST_REQUIRE_(rc == 0, "set %s", key);
+    }
+    for (size_t i = 0; i < KEYS; i += 2) {
+      key_of(key, sizeof key, i);
+      int rc = ht_conc_del(m, key);
+      TEST_REQUIRE_(rc == 0, "del %s", key);
+    }
+  }
+  TEST_CHECK_(ht_conc_len(m) == KEYS / 2, "len=%zu", ht_conc_len(m));
+  for (size_t i = 0; i < KEYS; i++) {
+    key_of(key, sizeof key, i);
+    void *want = i % 2 ? &vals[i] : NULL;
+    TEST_CHECK_(ht_conc_get(m, key) == want, "get %s", key);
+  }
+  ht_conc_free(m);
+}
+
+typedef struct churn {
+  ht_conc *m;
+  size_t lo, hi; // key range this writer owns
+  _Atomic int *stop;
+  _Atomic size_t bad; // lookups that returned another key's value
+} churn;
+
+static void *writer(void *arg) {
+  churn *c = arg;
+  char key[32];
+  for (int round = 0; round < 200; round++) {
+    for (size_t i = c->lo; i < c->hi; i++) {
+      key_of(key, sizeof key, i);
+      if (ht_conc_set(c->m, key, &vals[i]) < 0)
+        abort();
+    }
+    for (size_t i = c->lo; i < c->hi; i++) {
+      key_of(key, sizeof key, i);
+      ht_conc_del(c->m, key);
+    }
+  }
+  return NULL;
+}
+
+static void *reader(void *arg) {
+  churn *c = arg;
+  char key[32];
+  size_t i = 0;
+  while (!atomic_load(c->stop)) {
+    key_of(key, sizeof key, i);
+    void *v = ht_conc_get(c->m, key);
+    if (v != NULL && v != &vals[i])
+      atomic_fetch_add(&c->bad, 1);
+    i = (i + 7) % KEYS;
+  }
+  return NULL;
+}
+
+// Readers race writers that keep inserting, deleting and resizing. A
+// lookup may miss, but must never see a value that belongs to another key
+// or touch freed memory (run under ASan to check the latter).
+static void t_readers_vs_writers(void) {
+  enum { W = 4, R = 4 };
+  ht_conc *m = ht_conc_new(0);
+  TEST_REQUIRE_(m, "ht_conc_new");
+  _Atomic int stop = 0;
+  churn w[W], r = {.m = m, .stop = &stop};
+  pthread_t wt[W], rt[R];
+  for (int i = 0; i < R; i++)
+    pthread_create(&rt[i], NULL, reader, &r);
+  for (int i = 0; i < W; i++) {
+    w[i] = (churn){.m = m, .lo = KEYS / W * (size_t)i,
+                   .hi = KEYS / W * (size_t)(i + 1), .stop = &stop};
+    pthread_create(&wt[i], NULL, writer, &w[i]);
+  }
+  for (int i = 0; i < W; i++)
+    pthread_join(wt[i], NULL);
+  atomic_store(&stop, 1);
+  for (int i = 0; i < R; i++)
+    pthread_join(rt[i], NULL);
+  TEST_CHECK_(atomic_load(&r.bad) == 0, "%zu lookups saw the wrong value",
+              atomic_load(&r.bad));
+  TEST_CHECK_(ht_conc_len(m) == 0, "len=%zu", ht_conc_len(m));
+  ht_conc_free(m);
+}
+
+typedef struct seen {
+  unsigned char hits[KEYS];
+  size_t other;
+} seen;
+
+static int count_key(const char *key, size_t len, void *val, void *arg) {
+  seen *s = arg;
+  size_t i;
+  if (sscanf(key, "key:%zu", &i) == 1 && i < KEYS && val == &vals[i] &&
+      strlen(key) == len)
+    s->hits[i]++;
+  else
+    s->other++;
+  return 0;
+}
+
+// Keys that stay put during a walk are seen exactly once, even while
+// another thread churns different keys through the same shards.
+static void t_each_under_churn(void) {
+  ht_conc *m = ht_conc_new(0);
+  TEST_REQUIRE_(m, "ht_conc_new");
+  char key[32];
+  for (size_t i = 0; i < KEYS / 2; i++) {
+    key_of(key, sizeof key, i);
+    int rc = ht_conc_set(m, key, &vals[i]);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+  }
+  _Atomic int stop = 0;
+  churn w = {.m = m, .lo = KEYS / 2, .hi = KEYS, .stop = &stop};
+  pthread_t wt;
+  pthread_create(&wt, NULL, writer, &w);
+  static seen s;
+  for (int walk = 0; walk < 20; walk++) {
+    memset(&s, 0, sizeof s);
+    ht_conc_each(m, count_key, &s);
+    for (size_t i = 0; i < KEYS / 2; i++)
+      TEST_REQUIRE_(s.hits[i] == 1, "walk %d saw key %zu %d times", walk, i,
+                    s.hits[i]);
+    TEST_CHECK_(s.other == 0, "walk %d: %zu bad entries", walk, s.other);
+  }
+  pthread_join(wt, NULL);
+  ht_conc_free(m);
+}
+
+static int stop_at_three(const char *key, size_t len, void *val, void *arg) {
+  (void)key, (void)len, (void)val;
+  return ++*(int *)arg == 3 ? 42 : 0;
+}
+
+static void t_each_stops(void) {
+  ht_conc *m = ht_conc_new(0);
+  TEST_REQUIRE_(m, "ht_conc_new");
+  char key[32];
+  for (size_t i = 0; i < 100; i++) {
+    key_of(key, sizeof key, i);
+    int rc = ht_conc_set(m, key, &vals[i]);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+  }
+  int calls = 0;
+  int rc = ht_conc_each(m, stop_at_three, &calls);
+  TEST_CHECK_(rc == 42 && calls == 3, "rc=%d calls=%d", rc, calls);
+  ht_conc_free(m);
+}
+
+TEST_LIST = {{"set_get_del", t_set_get_del},
+             {"grow_and_churn", t_grow_and_churn},
+             {"readers_vs_writers", t_readers_vs_writers},
+             {"each_under_churn", t_each_under_churn},
+             {"each_stops", t_each_stops},
+             {NULL, NULL}};
@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+
+#include "acutest.h"
+#include "ht_gen.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef TEST_REQUIRE_
+#define TEST_REQUIRE_(cond, ...)                                               \
+  do {                                                                         \
+    TEST_CHECK_(cond, __VA_ARGS__);                                            \
+    if (!(cond))                                                               \
+      return;                                                                  \
+  } while (0)
+#endif
+
+#define u64_eq(a, b) ((a) == (b))
+HT_DEFINE(u64map, uint64_t, uint64_t, ht_hash_u64, u64_eq)
+
+// A struct value, and a hash so poor that every key shares one probe
+// sequence and one control byte: lookups then lean entirely on eq_fn.
+typedef struct point {
+  int32_t x, y;
+} point;
+
+#define bad_hash(k) ((uint64_t)((k) & 1))
+HT_DEFINE(badmap, uint32_t, point, bad_hash, u64_eq)
+
+// Keys are indexes into ctx, equal when what they index is: a lookup
+// through a scratch index finds the stored one.
+#define word_hash(w, i) ht_hash_u64((w)[i])
+#define word_eq(w, a, b) ((w)[a] == (w)[b])
+HT_DEFINE_CTX(idxmap, uint32_t, uint8_t, const uint64_t *, word_hash, word_eq)
+
+static void t_put_get_del(void) {
+  u64map m;
+  int rc = u64map_init(&m, 0);
+  TEST_REQUIRE_(rc == 0, "init");
+  int added = -1;
+  uint64_t *v = u64map_put(&m, 42, &added);
+  TEST_REQUIRE_(v && added == 1 && *v == 0, "put new");
+  *v = 7;
+  v = u64map_put(&m, 42, &added);
+  TEST_CHECK_(v && added == 0 && *v == 7, "put existing");
+  TEST_CHECK(u64map_get(&m, 43) == NULL);
+  TEST_CHECK(u64map_len(&m) == 1);
+  TEST_CHECK(u64map_del(&m, 42) == 0);
+  TEST_CHECK(u64map_del(&m, 42) == -1);
+  TEST_CHECK(u64map_get(&m, 42) == NULL);
+  TEST_CHECK(u64map_len(&m) == 0);
+  u64map_destroy(&m);
+}
+
+// Grow through several incremental resizes, checking every key after each
+// insert batch, then delete most of them so the table shrinks again.
+static void t_grow_and_shrink(void) {
+  enum { N = 200000 };
+  u64map m;
+  int rc = u64map_init(&m, 0);
+  TEST_REQUIRE_(rc == 0, "init");
+  for (uint64_t i = 0; i < N; i++) {
+    uint64_t *v = u64map_put(&m, i * 3, NULL);
+    TEST_REQUIRE_(v, "put %llu", (unsigned long long)i);
+    *v = i;
+    if (i % 20000 == 0 || i == N - 1)
+      for (uint64_t j = 0; j <= i; j += 97) {
+        const uint64_t *g = u64map_get(&m, j * 3);
+        TEST_REQUIRE_(g && *g == j, "get %llu after %llu puts",
+                      (unsigned long long)j, (unsigned long long)i);
+      }
+  }
+  TEST_CHECK(u64map_len(&m) == N);
+  size_t big = u64map_cap(&m);
+  for (uint64_t i = 100; i < N; i++) {
+    rc = u64map_del(&m, i * 3);
+    TEST_REQUIRE_(rc == 0, "del %llu", (unsigned long long)i);
+  }
+  TEST_CHECK_(u64map_cap(&m) <= big / 32, "cap %zu -> %zu", big,
+              u64map_cap(&m));
+  for (uint64_t i = 0; i < N; i += 7) {
+    const uint64_t *g = u64map_get(&m, i * 3);
+    TEST_CHECK_(i < 100 ? g && *g == i : g == NULL, "get %llu",
+                (unsigned long long)i);
+  }
+  u64map_destroy(&m);
+}
+
+// Iteration sees every entry once, including those an unfinished resize
+// still keeps in the old table.
+static void t_next_mid_resize(void) {
+  enum { N = 1000 };
+  static unsigned char seen[N];
+  u64map m;
+  int rc = u64map_init(&m, 0);
+  TEST_REQUIRE_(rc == 0, "init");
+  int mid = 0;
+  for (uint64_t i = 0; i < N; i++) {
+    uint64_t *v = u64map_put(&m, i, NULL);
+    TEST_REQUIRE_(v, "put");
+    *v = i + 1;
+    mid |= m.old.cap != 0 && i == N - 1;
+  }
+  TEST_CHECK_(mid, "no resize in progress at the end; pick another N");
+  size_t pos = 0, count = 0;
+  for (u64map_slot *s; (s = u64map_next(&m, &pos)); count++) {
+    TEST_REQUIRE_(s->key < N && s->val == s->key + 1, "bad entry");
+    seen[s->key]++;
+  }
+  TEST_CHECK_(count == N, "count=%zu", count);
+  for (size_t i = 0; i < N; i++)
+    TEST_CHECK_(seen[i] == 1, "key %zu seen %d times", i, seen[i]);
+  u64map_destroy(&m);
+}
+
+static void t_degenerate_hash(void) {
+  enum { N = 300 };
+  badmap m;
+  int rc = badmap_init(&m, 0);
+  TEST_REQUIRE_(rc == 0, "init");
+  for (uint32_t i = 0; i < N; i++) {
+    point *p = badmap_put(&m, i, NULL);
+    TEST_REQUIRE_(p, "put %u", i);
+    *p = (point){(int32_t)i, -(int32_t)i};
+  }
+  for (uint32_t i = 0; i < N; i += 2)
+    TEST_CHECK(badmap_del(&m, i) == 0);
+  for (uint32_t i = 0; i < N; i++) {
+    const point *p = badmap_get(&m, i);
+    TEST_CHECK_(i % 2 ? p && p->x == (int32_t)i && p->y == -(int32_t)i
+                      : p == NULL,
+                "get %u", i);
+  }
+  size_t hist[4];
+  size_t longest = badmap_probe_hist(&m, hist, 4);
+  TEST_CHECK_(longest > 1 && hist[3] > 0, "longest=%zu", longest);
+  badmap_destroy(&m);
+}
+
+// get_slot hands back the stored key, also for keys still in the old
+// table halfway through a resize.
+static void t_get_slot_ctx(void) {
+  enum { N = 5000 };
+  static uint64_t words[N + 1]; // words[N] is the scratch key
+  idxmap m;
+  int rc = idxmap_init(&m, 0);
+  TEST_REQUIRE_(rc == 0, "init");
+  m.ctx = words;
+  int mid_resize = 0;
+  for (uint32_t i = 0; i < N; i++) {
+    words[i] = (uint64_t)i * 1000003 + 17;
+    uint8_t *v = idxmap_put(&m, i, NULL);
+    TEST_REQUIRE_(v, "put %u", i);
+    *v = (uint8_t)i;
+    mid_resize |= m.old.cap != 0;
+    for (uint32_t j = i % 7; j <= i; j += 97) {
+      words[N] = words[j];
+      idxmap_slot *e = idxmap_get_slot(&m, N);
+      TEST_REQUIRE_(e && e->key == j && e->val == (uint8_t)j,
+                    "get_slot %u after %u", j, i);
+    }
+  }
+  TEST_CHECK(mid_resize);
+  words[N] = 1;
+  TEST_CHECK(idxmap_get_slot(&m, N) == NULL);
+  idxmap_destroy(&m);
+}
+
+TEST_LIST = {{"put_get_del", t_put_get_del},
+             {"grow_and_shrink", t_grow_and_shrink},
+             {"next_mid_resize", t_next_mid_resize},
+             {"degenerate_hash", t_degenerate_hash},
+             {"get_slot_ctx", t_get_slot_ctx},
+             {NULL, NULL}};
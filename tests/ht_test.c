@@ -5,7 +5,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #ifndef TEST_REQUIRE_
 #define TEST_REQUIRE_(cond, ...)                                               \
@@ -238,6 +240,404 @@ static void t_rehash_stress(void) {
   ht_free(m);
 }
 
+static void t_len_tracks_deletes(void) {
+  ht *m = ht_new(8);
+  TEST_REQUIRE_(m, "ht_new");
+
+  int v = 0;
+  TEST_REQUIRE_(ht_set(m, "a", &v) == 0, "set a");
+  TEST_REQUIRE_(ht_set(m, "b", &v) == 0, "set b");
+  TEST_REQUIRE_(ht_set(m, "a", &v) == 0, "overwrite a");
+  TEST_CHECK_(ht_len(m) == 2, "len=%zu after inserts", ht_len(m));
+  ht_del(m, "a");
+  ht_del(m, "nope");
+  TEST_CHECK_(ht_len(m) == 1, "len=%zu after delete", ht_len(m));
+
+  ht_free(m);
+}
+
+// Insert/delete churn at a steady size: tombstones must be recycled and
+// every live key must stay reachable.
+static void t_delete_churn(void) {
+  enum { LIVE = 1000, ROUNDS = 50 };
+  ht *m = ht_new(LIVE);
+  TEST_REQUIRE_(m, "ht_new");
+  static int vals[LIVE * ROUNDS];
+
+  char key[32];
+  for (size_t i = 0; i < LIVE * ROUNDS; i++) {
+    snprintf(key, sizeof key, "c%zu", i);
+    int rc = ht_set(m, key, &vals[i]);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+    if (i >= LIVE) {
+      snprintf(key, sizeof key, "c%zu", i - LIVE);
+      rc = ht_del(m, key);
+      TEST_REQUIRE_(rc == 0, "del %s", key);
+    }
+  }
+  TEST_CHECK_(ht_len(m) == LIVE, "len=%zu", ht_len(m));
+  for (size_t i = LIVE * (ROUNDS - 1); i < LIVE * ROUNDS; i++) {
+    snprintf(key, sizeof key, "c%zu", i);
+    void *p = ht_get(m, key);
+    TEST_CHECK_(p == &vals[i], "get %s", key);
+  }
+  TEST_CHECK_(ht_get(m, "c0") == NULL, "old key gone");
+
+  ht_free(m);
+}
+
+// Length-aware keys: embedded NULs count, slices need no terminator.
+static void t_len_keys(void) {
+  ht *m = ht_new(8);
+  TEST_REQUIRE_(m, "ht_new");
+
+  int v1 = 1, v2 = 2, v3 = 3;
+  TEST_REQUIRE_(ht_set_n(m, "a\0b", 3, &v1) == 0, "set a\\0b");
+  TEST_REQUIRE_(ht_set_n(m, "a\0c", 3, &v2) == 0, "set a\\0c");
+  TEST_REQUIRE_(ht_set(m, "a", &v3) == 0, "set a");
+  TEST_CHECK_(ht_len(m) == 3, "len=%zu", ht_len(m));
+  TEST_CHECK_(ht_get_n(m, "a\0b", 3) == &v1, "get a\\0b");
+  TEST_CHECK_(ht_get_n(m, "a\0c", 3) == &v2, "get a\\0c");
+  TEST_CHECK_(ht_get(m, "a") == &v3, "get a");
+
+  const char line[] = "JOIN alice bob\n";
+  TEST_REQUIRE_(ht_set(m, "alice", &v1) == 0, "set alice");
+  TEST_CHECK_(ht_get_n(m, line + 5, 5) == &v1, "lookup from a slice");
+  TEST_CHECK_(ht_get_n(m, line + 5, 4) == NULL, "prefix is a miss");
+  TEST_CHECK_(ht_del_n(m, line + 5, 5) == 0, "delete from a slice");
+  TEST_CHECK_(ht_get(m, "alice") == NULL, "alice gone");
+
+  ht_free(m);
+}
+
+// Sequential keys must spread: almost every key sits in its home group.
+static void t_probe_hist(void) {
+  const size_t N = 100000;
+  ht *m = ht_new(1);
+  TEST_REQUIRE_(m, "ht_new");
+
+  int v = 0;
+  char key[32];
+  for (size_t i = 0; i < N; i++) {
+    snprintf(key, sizeof key, "k%zu", i);
+    int rc = ht_set(m, key, &v);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+  }
+  size_t hist[8];
+  size_t longest = ht_probe_hist(m, hist, 8);
+  size_t total = 0;
+  for (int i = 0; i < 8; i++)
+    total += hist[i];
+  TRACE("probe hist: %zu %zu %zu %zu ... longest %zu\n", hist[0], hist[1],
+        hist[2], hist[3], longest);
+  TEST_CHECK_(total == N, "hist covers %zu of %zu keys", total, N);
+  TEST_CHECK_(hist[0] * 100 >= N * 95, "only %zu keys in their home group",
+              hist[0]);
+  TEST_CHECK_(longest <= 8, "longest probe %zu groups", longest);
+
+  ht_free(m);
+}
+
+// Keys on both sides of the inline limit, with enough deletes of long
+// keys that the arena has to be compacted along the way.
+static void t_long_keys_churn(void) {
+  enum { LIVE = 500, ROUNDS = 40 };
+  ht *m = ht_new(8);
+  TEST_REQUIRE_(m, "ht_new");
+  static int vals[LIVE * ROUNDS];
+
+  char key[64];
+  for (size_t i = 0; i < LIVE * ROUNDS; i++) {
+    // 15..17 byte keys around the limit, plus some much longer ones
+    int pad = i % 4 == 3 ? 40 : (int)(i % 3) + 15;
+    snprintf(key, sizeof key, "%0*zu", pad, i);
+    int rc = ht_set(m, key, &vals[i]);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+    if (i >= LIVE) {
+      size_t j = i - LIVE;
+      pad = j % 4 == 3 ? 40 : (int)(j % 3) + 15;
+      snprintf(key, sizeof key, "%0*zu", pad, j);
+      rc = ht_del(m, key);
+      TEST_REQUIRE_(rc == 0, "del %s", key);
+    }
+  }
+  TEST_CHECK_(ht_len(m) == LIVE, "len=%zu", ht_len(m));
+  for (size_t i = LIVE * (ROUNDS - 1); i < LIVE * ROUNDS; i++) {
+    int pad = i % 4 == 3 ? 40 : (int)(i % 3) + 15;
+    snprintf(key, sizeof key, "%0*zu", pad, i);
+    void *p = ht_get(m, key);
+    TEST_CHECK_(p == &vals[i], "get %s", key);
+  }
+
+  ht_free(m);
+}
+
+// Compaction is spread over later calls like resizing is: with most of a
+// big arena dead, no ht_set/ht_del sweeps more than a few slots or copies
+// more than a few keys, yet the dead bytes are given back in the end.
+static void t_arena_compacts_in_steps(void) {
+  enum { N = 100000, KEY = 40 };
+  ht *m = ht_new(8);
+  TEST_REQUIRE_(m, "ht_new");
+  static int vals[6 * N];
+  char key[64];
+  size_t most_slots = 0, most_bytes = 0, compactions = 0;
+  for (size_t i = 0; i < 6 * N; i++) {
+    // N keys live; past that every insert replaces the oldest
+    size_t dead = ht_arena(m).dead;
+    if (i >= N) {
+      snprintf(key, sizeof key, "%0*zu", KEY, i - N);
+      int rc = ht_del(m, key);
+      TEST_REQUIRE_(rc == 0, "del %s", key);
+      ht_arena_stats st = ht_arena(m);
+      most_slots = st.last_slots > most_slots ? st.last_slots : most_slots;
+      most_bytes = st.last_bytes > most_bytes ? st.last_bytes : most_bytes;
+    }
+    snprintf(key, sizeof key, "%0*zu", KEY, i);
+    int rc = ht_set(m, key, &vals[i]);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+    ht_arena_stats st = ht_arena(m);
+    most_slots = st.last_slots > most_slots ? st.last_slots : most_slots;
+    most_bytes = st.last_bytes > most_bytes ? st.last_bytes : most_bytes;
+    compactions += st.dead < dead;
+  }
+  size_t cap = ht_cap(m);
+  TEST_CHECK_(compactions >= 2, "%zu compactions finished", compactions);
+  TEST_CHECK_(most_slots <= 64 && most_slots * 256 < cap,
+              "%zu slots swept in one call, cap %zu", most_slots, cap);
+  TEST_CHECK_(most_bytes <= 64 * KEY, "%zu key bytes moved in one call",
+              most_bytes);
+  ht_arena_stats st = ht_arena(m);
+  size_t live = (size_t)N * KEY;
+  TEST_CHECK_(st.used - st.dead == live, "live %zu, want %zu",
+              st.used - st.dead, live);
+  TEST_CHECK_(st.used <= 4 * live, "arena %zu for %zu live", st.used, live);
+
+  for (size_t i = 0; i < 6 * N; i++) {
+    snprintf(key, sizeof key, "%0*zu", KEY, i);
+    void *p = ht_get(m, key);
+    TEST_CHECK_(p == (i < 5 * N ? NULL : &vals[i]), "get %s", key);
+  }
+  ht_free(m);
+}
+
+// Growth is spread over later ht_set/ht_del calls; every key must stay
+// reachable while entries sit in both the old and the new table.
+static void t_lookup_mid_resize(void) {
+  enum { N = 20000 };
+  ht *m = ht_new(8);
+  TEST_REQUIRE_(m, "ht_new");
+  static int vals[N];
+  char key[32];
+  for (size_t i = 0; i < N; i++) {
+    snprintf(key, sizeof key, "k%zu", i);
+    int rc = ht_set(m, key, &vals[i]);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+    // Probe a few older keys after every insert, not just at the end
+    for (size_t d = 0; d < 64 && d <= i; d += 7) {
+      size_t j = i - d;
+      snprintf(key, sizeof key, "k%zu", j);
+      TEST_REQUIRE_(ht_get(m, key) == &vals[j], "get %s after %zu sets", key,
+                    i + 1);
+    }
+  }
+  TEST_CHECK_(ht_len(m) == N, "len=%zu", ht_len(m));
+  ht_free(m);
+}
+
+// Deleting most keys gives memory back, and a burst of inserts right after
+// the shrink must not overrun the smaller table.
+static void t_shrink_after_deletes(void) {
+  enum { N = 100000, KEEP = 100, BURST = 5000 };
+  ht *m = ht_new(8);
+  TEST_REQUIRE_(m, "ht_new");
+  static int vals[N + BURST];
+  char key[32];
+  for (size_t i = 0; i < N; i++) {
+    snprintf(key, sizeof key, "k%zu", i);
+    int rc = ht_set(m, key, &vals[i]);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+  }
+  size_t big = ht_cap(m);
+  for (size_t i = KEEP; i < N; i++) {
+    snprintf(key, sizeof key, "k%zu", i);
+    int rc = ht_del(m, key);
+    TEST_REQUIRE_(rc == 0, "del %s", key);
+  }
+  TEST_CHECK_(ht_len(m) == KEEP, "len=%zu", ht_len(m));
+  // The last shrink may still be migrating, so both tables count here
+  TEST_CHECK_(ht_cap(m) <= big / 32, "cap %zu -> %zu", big, ht_cap(m));
+
+  for (size_t i = N; i < N + BURST; i++) {
+    snprintf(key, sizeof key, "k%zu", i);
+    int rc = ht_set(m, key, &vals[i]);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+  }
+  TEST_CHECK_(ht_len(m) == KEEP + BURST, "len=%zu", ht_len(m));
+  for (size_t i = 0; i < N + BURST; i++) {
+    if (i == KEEP)
+      i = N;
+    snprintf(key, sizeof key, "k%zu", i);
+    TEST_CHECK_(ht_get(m, key) == &vals[i], "get %s", key);
+  }
+  ht_free(m);
+}
+
+// Short keys are packed into the slot word by word. Keys of every length
+// up to past the inline limit, differing in a single byte or only in their
+// length (trailing NULs included), must all stay distinct.
+static void t_inline_key_bytes(void) {
+  enum { MAXLEN = 18 };
+  static int vals[MAXLEN + 1][MAXLEN + 1];
+  ht *m = ht_new(0);
+  TEST_REQUIRE_(m, "ht_new");
+  unsigned char key[MAXLEN];
+  for (int pass = 0; pass < 2; pass++) {
+    for (size_t len = 0; len <= MAXLEN; len++) {
+      for (size_t flip = 0; flip <= len; flip++) { // flip == len: no flip
+        memset(key, 0, sizeof key);
+        if (flip < len)
+          key[flip] = 0xff;
+        if (pass == 0) {
+          int rc = ht_set_n(m, key, len, &vals[len][flip]);
+          TEST_REQUIRE_(rc == 0, "set len=%zu flip=%zu", len, flip);
+        } else {
+          TEST_CHECK_(ht_get_n(m, key, len) == &vals[len][flip],
+                      "get len=%zu flip=%zu", len, flip);
+        }
+      }
+    }
+  }
+  size_t want = (MAXLEN + 1) * (MAXLEN + 2) / 2;
+  TEST_CHECK_(ht_len(m) == want, "len=%zu want %zu", ht_len(m), want);
+  ht_free(m);
+}
+
+static void snap_path(char *buf, size_t n) {
+  snprintf(buf, n, "/tmp/ht_test_snap.%ld", (long)getpid());
+}
+
+// Keys i < n: short "k<i>" for even i, long ones for odd i, so both the
+// inline and the arena paths go through the file.
+static int snap_key(char *buf, size_t n, size_t i) {
+  return i % 2 ? snprintf(buf, n, "a-rather-long-key:%zu", i)
+               : snprintf(buf, n, "k%zu", i);
+}
+
+// A snapshot maps back to the same contents, deleted keys included, even
+// when taken in the middle of a resize.
+static void t_snapshot_roundtrip(void) {
+  enum { N = 60000, DEL = N / 10 };
+  static int vals[N];
+  char path[64], key[48];
+  snap_path(path, sizeof path);
+  ht *m = ht_new(0);
+  TEST_REQUIRE_(m, "ht_new");
+  for (size_t i = 0; i < N; i++) {
+    snap_key(key, sizeof key, i);
+    int rc = ht_set(m, key, &vals[i]);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+  }
+  for (size_t i = 0; i < DEL; i += 3) {
+    snap_key(key, sizeof key, i);
+    int rc = ht_del(m, key);
+    TEST_REQUIRE_(rc == 0, "del %s", key);
+  }
+  size_t cap = ht_cap(m); // two tables: not a power of two
+  TEST_CHECK_((cap & (cap - 1)) != 0, "no resize under way, cap=%zu", cap);
+  int rc = ht_snapshot(m, path);
+  TEST_REQUIRE_(rc == 0, "ht_snapshot");
+  size_t len = ht_len(m);
+  ht_free(m);
+
+  ht *s = ht_open_mapped(path);
+  TEST_REQUIRE_(s, "ht_open_mapped");
+  TEST_CHECK_(ht_len(s) == len, "len=%zu want %zu", ht_len(s), len);
+  for (size_t i = 0; i < N; i++) {
+    snap_key(key, sizeof key, i);
+    void *want = i < DEL && i % 3 == 0 ? NULL : &vals[i];
+    TEST_CHECK_(ht_get(s, key) == want, "get %s", key);
+  }
+  TEST_CHECK(ht_get(s, "missing") == NULL);
+  ht_free(s);
+  unlink(path);
+}
+
+// A mapped table takes every kind of change, growing past the mapped
+// arrays included, while the file keeps what was snapshotted.
+static void t_snapshot_copy_on_write(void) {
+  enum { N = 2000, MORE = 20000 };
+  static int vals[N + MORE], other;
+  char path[64], key[48];
+  snap_path(path, sizeof path);
+  ht *m = ht_new(0);
+  TEST_REQUIRE_(m, "ht_new");
+  for (size_t i = 0; i < N; i++) {
+    snap_key(key, sizeof key, i);
+    int rc = ht_set(m, key, &vals[i]);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+  }
+  int rc = ht_snapshot(m, path);
+  TEST_REQUIRE_(rc == 0, "ht_snapshot");
+  ht_free(m);
+
+  ht *s = ht_open_mapped(path);
+  TEST_REQUIRE_(s, "ht_open_mapped");
+  for (size_t i = 0; i < N; i += 2) { // overwrite half, delete the rest
+    snap_key(key, sizeof key, i);
+    rc = ht_set(s, key, &other);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+    snap_key(key, sizeof key, i + 1);
+    rc = ht_del(s, key);
+    TEST_REQUIRE_(rc == 0, "del %s", key);
+  }
+  for (size_t i = N; i < N + MORE; i++) {
+    snap_key(key, sizeof key, i);
+    rc = ht_set(s, key, &vals[i]);
+    TEST_REQUIRE_(rc == 0, "set %s", key);
+  }
+  TEST_CHECK_(ht_len(s) == N / 2 + MORE, "len=%zu", ht_len(s));
+  for (size_t i = 0; i < N + MORE; i++) {
+    snap_key(key, sizeof key, i);
+    void *want = i >= N ? &vals[i] : i % 2 ? NULL : &other;
+    TEST_CHECK_(ht_get(s, key) == want, "modified get %s", key);
+  }
+
+  ht *again = ht_open_mapped(path);
+  TEST_REQUIRE_(again, "reopen");
+  TEST_CHECK_(ht_len(again) == N, "len=%zu", ht_len(again));
+  for (size_t i = 0; i < N + 10; i++) {
+    snap_key(key, sizeof key, i);
+    void *want = i < N ? &vals[i] : NULL;
+    TEST_CHECK_(ht_get(again, key) == want, "file get %s", key);
+  }
+  ht_free(again);
+  ht_free(s);
+  unlink(path);
+}
+
+static void t_snapshot_bad_file(void) {
+  char path[64];
+  snap_path(path, sizeof path);
+  TEST_CHECK(ht_open_mapped(path) == NULL); // missing
+  FILE *f = fopen(path, "wb");
+  TEST_REQUIRE_(f, "fopen");
+  char junk[4096];
+  memset(junk, 'x', sizeof junk);
+  fwrite(junk, 1, sizeof junk, f);
+  fclose(f);
+  TEST_CHECK(ht_open_mapped(path) == NULL); // not a snapshot
+
+  ht *m = ht_new(0);
+  TEST_REQUIRE_(m, "ht_new");
+  int rc = ht_snapshot(m, path);
+  TEST_REQUIRE_(rc == 0, "ht_snapshot");
+  ht_free(m);
+  TEST_CHECK(truncate(path, 100) == 0);
+  TEST_CHECK(ht_open_mapped(path) == NULL); // cut short
+  unlink(path);
+}
+
 TEST_LIST = {{"insert_get_one", t_insert_get_one},
              {"insert_get_many", t_insert_get_many},
              {"overwrite", t_overwrite},
@@ -246,4 +646,16 @@ TEST_LIST = {{"insert_get_one", t_insert_get_one},
              {"key_is_copied", t_key_is_copied},
              {"delete_positions", t_delete_positions},
              {"rehash_stress", t_rehash_stress},
+             {"len_tracks_deletes", t_len_tracks_deletes},
+             {"delete_churn", t_delete_churn},
+             {"len_keys", t_len_keys},
+             {"probe_hist", t_probe_hist},
+             {"long_keys_churn", t_long_keys_churn},
+             {"arena_compacts_in_steps", t_arena_compacts_in_steps},
+             {"lookup_mid_resize", t_lookup_mid_resize},
+             {"shrink_after_deletes", t_shrink_after_deletes},
+             {"inline_key_bytes", t_inline_key_bytes},
+             {"snapshot_roundtrip", t_snapshot_roundtrip},
+             {"snapshot_copy_on_write", t_snapshot_copy_on_write},
+             {"snapshot_bad_file", t_snapshot_bad_file},
              {NULL, NULL}};
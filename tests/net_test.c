@@ -0,0 +1,53 @@
+#define _GNU_SOURCE
+
+#include "acutest.h"
+#include "reactor.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int readable;
+static void count_readable(Conn *c) {
+  (void)c;
+  readable++;
+}
+
+static uint64_t ev_data(const Conn *c) {
+  return (uint64_t)c->gen << 32 | (uint32_t)c->fd;
+}
+
+// A conn closed mid-tick stays on the dead list, so the conn that accept
+// hands its fd to comes from another slot. Events still queued for the old
+// socket must not reach the new one.
+static void t_stale_event(void) {
+  static const NetProto proto = {.on_readable = count_readable};
+  Reactor r = {.epfd = epoll_create1(EPOLL_CLOEXEC), .lfd = -1, .wakefd = -1,
+               .proto = &proto};
+  TEST_ASSERT(r.epfd >= 0);
+  int a[2], b[2];
+  TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, a) == 0);
+  Conn *ca = reactor_conn_new(&r, a[0]);
+  uint64_t old = ev_data(ca);
+  conn_close(ca);
+
+  TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, b) == 0);
+  TEST_ASSERT_(b[0] == a[0], "fd %d not reused (got %d)", a[0], b[0]);
+  Conn *cb = reactor_conn_new(&r, b[0]);
+  TEST_CHECK(cb != ca);
+
+  reactor_conn_event(&r, old, EPOLLIN | EPOLLRDHUP);
+  TEST_CHECK_(readable == 0, "old event reached the new conn");
+  reactor_conn_event(&r, old, EPOLLERR);
+  TEST_CHECK_(!cb->dead, "old error closed the new conn");
+  reactor_conn_event(&r, ev_data(cb), EPOLLIN);
+  TEST_CHECK(readable == 1);
+
+  conn_close(cb);
+  reactor_reap(&r);
+  close(a[1]);
+  close(b[1]);
+  close(r.epfd);
+  free(r.conns);
+}
+
+TEST_LIST = {{"stale_event", t_stale_event}, {NULL, NULL}};
@@ -0,0 +1,296 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "acutest.h"
+#include "prime.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Plain sieve as the reference for small n.
+static void t_matches_sieve(void) {
+  enum { N = 2000000 };
+  unsigned char *comp = calloc(N, 1);
+  TEST_CHECK(comp != NULL);
+  if (!comp)
+    return;
+  comp[0] = comp[1] = 1;
+  for (size_t i = 2; i * i < N; i++)
+    if (!comp[i])
+      for (size_t j = i * i; j < N; j += i)
+        comp[j] = 1;
+  size_t bad = 0;
+  for (uint64_t n = 0; n < N; n++)
+    if (prime_u64(n) != !comp[n] && bad++ < 10)
+      TEST_CHECK_(0, "prime_u64(%llu) = %d", (unsigned long long)n,
+                  prime_u64(n));
+  TEST_CHECK_(bad == 0, "%zu mismatches", bad);
+  free(comp);
+}
+
+static int trial(uint64_t n) {
+  if (n < 2)
+    return 0;
+  for (uint64_t d = 2; d <= n / d; d++)
+    if (n % d == 0)
+      return 0;
+  return 1;
+}
+
+// Random odd numbers up to 2^36, checked by trial division.
+static void t_matches_trial_division(void) {
+  uint64_t x = 0x9e3779b97f4a7c15;
+  for (int i = 0; i < 2000; i++) {
+    x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+    uint64_t n = (x >> 28) | 1;
+    TEST_CHECK_(prime_u64(n) == trial(n), "n=%llu", (unsigned long long)n);
+  }
+}
+
+// Composites that fool weaker tests: strong pseudoprimes to base 2 and to
+// the first several prime bases, Carmichael numbers, and products of two
+// large primes near 2^64.
+static void t_pseudoprimes(void) {
+  static const uint64_t composite[] = {
+      2047,
+      3215031751u,
+      4759123141u, // smallest strong pseudoprime to 2, 7 and 61
+      2152302898747u,
+      3474749660383u,
+      341550071728321u,
+      3825123056546413051u,
+      561,
+      41041,
+      825265,
+      321197185,
+      4294967291u * (uint64_t)4294967279u,
+      4294967291u * (uint64_t)4294967291u,
+      3037000493u * (uint64_t)3037000453u,
+      UINT64_MAX,
+      UINT64_MAX - 1,
+  };
+  for (size_t i = 0; i < sizeof composite / sizeof composite[0]; i++)
+    TEST_CHECK_(!prime_u64(composite[i]), "%llu is composite",
+                (unsigned long long)composite[i]);
+}
+
+// prime_u64_batch against prime_u64 on a mix of small numbers, odd
+// numbers near 2^32 and 2^64, and the pseudoprimes above, in batches of
+// every size from 0 to 70 so lanes go idle at every point.
+static void t_batch_matches(void) {
+  enum { N = 4000 };
+  static uint64_t n[N];
+  static int got[N];
+  uint64_t x = 0x2545f4914f6cdd1d;
+  for (size_t i = 0; i < N; i++) {
+    x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+    switch (i % 4) {
+    case 0:
+      n[i] = x % 100000;
+      break;
+    case 1:
+      n[i] = (x >> 30) | 1;
+      break;
+    case 2:
+      n[i] = x | 1;
+      break;
+    default:
+      n[i] = i % 8 == 3 ? 3825123056546413051u : 4759123141u;
+    }
+  }
+  size_t bad = 0;
+  for (size_t len = 0, at = 0; at + len <= N; at += len, len = (len + 1) % 71) {
+    prime_u64_batch(n + at, len, got + at);
+    for (size_t i = at; i < at + len; i++)
+      if (got[i] != prime_u64(n[i]) && bad++ < 10)
+        TEST_CHECK_(0, "batch says %llu is%s prime", (unsigned long long)n[i],
+                    got[i] ? "" : " not");
+  }
+  prime_u64_batch(n, N, got);
+  for (size_t i = 0; i < N; i++)
+    if (got[i] != prime_u64(n[i]) && bad++ < 10)
+      TEST_CHECK_(0, "whole batch: %llu", (unsigned long long)n[i]);
+  TEST_CHECK_(bad == 0, "%zu mismatches", bad);
+}
+
+static void t_large_primes(void) {
+  static const uint64_t prime[] = {
+      4294967291u,           // largest below 2^32
+      2305843009213693951u,  // 2^61 - 1
+      9223372036854775783u,  // largest below 2^63
+      9223372036854775837u,  // smallest above 2^63
+      18446744073709551557u, // largest below 2^64
+      1000000000000000003u,
+  };
+  for (size_t i = 0; i < sizeof prime / sizeof prime[0]; i++)
+    TEST_CHECK_(prime_u64(prime[i]), "%llu is prime",
+                (unsigned long long)prime[i]);
+}
+
+static int token(const char *s) { return prime_token(s, strlen(s)); }
+
+// Spellings of the same value agree; anything that is not an integer, or
+// not a JSON number at all, is not prime.
+static void t_token_forms(void) {
+  static const struct {
+    const char *s;
+    int prime;
+  } cases[] = {
+      {"7", 1},        {"007", 1},      {"7.", 1},     {"7.000", 1},
+      {"70e-1", 1},    {"0.7E1", 1},    {"7e+0", 1},   {"0.02e2", 1},
+      {"7.5", 0},      {"7e1", 0},      {"70", 0},     {"1e3", 0},
+      {"0.7", 0},      {"1", 0},        {"0", 0},      {"0.0e5", 0},
+      {"-7", 0},       {"-0", 0},       {"1e400", 0},  {"7e-400", 0},
+      {"", 0},         {"7e", 0},       {"7e+", 0},    {"7.0.0", 0},
+      {"7x", 0},       {".7e1", 0},     {"2.0000000000000000000000001", 0},
+      {"9007199254740997", 1}, // prime, but 2^53 + 4 as a double
+      {"9007199254740997.0", 1},
+      {"18446744073709551629", 1}, // first prime past 2^64
+      {"1844674407370955162.9e1", 1},
+  };
+  for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++)
+    TEST_CHECK_(token(cases[i].s) == cases[i].prime, "\"%s\"", cases[i].s);
+}
+
+// The token path lands on prime_u64 for anything that fits.
+static void t_token_matches_u64(void) {
+  uint64_t x = 0x2545f4914f6cdd1d;
+  char buf[64];
+  for (int i = 0; i < 3000; i++) {
+    x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+    uint64_t n = i < 1000 ? x >> 40 : x >> (i % 64);
+    int want = prime_u64(n);
+    snprintf(buf, sizeof buf, "%llu", (unsigned long long)n);
+    TEST_CHECK_(token(buf) == want, "%s", buf);
+    snprintf(buf, sizeof buf, "%llu.00e0", (unsigned long long)n);
+    TEST_CHECK_(token(buf) == want, "%s", buf);
+    snprintf(buf, sizeof buf, "%llu0e-1", (unsigned long long)n);
+    TEST_CHECK_(token(buf) == want, "%s", buf);
+  }
+}
+
+// prime_token_batch against prime_token: the forms above, numbers either
+// side of 2^64, and random ones, so both paths share batches.
+static void t_token_batch(void) {
+  enum { N = 600 };
+  static char text[N][32];
+  static const char *s[N];
+  static size_t len[N];
+  static int got[N];
+  static const char *fixed[] = {"7", "007", "7.0", "70e-1", "-7", "", "7x",
+                                "0", "1", "18446744073709551557",
+                                "18446744073709551615", "18446744073709551629",
+                                "99999999999999999999"};
+  size_t nfixed = sizeof fixed / sizeof fixed[0];
+  uint64_t x = 0x2545f4914f6cdd1d;
+  for (size_t i = 0; i < N; i++) {
+    x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+    if (i % 5 == 0)
+      snprintf(text[i], sizeof text[i], "%s", fixed[i / 5 % nfixed]);
+    else
+      snprintf(text[i], sizeof text[i], "%llu",
+               (unsigned long long)(x >> (i % 64)) | 1);
+    s[i] = text[i];
+    len[i] = strlen(text[i]);
+  }
+  prime_token_batch(s, len, N, got);
+  for (size_t i = 0; i < N; i++)
+    TEST_CHECK_(got[i] == prime_token(s[i], len[i]), "\"%s\"", s[i]);
+}
+
+static void t_token_large(void) {
+  static const char *prime[] = {
+      "618970019642690137449562111",             // 2^89 - 1
+      "170141183460469231731687303715884105727", // 2^127 - 1
+      "340282366920938463463374607431768211297", // largest below 2^128
+  };
+  // Composites that pass a base-2 Miller-Rabin round, so only the Lucas
+  // half of Baillie-PSW turns them down: Chernick Carmichael numbers
+  // (6k+1)(12k+1)(18k+1) of 65, 100, 130 and 300 bits; then products of
+  // primes and a square.
+  static const char *composite[] = {
+      "18768001878618448249",
+      "845144448230695205767661564041",
+      "907419646290971157795204881353544995561",
+      "1358023984222975599873377487284370461848081660985654299570755303076535"
+      "848339870114880219881",
+      "340282366920938460843936948965011886881", // (2^64 - 59)(2^64 - 83)
+      "340282366920938463463374607431768211457", // 2^128 + 1
+      "324518553658426762811953039540225",       // (2^54 + 1)^2
+  };
+  for (size_t i = 0; i < sizeof prime / sizeof prime[0]; i++)
+    TEST_CHECK_(token(prime[i]), "%s is prime", prime[i]);
+  for (size_t i = 0; i < sizeof composite / sizeof composite[0]; i++)
+    TEST_CHECK_(!token(composite[i]), "%s is composite", composite[i]);
+}
+
+// Past PRIME_MAX_BITS only the last digit is looked at: 0 when it shows a
+// factor of 2 or 5, else -1 rather than a guess. 10^1234 is just past
+// 2^4096, 10^1401 past the digits converted at all.
+static void t_token_too_large(void) {
+  static char s[1500];
+  static const struct {
+    size_t zeros;
+    char last;
+    int want;
+  } cases[] = {{1233, '1', -1}, {1233, '3', -1}, {1233, '4', 0},
+               {1233, '5', 0},  {1400, '7', -1}, {1400, '8', 0}};
+  for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) {
+    s[0] = '1';
+    memset(s + 1, '0', cases[i].zeros);
+    s[cases[i].zeros + 1] = cases[i].last;
+    s[cases[i].zeros + 2] = '\0';
+    TEST_CHECK_(token(s) == cases[i].want, "10^%zu + %c: %d",
+                cases[i].zeros + 1, cases[i].last, token(s));
+    int out = 2;
+    const char *tok = s;
+    size_t len = strlen(s);
+    prime_token_batch(&tok, &len, 1, &out);
+    TEST_CHECK(out == cases[i].want);
+  }
+  TEST_CHECK(token("1e5000") == 0); // a multiple of 10 however long
+  uint64_t n[PRIME_MAX_BITS / 64 + 1] = {1};
+  n[PRIME_MAX_BITS / 64] = 1; // 2^4096 + 1
+  TEST_CHECK(prime_bn(n, PRIME_MAX_BITS / 64 + 1) == -1);
+  n[0] = 2;
+  TEST_CHECK(prime_bn(n, PRIME_MAX_BITS / 64 + 1) == 0);
+}
+
+// 2^p - 1 as limbs.
+static size_t mersenne(uint64_t *n, unsigned p) {
+  size_t k = (p + 63) / 64;
+  for (size_t i = 0; i < k; i++)
+    n[i] = UINT64_MAX;
+  if (p % 64)
+    n[k - 1] >>= 64 - p % 64;
+  return k;
+}
+
+// Mersenne numbers past 128 bits: primes, and composites whose factors are
+// all far past trial division (2^1277 - 1 has none known).
+static void t_bn_mersenne(void) {
+  static const unsigned prime[] = {521, 607, 1279, 2203};
+  static const unsigned composite[] = {131, 257, 1061, 1277, 4096};
+  uint64_t n[PRIME_MAX_BITS / 64];
+  for (size_t i = 0; i < sizeof prime / sizeof prime[0]; i++) {
+    size_t k = mersenne(n, prime[i]);
+    TEST_CHECK_(prime_bn(n, k), "2^%u - 1 is prime", prime[i]);
+  }
+  for (size_t i = 0; i < sizeof composite / sizeof composite[0]; i++) {
+    size_t k = mersenne(n, composite[i]);
+    TEST_CHECK_(!prime_bn(n, k), "2^%u - 1 is composite", composite[i]);
+  }
+}
+
+TEST_LIST = {{"matches_sieve", t_matches_sieve},
+             {"matches_trial_division", t_matches_trial_division},
+             {"pseudoprimes", t_pseudoprimes},
+             {"batch_matches", t_batch_matches},
+             {"large_primes", t_large_primes},
+             {"token_forms", t_token_forms},
+             {"token_matches_u64", t_token_matches_u64},
+             {"token_batch", t_token_batch},
+             {"token_large", t_token_large},
+             {"token_too_large", t_token_too_large},
+             {"bn_mersenne", t_bn_mersenne},
+             {NULL, NULL}};
@@ -0,0 +1,211 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "acutest.h"
+#include "cJSON.h"
+#include "request.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Both decoders on one line: the fast path must agree with cJSON wherever
+// it does not defer, down to the number token it hands back.
+static int agree(const char *line, size_t len, int *deferred) {
+  const char *a = NULL, *b = NULL;
+  size_t alen = 0, blen = 0;
+  int fast = req_parse_fast(line, len, &a, &alen);
+  int slow = req_parse_cjson(line, len, &b, &blen);
+  *deferred = fast == -1;
+  if (fast == -1)
+    return req_parse(line, len, &a, &alen) == slow &&
+           (!slow || (a == b && alen == blen));
+  return fast == slow && (!slow || (a == b && alen == blen));
+}
+
+static void check_line(const char *line, size_t len, int want) {
+  const char *tok;
+  size_t tok_len;
+  int deferred, got = req_parse(line, len, &tok, &tok_len);
+  TEST_CHECK_(got == want, "req_parse(%.*s) = %d", (int)len, line, got);
+  int same = agree(line, len, &deferred);
+  TEST_CHECK_(same, "fast path disagrees with cJSON on %.*s", (int)len, line);
+}
+
+#define LINE(s, want) check_line(s, sizeof(s) - 1, want)
+
+static void t_accepts(void) {
+  LINE("{\"method\":\"isPrime\",\"number\":7}", 1);
+  LINE("{\"number\":7,\"method\":\"isPrime\"}", 1);
+  LINE(" { \"method\" : \"isPrime\" ,\t\"number\" : 7 } ", 1);
+  LINE("{\"method\":\"isPrime\",\"number\":-7.5e3}", 1);
+  LINE("{\"method\":\"isPrime\",\"number\":7.}", 1); // strtod takes it
+  LINE("{\"method\":\"isPrime\",\"number\":-.5}", 1); // and this
+  LINE("{\"method\":\"isPrime\",\"extra\":[1,{\"a\":null}],\"number\":7}", 1);
+  LINE("{\"meth\\u006fd\":\"is\\u0050rime\",\"number\":7}", 1);
+  LINE("{\"method\":\"isPrime\",\"number\":7,\"number\":\"x\"}", 1);
+  LINE("{\"method\":\"isPrime\",\"number\":7} trailing", 1);
+  LINE("\xef\xbb\xbf{\"method\":\"isPrime\",\"number\":7}", 1);
+  LINE("{\"method\":\"isPrime\\u0000junk\",\"number\":7}", 1);
+  LINE("{\"method\":\"isPrime\",\"number\":"
+       "170141183460469231731687303715884105727}", 1);
+}
+
+static void t_rejects(void) {
+  LINE("", 0);
+  LINE("{}", 0);
+  LINE("[]", 0);
+  LINE("7", 0);
+  LINE("{\"method\":\"isPrime\"}", 0);
+  LINE("{\"number\":7}", 0);
+  LINE("{\"method\":\"isprime\",\"number\":7}", 0);
+  LINE("{\"method\":\"isPrime\",\"number\":\"7\"}", 0);
+  LINE("{\"method\":\"isPrimer\",\"number\":7}", 0);
+  LINE("{\"method\":1,\"number\":7}", 0);
+  LINE("{\"method\":\"x\",\"method\":\"isPrime\",\"number\":7}", 0);
+  LINE("{\"method\":\"isPrime\",\"number\":7", 0);
+  LINE("{\"method\":\"isPrime\",\"number\":7,}", 0);
+  LINE("{\"method\":\"isPrime\" \"number\":7}", 0);
+  LINE("{\"method\":\"isPrime\",\"number\":1e}", 0);
+  LINE("{\"method\":\"isPrime\",\"number\":1-2}", 0);
+  LINE("{\"method\":\"isPrime\",\"number\":tru}", 0);
+  LINE("{\"method\":\"isPrime\",\"number\":7,\"x\":\"\\q\"}", 0);
+  LINE("{\"method\":\"isPrime\",\"number\":7,\"x\":\"\\ud800\"}", 0);
+  LINE("{\"method\":\"isPrime\",\"number\":7,\"x\":[1,2}", 0);
+}
+
+// The lines a well-behaved client sends must never reach cJSON.
+static void t_common_shapes_fast(void) {
+  static const char *const lines[] = {
+      "{\"method\":\"isPrime\",\"number\":123}",
+      "{\"number\":123,\"method\":\"isPrime\"}",
+      "{\"method\": \"isPrime\", \"number\": 123.0}",
+      "{\"method\":\"isPrime\",\"number\":-4}",
+      "{\"method\":\"isPrime\",\"number\":1e3,\"extra\":{\"a\":[true]}}",
+      "{\"method\":\"isPrime\"}",
+      "{\"method\":\"isPrime\",\"number\":\"123\"}",
+      "{\"meth\\u006fd\":\"isPrime\",\"number\":123}",
+  };
+  for (size_t i = 0; i < sizeof lines / sizeof lines[0]; i++) {
+    const char *tok;
+    size_t tok_len;
+    int r = req_parse_fast(lines[i], strlen(lines[i]), &tok, &tok_len);
+    TEST_CHECK_(r != -1, "deferred: %s", lines[i]);
+  }
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15u;
+
+static uint64_t rng(void) { // xorshift64*
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545f4914f6cdd1du;
+}
+
+// Random edits of valid requests: each edit tends to land on some corner of
+// the grammar, and every result must decode as cJSON decodes it.
+static void t_mutations(void) {
+  static const char *const seeds[] = {
+      "{\"method\":\"isPrime\",\"number\":7}",
+      "{ \"number\" : -12.5e+2 , \"method\" : \"isPrime\" }",
+      "{\"method\":\"isPrime\",\"x\":[null,true,false,{\"y\":\"\\n\"}],"
+      "\"number\":1234567}",
+      "{\"m\\u0065thod\":\"isPrime\",\"number\":0.7E1}",
+  };
+  static const char alphabet[] = "{}[]\":,\\ u0e.+-9tfnlsr\t\x01";
+  enum { ROUNDS = 200000, MAXLEN = 96 };
+  size_t bad = 0, deferred_n = 0;
+  for (int r = 0; r < ROUNDS; r++) {
+    char line[MAXLEN];
+    const char *seed = seeds[rng() % (sizeof seeds / sizeof seeds[0])];
+    size_t len = strlen(seed);
+    memcpy(line, seed, len);
+    for (int edits = 1 + (int)(rng() % 3); edits > 0; edits--) {
+      size_t at = len ? rng() % len : 0;
+      char c = alphabet[rng() % (sizeof alphabet - 1)];
+      switch (rng() % 3) {
+      case 0: // replace
+        if (len)
+          line[at] = c;
+        break;
+      case 1: // insert
+        if (len < MAXLEN) {
+          memmove(line + at + 1, line + at, len - at);
+          line[at] = c;
+          len++;
+        }
+        break;
+      default: // delete
+        if (len) {
+          memmove(line + at, line + at + 1, len - at - 1);
+          len--;
+        }
+      }
+    }
+    int deferred;
+    if (!agree(line, len, &deferred) && bad++ < 10)
+      TEST_CHECK_(0, "disagree on %.*s", (int)len, line);
+    deferred_n += (size_t)deferred;
+  }
+  TEST_CHECK_(bad == 0, "%zu disagreements", bad);
+  TEST_MSG("%zu of %d deferred", deferred_n, ROUNDS);
+}
+
+// Lines whose trees outgrow the parse arena, again and again: each has
+// an ignored member of pad bytes, and every other one is cut short.
+static void *arena_lines(void *arg) {
+  size_t *bad = arg;
+  enum { MAXPAD = 1 << 17 };
+  char *line = malloc(MAXPAD + 64);
+  if (!line)
+    abort();
+  for (size_t pad = 1; pad <= MAXPAD; pad = pad * 3 / 2 + 1)
+    for (int round = 0; round < 4; round++) {
+      size_t len = (size_t)sprintf(line, "{\"method\":\"isPrime\",\"x\":\"");
+      memset(line + len, 'a', pad);
+      len += pad;
+      len += (size_t)sprintf(line + len, "\",\"number\":7}");
+      if (round % 2)
+        len -= 3; // unterminated
+      const char *tok;
+      size_t tok_len;
+      int got = req_parse_cjson(line, len, &tok, &tok_len);
+      if (round % 2 ? got : !got || tok_len != 1 || *tok != '7')
+        ++*bad;
+    }
+  free(line);
+  return NULL;
+}
+
+// cJSON parses through a per-thread arena; other threads, and cJSON calls
+// outside req_parse_cjson, must not notice.
+static void t_arena(void) {
+  enum { THREADS = 4 };
+  pthread_t t[THREADS];
+  size_t bad[THREADS] = {0};
+  for (int i = 0; i < THREADS; i++)
+    TEST_ASSERT(pthread_create(&t[i], NULL, arena_lines, &bad[i]) == 0);
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(t[i], NULL);
+    TEST_CHECK_(bad[i] == 0, "thread %d: %zu wrong answers", i, bad[i]);
+  }
+
+  const char *tok;
+  size_t tok_len;
+  TEST_CHECK(req_parse_cjson("{\"method\":\"isPrime\",\"number\":7}", 31,
+                             &tok, &tok_len) == 1);
+  cJSON *doc = cJSON_Parse("{\"a\":[1,\"two\"]}");
+  TEST_ASSERT(doc != NULL);
+  char *text = cJSON_PrintUnformatted(doc);
+  TEST_CHECK(text && strcmp(text, "{\"a\":[1,\"two\"]}") == 0);
+  cJSON_free(text);
+  cJSON_Delete(doc);
+}
+
+TEST_LIST = {{"accepts", t_accepts},
+             {"rejects", t_rejects},
+             {"common_shapes_fast", t_common_shapes_fast},
+             {"mutations", t_mutations},
+             {"arena", t_arena},
+             {NULL, NULL}};
@@ -0,0 +1,69 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "acutest.h"
+#include "prime.h"
+#include "sieve.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Every number below the bound against prime_u64, across several segments
+// and with more workers than segments at the small end.
+static void check_bound(uint64_t limit, int threads) {
+  Sieve s;
+  TEST_ASSERT(sieve_build(&s, limit, threads) == 0);
+  size_t bad = 0;
+  for (uint64_t n = 0; n < limit; n++)
+    if (sieve_has(&s, n) != prime_u64(n) && bad++ < 10)
+      TEST_CHECK_(0, "2^%d sieve says %llu is%s prime", __builtin_ctzll(limit),
+                  (unsigned long long)n, sieve_has(&s, n) ? "" : " not");
+  TEST_CHECK_(bad == 0, "%zu mismatches below %llu with %d threads", bad,
+              (unsigned long long)limit, threads);
+  sieve_free(&s);
+}
+
+static void t_matches_prime_u64(void) {
+  check_bound(128, 4);
+  check_bound(1 << 16, 1);
+  check_bound(1 << 25, 1); // 8 segments
+  check_bound(1 << 25, 3);
+}
+
+static void t_bad_limits(void) {
+  Sieve s;
+  TEST_CHECK(sieve_build(&s, 0, 1) < 0);
+  TEST_CHECK(sieve_build(&s, 1000, 1) < 0); // not a multiple of 128
+}
+
+static void t_save_map(void) {
+  char path[] = "/tmp/sieve_test_XXXXXX";
+  int fd = mkstemp(path);
+  TEST_ASSERT(fd >= 0);
+  close(fd);
+
+  Sieve built, mapped;
+  TEST_ASSERT(sieve_build(&built, 1 << 20, 2) == 0);
+  TEST_CHECK(sieve_save(&built, path) == 0);
+  TEST_CHECK(sieve_map(&mapped, 1 << 21, path) < 0); // other bound
+  TEST_ASSERT(sieve_map(&mapped, 1 << 20, path) == 0);
+  TEST_CHECK(memcmp(built.bits, mapped.bits, (1 << 20) / 16) == 0);
+
+  // prime_u64 answers from the sieve while one is set
+  prime_use_sieve(&mapped);
+  TEST_CHECK(prime_u64(1000003) == 1);
+  TEST_CHECK(prime_u64(1000001) == 0);
+  TEST_CHECK(prime_u64((1 << 20) + 7) == 1); // past the bound
+  prime_use_sieve(NULL);
+
+  sieve_free(&mapped);
+  sieve_free(&built);
+  TEST_CHECK(sieve_map(&mapped, 1 << 20, "/nonexistent/sieve") < 0);
+  unlink(path);
+}
+
+TEST_LIST = {{"matches_prime_u64", t_matches_prime_u64},
+             {"bad_limits", t_bad_limits},
+             {"save_map", t_save_map},
+             {NULL, NULL}};
@@ -303,6 +303,237 @@ typedef struct
 /* get a pointer to the buffer at the position */
 #define buffer_at_offset(buffer) ((buffer)->content + (buffer)->offset)
 
+/* The fast path in parse_number needs a 64x64->128 bit multiply and
+ * IEEE doubles that are computed without extra precision. */
+#if defined(__GNUC__) && defined(__SIZEOF_INT128__) && defined(FLT_EVAL_METHOD) && (FLT_EVAL_METHOD == 0) && (DBL_MANT_DIG == 53) && (DBL_MAX_EXP == 1024)
+#define CJSON_FAST_NUMBER
+#include "cJSON_pow5.h"
+#endif
+
+/* a number literal, as far as strtod would read it */
+typedef struct
+{
+    unsigned long long mantissa; /* its significant digits */
+    int exponent; /* the power of ten to scale the mantissa by */
+    size_t length; /* characters strtod would consume, 0 if it would fail */
+    cJSON_bool negative;
+    cJSON_bool is_integer; /* no fraction and no exponent */
+    cJSON_bool inexact; /* more than 19 significant digits, or an exponent out of any range */
+} number_literal;
+
+/* Read a number with the grammar strtod uses for the characters parse_number
+ * hands it: [+-] digits [. digits] [(e|E) [+-] digits], with at least one
+ * digit before the exponent, which is only taken if it has digits of its own.
+ * '.' is the decimal point whatever the locale. */
+static void scan_number(number_literal * const literal, const unsigned char * const input, const size_t length)
+{
+    size_t i = 0;
+    size_t digits = 0;
+    int significant = 0;
+
+    memset(literal, 0, sizeof(*literal));
+    literal->is_integer = true;
+
+    if ((i < length) && ((input[i] == '+') || (input[i] == '-')))
+    {
+        literal->negative = (input[i] == '-');
+        i++;
+    }
+    for (; (i < length) && (input[i] >= '0') && (input[i] <= '9'); i++, digits++)
+    {
+        if ((significant == 0) && (input[i] == '0'))
+        {
+            continue; /* leading zero */
+        }
+        if (significant++ < 19)
+        {
+            literal->mantissa = literal->mantissa * 10 + (unsigned long long)(input[i] - '0');
+        }
+    }
+    if ((i < length) && (input[i] == '.'))
+    {
+        literal->is_integer = false;
+        for (i++; (i < length) && (input[i] >= '0') && (input[i] <= '9'); i++, digits++)
+        {
+            if (literal->exponent > -100000)
+            {
+                literal->exponent--;
+            }
+            if ((significant == 0) && (input[i] == '0'))
+            {
+                continue;
+            }
+            if (significant++ < 19)
+            {
+                literal->mantissa = literal->mantissa * 10 + (unsigned long long)(input[i] - '0');
+            }
+        }
+    }
+    if (digits == 0)
+    {
+        return; /* not a number */
+    }
+    if ((i < length) && ((input[i] == 'e') || (input[i] == 'E')))
+    {
+        size_t j = i + 1;
+        int exponent = 0;
+        cJSON_bool negative_exponent = false;
+        if ((j < length) && ((input[j] == '+') || (input[j] == '-')))
+        {
+            negative_exponent = (input[j] == '-');
+            j++;
+        }
+        if ((j < length) && (input[j] >= '0') && (input[j] <= '9'))
+        {
+            for (; (j < length) && (input[j] >= '0') && (input[j] <= '9'); j++)
+            {
+                if (exponent < 100000)
+                {
+                    exponent = exponent * 10 + (input[j] - '0');
+                }
+            }
+            literal->exponent += negative_exponent ? -exponent : exponent;
+            literal->is_integer = false;
+            i = j;
+        }
+    }
+    /* a fraction or exponent this long cannot be scaled exactly here */
+    literal->inexact = (significant > 19) || (literal->exponent <= -100000) || (literal->exponent >= 100000);
+    literal->length = i;
+}
+
+#ifdef CJSON_FAST_NUMBER
+/* The double nearest to the literal, rounding ties to even as strtod does in
+ * the default rounding mode. Returns false where that takes strtod: too many
+ * digits, subnormal or infinite results, and the rare products too close to
+ * a tie to round from 128 bits (Eisel-Lemire, as in Lemire's
+ * fast_double_parser). */
+static cJSON_bool fast_number(const number_literal * const literal, double * const number)
+{
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    unsigned long long mantissa = literal->mantissa;
+    int q = literal->exponent;
+    unsigned long long upper;
+    unsigned long long lower;
+    unsigned long long upper_bit;
+    unsigned long long bits;
+    unsigned __int128 product;
+    const unsigned long long *factor;
+    long long binary_exponent;
+    int leading_zeros;
+    double value;
+
+    if (literal->inexact)
+    {
+        return false;
+    }
+    if (mantissa == 0)
+    {
+        *number = literal->negative ? -0.0 : 0.0;
+        return true;
+    }
+    /* Integers convert exactly, or with one correctly rounded conversion.
+     * Up to 2^53 and 10^22 both factors are exact doubles, so a single
+     * correctly rounded multiply or divide gives the answer (Clinger). */
+    if ((q == 0) || ((mantissa <= (1ULL << 53)) && (q >= -22) && (q <= 22)))
+    {
+        value = (double)mantissa;
+        if (q < 0)
+        {
+            value /= powers_of_ten[-q];
+        }
+        else if (q > 0)
+        {
+            value *= powers_of_ten[q];
+        }
+        *number = literal->negative ? -value : value;
+        return true;
+    }
+
+    if ((q < CJSON_POW5_MIN) || (q > CJSON_POW5_MAX))
+    {
+        return false;
+    }
+    /* 10^q = 5^q * 2^q: multiply the normalized mantissa by 5^q's leading
+     * 128 bits, using the low half only when the high one is inconclusive */
+    leading_zeros = __builtin_clzll(mantissa);
+    mantissa <<= leading_zeros;
+    factor = cjson_pow5[q - CJSON_POW5_MIN];
+    product = (unsigned __int128)mantissa * factor[0];
+    upper = (unsigned long long)(product >> 64);
+    lower = (unsigned long long)product;
+    if (((upper & 0x1FF) == 0x1FF) && (lower + mantissa < lower))
+    {
+        unsigned __int128 second = (unsigned __int128)mantissa * factor[1];
+        unsigned long long middle = lower + (unsigned long long)(second >> 64);
+        if (middle < lower)
+        {
+            upper++;
+        }
+        if ((middle + 1 == 0) && ((upper & 0x1FF) == 0x1FF) && ((unsigned long long)second + mantissa < (unsigned long long)second))
+        {
+            return false;
+        }
+        lower = middle;
+    }
+
+    /* keep 54 bits, one more than the double has, to round with */
+    upper_bit = upper >> 63;
+    bits = upper >> (upper_bit + 9);
+    leading_zeros += (int)(1 ^ upper_bit);
+    binary_exponent = ((((long long)152170 + 65536) * q) >> 16) + 1024 + 63 - leading_zeros;
+    if ((binary_exponent < 1) || (binary_exponent > 2046))
+    {
+        return false;
+    }
+    /* exactly halfway between two doubles: round to even, that is down */
+    if ((lower == 0) && ((upper & 0x1FF) == 0) && ((bits & 3) == 1) && ((bits << (upper_bit + 9)) == upper))
+    {
+        bits &= ~1ULL;
+    }
+    bits += bits & 1;
+    bits >>= 1;
+    if (bits >= (1ULL << 53))
+    {
+        bits = 1ULL << 52; /* rounded up to the next power of two */
+        binary_exponent++;
+    }
+    bits &= ~(1ULL << 52);
+    if (binary_exponent > 2046)
+    {
+        return false;
+    }
+    bits |= (unsigned long long)binary_exponent << 52;
+    bits |= (unsigned long long)(literal->negative ? 1 : 0) << 63;
+    memcpy(number, &bits, sizeof(*number));
+    return true;
+}
+#endif
+
+static void set_parsed_number(cJSON * const item, const double number, const cJSON_bool is_integer)
+{
+    item->valuedouble = number;
+
+    /* use saturation in case of overflow */
+    if (number >= INT_MAX)
+    {
+        item->valueint = INT_MAX;
+    }
+    else if (number <= (double)INT_MIN)
+    {
+        item->valueint = INT_MIN;
+    }
+    else
+    {
+        item->valueint = (int)number;
+    }
+
+    item->type = cJSON_Number | (is_integer ? cJSON_NumberIsInteger : 0);
+}
+
 /* Parse the input text to generate a number, and populate the result into item. */
 static cJSON_bool parse_number(cJSON * const item, parse_buffer * const input_buffer)
 {
@@ -313,12 +544,27 @@ static cJSON_bool parse_number(cJSON * const item, parse_buffer * const input_bu
     size_t i = 0;
     size_t number_string_length = 0;
     cJSON_bool has_decimal_point = false;
+    number_literal literal;
 
     if ((input_buffer == NULL) || (input_buffer->content == NULL))
     {
         return false;
     }
 
+    scan_number(&literal, buffer_at_offset(input_buffer), input_buffer->length - input_buffer->offset);
+    if (literal.length == 0)
+    {
+        return false; /* parse_error */
+    }
+#ifdef CJSON_FAST_NUMBER
+    if (fast_number(&literal, &number))
+    {
+        set_parsed_number(item, number, literal.is_integer);
+        input_buffer->offset += literal.length;
+        return true;
+    }
+#endif
+
     /* copy the number into a temporary buffer and replace '.' with the decimal point
      * of the current locale (for strtod)
      * This also takes care of '\0' not necessarily being available for marking the end of the input */
@@ -383,23 +629,7 @@ loop_end:
         return false; /* parse_error */
     }
 
-    item->valuedouble = number;
-
-    /* use saturation in case of overflow */
-    if (number >= INT_MAX)
-    {
-        item->valueint = INT_MAX;
-    }
-    else if (number <= (double)INT_MIN)
-    {
-        item->valueint = INT_MIN;
-    }
-    else
-    {
-        item->valueint = (int)number;
-    }
-
-    item->type = cJSON_Number;
+    set_parsed_number(item, number, literal.is_integer);
 
     input_buffer->offset += (size_t)(after_end - number_c_string);
     /* free the temporary buffer */
@@ -422,6 +652,7 @@ CJSON_PUBLIC(double) cJSON_SetNumberHelper(cJSON *object, double number)
     {
         object->valueint = (int)number;
     }
+    object->type &= ~cJSON_NumberIsInteger;
 
     return object->valuedouble = number;
 }
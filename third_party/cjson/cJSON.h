@@ -98,6 +98,8 @@ then using the CJSON_API_VISIBILITY flag to "export" the same symbols the way CJ
 
 #define cJSON_IsReference 256
 #define cJSON_StringIsConst 512
+/* set on parsed numbers written without a fraction or exponent */
+#define cJSON_NumberIsInteger 1024
 
 /* The cJSON structure: */
 typedef struct cJSON